@@ -0,0 +1,74 @@
+/**
+ * 07_headless.c - Rendering into memory, with no window or display
+ *
+ * Demonstrates:
+ * - Selecting the headless backend with qgl_headless()
+ * - Rendering frames straight into an application buffer
+ * - Receiving each frame and its damaged area in a callback
+ * - Running uncapped, as servers and benchmarks want
+ *
+ * Renders a few thumbnails and writes them as PPM images.
+ *
+ * To compile:
+ *   cc -o 07_headless 07_headless.c -lqgl
+ */
+
+#include <ttypt/qgl.h>
+#include <stdio.h>
+
+#define THUMB_W 160
+#define THUMB_H 120
+#define THUMBS 4
+
+static uint8_t pixels[THUMB_W * THUMB_H * 4];
+
+/* Called by qgl_flush() once the frame is in `pixels` */
+static void save_thumb(const uint8_t *frame, uint32_t w, uint32_t h,
+                       uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1,
+                       void *ctx)
+{
+	int *index = ctx;
+	char path[64];
+	uint32_t i;
+	FILE *fp;
+
+	(void) x0; (void) y0; (void) x1; (void) y1;
+
+	snprintf(path, sizeof(path), "thumb_%d.ppm", (*index)++);
+	fp = fopen(path, "wb");
+	if (!fp)
+		return;
+
+	/* PPM is RGB, frames are BGRA */
+	fprintf(fp, "P6\n%u %u\n255\n", w, h);
+	for (i = 0; i < w * h; i++) {
+		fputc(frame[i * 4 + 2], fp);
+		fputc(frame[i * 4 + 1], fp);
+		fputc(frame[i * 4], fp);
+	}
+
+	fclose(fp);
+	printf("Wrote %s\n", path);
+}
+
+int main(void)
+{
+	int index = 0;
+	int i;
+
+	/* Must come before qgl_init() */
+	qgl_headless(THUMB_W, THUMB_H, pixels, save_thumb, &index);
+	qgl_init();
+
+	/* There is no display: don't wait between frames */
+	qgl_pace(QGL_PACE_UNCAPPED, 0);
+
+	for (i = 0; i < THUMBS; i++) {
+		qgl_fill(0, 0, THUMB_W, THUMB_H, 0xFF202020);
+		qgl_fill(10 + i * 20, 10, 60, 40, 0xFF0000FF);
+		qgl_fill(20, 60 + i * 10, 120, 30, 0x8000FF00);
+		qgl_flush();
+	}
+
+	return 0;
+}
@@ -0,0 +1,149 @@
+#ifndef QGL_BUNDLE_H
+#define QGL_BUNDLE_H
+
+/**
+ * @file qgl-bundle.h
+ * @brief Packed asset bundles.
+ *
+ * A bundle is one file holding textures already packed into atlas
+ * pages, the tilemaps and fonts made from them, and an index of
+ * their names. mkbundle.py builds them offline; qgl_bundle_open()
+ * maps one and registers everything in it with one upload per page.
+ *
+ * The file is little-endian and starts with a qgl_bundle_header_t.
+ * The tables it points to are arrays of the types below. Names are
+ * offsets of NUL-terminated strings in the string table. Page pixels
+ * are RGBA, top row first, and start on 4096-byte boundaries.
+ *
+ * The index is an open-addressed hash table of `nindex` slots, a
+ * power of two. An entry of type `t` named `s` is found by probing
+ * linearly from slot `qgl_bundle_hash(t, s) & (nindex - 1)` until
+ * its slot or an empty one (`hash` 0).
+ */
+
+#include <stdint.h>
+
+#define QGL_BUNDLE_MAGIC 0x42474c51u	/* "QGLB" */
+#define QGL_BUNDLE_VERSION 1
+#define QGL_BUNDLE_ALIGN 4096
+
+/**
+ * @brief Kinds of assets in a bundle.
+ */
+typedef enum {
+	QGL_ASSET_TEX,		/**< A texture, one rect of a page. */
+	QGL_ASSET_TM,		/**< A tilemap over a texture. */
+	QGL_ASSET_FONT,		/**< A bitmap font over a texture. */
+} qgl_asset_t;
+
+/**
+ * @brief Start of a bundle file.
+ */
+typedef struct {
+	uint32_t magic;		/**< QGL_BUNDLE_MAGIC. */
+	uint32_t version;	/**< QGL_BUNDLE_VERSION. */
+	uint32_t npages, ntex, ntm, nfont;
+	uint32_t nindex;	/**< Index slots, a power of two. */
+	uint32_t strings_size;	/**< Bytes in the string table. */
+	uint64_t pages;		/**< Offset of the qgl_bundle_page_t table. */
+	uint64_t tex;		/**< Offset of the qgl_bundle_tex_t table. */
+	uint64_t tm;		/**< Offset of the qgl_bundle_tm_t table. */
+	uint64_t font;		/**< Offset of the qgl_bundle_font_t table. */
+	uint64_t index;		/**< Offset of the qgl_bundle_slot_t table. */
+	uint64_t strings;	/**< Offset of the string table. */
+} qgl_bundle_header_t;
+
+/**
+ * @brief An atlas page.
+ */
+typedef struct {
+	uint32_t w, h;
+	uint64_t data;		/**< Offset of its pixels. */
+} qgl_bundle_page_t;
+
+/**
+ * @brief A texture: a rect of a page.
+ */
+typedef struct {
+	uint32_t name;
+	uint32_t page;
+	uint32_t x, y, w, h;
+} qgl_bundle_tex_t;
+
+/**
+ * @brief A tilemap, as qgl_tm_new() takes it.
+ */
+typedef struct {
+	uint32_t name;
+	uint32_t tex;		/**< Index in the texture table. */
+	uint32_t w, h;		/**< Tile size. */
+} qgl_bundle_tm_t;
+
+/**
+ * @brief A bitmap font, as qgl_font_new() takes it.
+ */
+typedef struct {
+	uint32_t name;
+	uint32_t tex;		/**< Index in the texture table. */
+	uint32_t cell_w, cell_h;
+	uint8_t first, last;
+	uint16_t pad;
+} qgl_bundle_font_t;
+
+/**
+ * @brief A slot of the name index.
+ */
+typedef struct {
+	uint64_t hash;		/**< qgl_bundle_hash(), 0 if empty. */
+	uint32_t type;		/**< qgl_asset_t. */
+	uint32_t item;		/**< Index in the table of that type. */
+} qgl_bundle_slot_t;
+
+/**
+ * @brief Hash of an index key: FNV-1a over the type byte and the
+ *        name, never 0.
+ */
+static inline uint64_t qgl_bundle_hash(uint32_t type, const char *name)
+{
+	uint64_t h = 0xcbf29ce484222325ull;
+
+	h = (h ^ (uint8_t) type) * 0x100000001b3ull;
+	while (*name)
+		h = (h ^ (uint8_t) *name++) * 0x100000001b3ull;
+
+	return h ? h : 1;
+}
+
+/**
+ * @brief Open an asset bundle.
+ *
+ * Maps the file, uploads each atlas page once, and registers every
+ * texture, tilemap and font in it. Textures are also registered
+ * under their names, so qgl_tex_load() and qgl_font_open() of a
+ * name in the bundle return its texture without touching the disk.
+ * Call after qgl_init().
+ *
+ * @param[in] path Bundle file.
+ * @return Bundle handle, or QM_MISS if it can't be read.
+ */
+uint32_t qgl_bundle_open(const char *path);
+
+/**
+ * @brief Look up an asset of a bundle.
+ *
+ * @param[in] bundle Bundle handle.
+ * @param[in] type   Kind of asset.
+ * @param[in] name   Its name.
+ * @return The texture, tilemap or font handle, or QM_MISS.
+ */
+uint32_t qgl_bundle_ref(uint32_t bundle, qgl_asset_t type,
+                        const char *name);
+
+/**
+ * @brief Release a bundle and everything it registered.
+ *
+ * @param[in] bundle Bundle handle.
+ */
+void qgl_bundle_close(uint32_t bundle);
+
+#endif
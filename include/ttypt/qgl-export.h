@@ -0,0 +1,78 @@
+#ifndef QGL_EXPORT_H
+#define QGL_EXPORT_H
+
+/**
+ * @file qgl-export.h
+ * @brief Shared-memory frame export.
+ *
+ * qgl_export() publishes every frame qgl_flush() presents into a
+ * ring of slots in a memfd, and signals an eventfd after each one,
+ * so another process (a recorder, a compositor) can map the memfd
+ * read-only and read frames in place.
+ *
+ * The map starts with a qgl_export_header_t. Frame `n` (counted
+ * from 1) lives in slot `n % nslots`: its description in
+ * `slot[n % nslots]`, its pixels at `data_offset + (n % nslots) *
+ * slot_size`, BGRA, top row first, `stride` bytes per row. Every
+ * slot holds a whole frame.
+ *
+ * Slots are overwritten as the ring wraps, so readers check them
+ * like a seqlock: load `seq` (acquire), skip the slot if it is odd,
+ * read the pixels, then load `seq` again after an acquire fence;
+ * if it changed, the frame was overwritten meanwhile. `latest` is
+ * the last frame published.
+ *
+ * This header only describes the layout and can be used without
+ * linking against qgl.
+ */
+
+#include <stdint.h>
+
+#define QGL_EXPORT_MAGIC 0x58474c51u	/* "QGLX" */
+#define QGL_EXPORT_VERSION 1
+#define QGL_EXPORT_SLOTS_MAX 8
+
+/**
+ * @brief One frame in the ring.
+ */
+typedef struct {
+	uint64_t seq;		/**< Odd while the slot is being written. */
+	uint64_t frame;		/**< Frame number, from 1. */
+	uint64_t time_ns;	/**< CLOCK_MONOTONIC when published. */
+	/** Area changed since the previous frame (x1, y1 exclusive). */
+	uint32_t x0, y0, x1, y1;
+} qgl_export_slot_t;
+
+/**
+ * @brief Start of the shared memory.
+ */
+typedef struct {
+	uint32_t magic;		/**< QGL_EXPORT_MAGIC. */
+	uint32_t version;	/**< QGL_EXPORT_VERSION. */
+	uint32_t width, height;	/**< Frame size in pixels. */
+	uint32_t stride;	/**< Bytes per row. */
+	uint32_t nslots;	/**< Slots in the ring. */
+	uint64_t data_offset;	/**< Offset of slot 0's pixels. */
+	uint64_t slot_size;	/**< Bytes from one slot's pixels to the next. */
+	uint64_t latest;	/**< Last frame published, 0 before any. */
+	qgl_export_slot_t slot[QGL_EXPORT_SLOTS_MAX];
+} qgl_export_header_t;
+
+/**
+ * @brief Publish frames to shared memory.
+ *
+ * Call after qgl_init(). Works alongside any backend: frames are
+ * taken from the memory the backend presents from, or read from
+ * the GPU when it has none. Calling it again returns the same
+ * descriptors. Both are close-on-exec and owned by the library;
+ * pass them to the consumer over a UNIX socket, or dup them.
+ *
+ * @param[in]  slots    Frames in the ring (2 to QGL_EXPORT_SLOTS_MAX).
+ * @param[out] mem_fd   The memfd holding the ring.
+ * @param[out] event_fd An eventfd counting frames published.
+ *
+ * @return 0 on success, -1 with errno set on failure.
+ */
+int qgl_export(uint32_t slots, int *mem_fd, int *event_fd);
+
+#endif
@@ -36,6 +36,25 @@ uint32_t qgl_font_open(const char *png_path,
 		       uint8_t first,
 		       uint8_t last);
 
+/**
+ * @brief Make a bitmap font from a loaded texture.
+ *
+ * Like qgl_font_open(), for an atlas that is already a texture,
+ * such as one from an asset bundle.
+ *
+ * @param[in] img_ref  Texture reference of the font atlas.
+ * @param[in] cell_w   Width of each glyph cell.
+ * @param[in] cell_h   Height of each glyph cell.
+ * @param[in] first    First character code in the atlas.
+ * @param[in] last     Last character code in the atlas.
+ * @return Font handle (font_ref) or QM_MISS on error.
+ */
+uint32_t qgl_font_new(uint32_t img_ref,
+		      unsigned cell_w,
+		      unsigned cell_h,
+		      uint8_t first,
+		      uint8_t last);
+
 /**
  * @brief Unload a font and free its resources.
  *
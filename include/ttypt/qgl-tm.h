@@ -54,6 +54,15 @@ uint32_t qgl_tm_new(uint32_t img_ref,
 		    uint32_t w,
 		    uint32_t h);
 
+/**
+ * @brief Release a tilemap.
+ *
+ * The image it was made from is left alone.
+ *
+ * @param[in] tm_ref Tilemap handle.
+ */
+void qgl_tm_del(uint32_t tm_ref);
+
 /**
  * @brief Retrieve a tilemap descriptor.
  *
@@ -69,6 +69,112 @@ void qgl_size(uint32_t *width, uint32_t *height);
  */
 void qgl_init(void);
 
+/**
+ * @brief Headless frame callback, see qgl_headless().
+ *
+ * @param[in] pixels    The frame, BGRA, top row first, width * 4
+ *                      bytes per row.
+ * @param[in] w,h       Frame size in pixels.
+ * @param[in] x0,y0     Top-left corner of the area that changed.
+ * @param[in] x1,y1     Bottom-right corner (exclusive); x0 == x1
+ *                      when nothing did.
+ * @param[in] ctx       Pointer given to qgl_headless().
+ */
+typedef void qgl_frame_cb_t(const uint8_t *pixels,
+                            uint32_t w, uint32_t h,
+                            uint32_t x0, uint32_t y0,
+                            uint32_t x1, uint32_t y1,
+                            void *ctx);
+
+/**
+ * @brief Render into memory, with no window or display.
+ *
+ * Switches to the headless backend, which renders through a
+ * surfaceless EGL context (Linux). Call it before qgl_init(). It is
+ * also picked when QGL_BACKEND=headless is set, or when there is
+ * neither a display nor a framebuffer device.
+ *
+ * Each qgl_flush() reads the area drawn into `pixels`, or into an
+ * internal buffer if it is NULL, then calls `cb`. With neither,
+ * frames are rendered and never read back. There is no display to
+ * wait for, so QGL_PACE_VSYNC doesn't wait.
+ *
+ * @param[in] w,h    Frame size in pixels (0 keeps the default).
+ * @param[out] pixels BGRA buffer of w * h * 4 bytes, or NULL.
+ * @param[in] cb     Called after every frame, or NULL.
+ * @param[in] ctx    Passed to `cb`.
+ */
+void qgl_headless(uint32_t w, uint32_t h, void *pixels,
+                  qgl_frame_cb_t *cb, void *ctx);
+
+/**
+ * @brief Tunables, see qgl_hint().
+ */
+typedef enum {
+	/**
+	 * Textures no larger than this many pixels on either side
+	 * are packed into shared atlas pages. 0 (default) disables it.
+	 */
+	QGL_HINT_ATLAS,
+	/** Side of an atlas page in pixels (default 2048). */
+	QGL_HINT_ATLAS_PAGE,
+	/**
+	 * Non-zero keeps each frame as the starting point of the next:
+	 * qgl_flush() no longer clears, and only reads back and
+	 * presents the area drawn since the last one (see qgl_damage()).
+	 */
+	QGL_HINT_RETAIN,
+	/**
+	 * Non-zero, when set before qgl_init(), reads frames back
+	 * without waiting for the GPU: each one is fetched while the
+	 * next renders, and presented one frame late. Only matters to
+	 * backends that present from memory (fbdev).
+	 */
+	QGL_HINT_ASYNC_READBACK,
+	/**
+	 * Non-zero, when set before qgl_init(), applies ordered
+	 * dithering when presenting to 16-bit framebuffers.
+	 */
+	QGL_HINT_DITHER,
+	/**
+	 * Frames that may wait for presentation, when set before
+	 * qgl_init(). Non-zero moves the fbdev copy, vsync wait and
+	 * page flip to a thread of their own, and qgl_flush() only
+	 * waits when that many frames are pending. 0 (the default)
+	 * presents within qgl_flush().
+	 */
+	QGL_HINT_PRESENT_QUEUE,
+	/**
+	 * Non-zero makes a full present queue drop its oldest frame
+	 * instead of waiting (see QGL_STAT_DROPPED).
+	 */
+	QGL_HINT_PRESENT_DROP,
+	/**
+	 * Threads decoding textures for qgl_tex_load_async(), read
+	 * when the first one starts. 0 (default) uses one less than
+	 * the number of CPUs, at most 8.
+	 */
+	QGL_HINT_LOAD_THREADS,
+	/**
+	 * Microseconds each qgl_flush() may spend uploading textures
+	 * loaded with qgl_tex_load_async() (default 2000). At least
+	 * one is uploaded per frame.
+	 */
+	QGL_HINT_UPLOAD_US,
+	QGL_HINT_MAX,
+} qgl_hint_t;
+
+/**
+ * @brief Set a tunable.
+ *
+ * Hints are read when the feature they control is first used,
+ * so set them before qgl_init() and before loading textures.
+ *
+ * @param[in] hint  Tunable to set.
+ * @param[in] value Its new value.
+ */
+void qgl_hint(qgl_hint_t hint, int value);
+
 /** Default white RGBA tint (no color modulation). */
 static const uint32_t qgl_default_tint = 0xFFFFFFFF;
 
@@ -131,9 +237,278 @@ void qgl_fill(int32_t x, int32_t y,
  *
  * Flushes pending draw commands and updates the visible frame
  * through the active backend (OpenGL swap, FB copy, etc.).
+ *
+ * Draw calls are batched: consecutive qgl_fill(), texture,
+ * rounded-rect and shadow draws are gathered and submitted
+ * together, and only reach the GPU when the texture or shader
+ * changes or at this call.
+ *
+ * Backends that present straight from the GPU (GLFW) skip the
+ * readback; use qgl_capture() to get the pixels there.
  */
 void qgl_flush(void);
 
+/**
+ * @brief Read the screen back into memory.
+ *
+ * Flushes pending draw commands and copies what has been drawn so
+ * far this frame, top row first.
+ *
+ * @param[out] pixels BGRA buffer of qgl_size() width times height
+ *                    times 4 bytes.
+ */
+void qgl_capture(void *pixels);
+
+/**
+ * @brief Restrict drawing to a rectangle.
+ *
+ * Intersects the rectangle with the current clip and makes the
+ * result the new clip, until the matching qgl_clip_pop(). Draws
+ * are trimmed to it before they are batched, and draws entirely
+ * outside it (or outside the render target) are dropped, so
+ * clipping never costs a draw call. Clips apply to the render
+ * target they were pushed on. Command lists and other threads'
+ * recordings are clipped when they are drawn.
+ *
+ * @param[in] x,y Top-left corner in pixels.
+ * @param[in] w,h Size in pixels.
+ */
+void qgl_clip_push(int32_t x, int32_t y, uint32_t w, uint32_t h);
+
+/**
+ * @brief Restore the clip in effect before the last qgl_clip_push().
+ */
+void qgl_clip_pop(void);
+
+/** Layer value for drawing in call order (the default), see qgl_layer(). */
+#define QGL_LAYER_NONE 0xFFFFFFFFu
+
+/** Or'd into a layer to keep call order inside it, see qgl_layer(). */
+#define QGL_LAYER_STRICT 0x10000u
+
+/**
+ * @brief Defer subsequent draws into a layer.
+ *
+ * Layered draws are queued and submitted at the next qgl_flush(),
+ * render-target change or texture upload: layers in ascending
+ * order (0 to 0xFFFF), and inside a layer grouped by shader and
+ * texture, so interleaved draws (tiles, glyphs, tiles) share draw
+ * calls. Overlapping draws with a different shader or texture may
+ * swap places within a layer; give them separate layers, or or the
+ * layer with QGL_LAYER_STRICT, where overlap matters.
+ *
+ * Setting QGL_LAYER_NONE submits what was queued and goes back to
+ * drawing in call order.
+ *
+ * @param[in] layer Layer key, or QGL_LAYER_NONE.
+ */
+void qgl_layer(uint32_t layer);
+
+/**
+ * @brief Start recording a command list.
+ *
+ * Until qgl_cmdlist_end(), fills, texture, rounded-rect and
+ * shadow draws aimed at the current render target are kept in
+ * the list instead of being drawn. Static content (menus, tile
+ * backgrounds, HUD frames) can then be replayed every frame
+ * without redoing the work that produced it.
+ *
+ * The list refers to textures by their GL names, so re-record
+ * it after unregistering a texture it draws.
+ */
+void qgl_cmdlist_begin(void);
+
+/**
+ * @brief Stop recording.
+ *
+ * @return Command list reference, QM_MISS if not recording.
+ */
+unsigned qgl_cmdlist_end(void);
+
+/**
+ * @brief Draw a recorded command list.
+ *
+ * Quads go straight into the batch, already resolved.
+ *
+ * @param[in] ref   Command list reference.
+ * @param[in] dx,dy Offset added to every quad, in pixels.
+ * @param[in] tint  RGBA multiplier applied to every quad's color.
+ */
+void qgl_cmdlist_replay(unsigned ref, int32_t dx, int32_t dy,
+                        uint32_t tint);
+
+/**
+ * @brief Release a command list. Its reference becomes invalid.
+ *
+ * @param[in] ref Command list reference.
+ */
+void qgl_cmdlist_free(unsigned ref);
+
+/**
+ * @brief Start recording this thread's draws.
+ *
+ * Any thread may call this. Until qgl_record_end(), fills,
+ * texture, tile, text, rounded-rect and shadow draws made on the
+ * calling thread go to a buffer of its own, without locking or, once
+ * warm, allocating. Drawing that touches GL directly (loading
+ * textures, qui_render() caches) still belongs on the GL thread.
+ * Recording reads the texture, tilemap and font tables, so don't
+ * create or release any of those while other threads record.
+ * qgl_flush() finishing a qgl_tex_load_async() is fine, as the load
+ * made room for the texture when it was queued; just don't draw it
+ * from a recording thread before qgl_tex_ready() says it is ready.
+ *
+ * @param[in] order Position of this thread's draws in
+ *                  qgl_record_submit(); lower goes first.
+ */
+void qgl_record_begin(uint32_t order);
+
+/**
+ * @brief Publish what this thread recorded.
+ *
+ * Replaces anything the thread published earlier that has not been
+ * submitted yet.
+ */
+void qgl_record_end(void);
+
+/**
+ * @brief Draw every thread's latest recording.
+ *
+ * Must be called on the GL thread. Recordings are drawn in
+ * ascending order, equal orders in the order their threads first
+ * called qgl_record_begin(). A thread that published nothing new
+ * since the last call has its previous recording drawn again, so
+ * publish an empty one to clear it (before exiting, for a thread
+ * that stops drawing).
+ */
+void qgl_record_submit(void);
+
+/**
+ * @brief Clear part of the screen and mark it for presentation.
+ *
+ * Every draw to the screen marks its bounds as damaged, and under
+ * QGL_HINT_RETAIN only the bounding box of the damage is read back
+ * and presented. To update a region, damage it, then redraw what
+ * covers it inside qgl_clip_push() of the same rectangle; everything
+ * outside is dropped before it reaches the GPU.
+ *
+ * @param[in] x,y Top-left corner in pixels.
+ * @param[in] w,h Size in pixels.
+ */
+void qgl_damage(int32_t x, int32_t y, uint32_t w, uint32_t h);
+
+/**
+ * @brief Frame pacing modes, see qgl_pace().
+ */
+typedef enum {
+	QGL_PACE_VSYNC,     /**< Present on the display refresh (default). */
+	QGL_PACE_UNCAPPED,  /**< Never wait, for benchmarks. */
+	QGL_PACE_FIXED,     /**< Present at a fixed rate. */
+	QGL_PACE_ADAPTIVE,  /**< Fixed rate, divided while frames miss it. */
+} qgl_pace_t;
+
+/**
+ * @brief Choose how qgl_flush() paces frames.
+ *
+ * Timed modes wait for a monotonic timer. Without a way to wait for
+ * the display, QGL_PACE_VSYNC falls back to 60 Hz (headless, it
+ * doesn't wait at all). While the window
+ * is hidden every mode is throttled.
+ *
+ * @param[in] mode Pacing mode.
+ * @param[in] hz   Target rate for the timed modes (0 for 60).
+ */
+void qgl_pace(qgl_pace_t mode, uint32_t hz);
+
+/**
+ * @brief Sleep until the latest moment to start the next frame.
+ *
+ * Predicts the next deadline from the measured frame rate and the
+ * time frames take to draw. Call it right before qgl_poll(), so
+ * input is read as close to presentation as possible.
+ */
+void qgl_pace_wait(void);
+
+/**
+ * @brief Video formats, see qgl_video_open().
+ */
+typedef enum {
+	/**
+	 * YUV4MPEG2, 4:2:0 with BT.601 limited range, at a fixed
+	 * frame rate. Most players and encoders read it.
+	 */
+	QGL_VIDEO_Y4M,
+	/**
+	 * Header "QGLV", then version, width, height and fps as
+	 * 32-bit words; each frame is its number and CLOCK_MONOTONIC
+	 * time in nanoseconds as 64-bit words, then width * height
+	 * BGRA pixels, top row first. Lossless, and keeps the real
+	 * timing. All words are host byte order.
+	 */
+	QGL_VIDEO_RAW,
+} qgl_video_fmt_t;
+
+/**
+ * @brief Record presented frames to a file.
+ *
+ * qgl_flush() copies each frame it presents (only the area that
+ * changed) into one of `depth` buffers, and a worker thread converts
+ * and writes them out, so the render loop never waits on the disk.
+ * When every buffer is still waiting to be written, the frame is
+ * dropped instead (see QGL_STAT_VIDEO_DROPPED).
+ *
+ * @param[in] path     File to create or truncate.
+ * @param[in] fmt      Video format.
+ * @param[in] fps      Frame rate in the Y4M header (0 for 60).
+ * @param[in] depth    Frames that may wait for the writer (0 for 4).
+ * @param[in] compress Non-zero compresses the file at the fastest
+ *                     level: an LZ4 frame stream when the library is
+ *                     built with LZ4=1, gzip otherwise.
+ *
+ * @return 0 on success, -1 if the file can't be opened or a
+ *         recording is already running.
+ */
+int qgl_video_open(const char *path, qgl_video_fmt_t fmt, uint32_t fps,
+                   uint32_t depth, int compress);
+
+/**
+ * @brief Stop recording.
+ *
+ * Writes out the frames still queued and closes the file.
+ *
+ * @return Frames dropped over the whole recording.
+ */
+uint64_t qgl_video_close(void);
+
+/**
+ * @brief Renderer statistics, see qgl_stat().
+ */
+typedef enum {
+	QGL_STAT_DRAW_CALLS, /**< GL draw calls issued for batched quads. */
+	QGL_STAT_QUADS,      /**< Quads submitted through the batch. */
+	QGL_STAT_RING_WAITS, /**< Times the CPU waited on the GPU for vertex space. */
+	QGL_STAT_GL_SKIPPED, /**< Redundant GL state changes that were skipped. */
+	QGL_STAT_CULLED,     /**< Quads dropped for lying outside the clip or target. */
+	QGL_STAT_PRESENTED,  /**< Pixels of the damaged area handed to the backend. */
+	QGL_STAT_FB_ROWS,    /**< Framebuffer rows the fbdev backend wrote. */
+	QGL_STAT_DROPPED,    /**< Frames dropped from a full present queue. */
+	QGL_STAT_FRAME_NS,   /**< Nanoseconds since the frame before was presented. */
+	QGL_STAT_MISSED,     /**< Frames presented after their paced deadline. */
+	QGL_STAT_VIDEO_DROPPED, /**< Frames the recorder had no room for. */
+	QGL_STAT_MAX,
+} qgl_stat_t;
+
+/**
+ * @brief Read a renderer statistic for the last presented frame.
+ *
+ * Counters accumulate while a frame is drawn and are latched
+ * by qgl_flush().
+ *
+ * @param[in] stat Statistic to read.
+ * @return         Its value for the previous frame, 0 if unknown.
+ */
+uint64_t qgl_stat(qgl_stat_t stat);
+
 /** @} */
 
 
@@ -185,6 +560,71 @@ void qgl_tex_draw(uint32_t ref,
  */
 unsigned qgl_tex_load(const char *filename);
 
+/**
+ * @brief Called once a texture loaded with qgl_tex_load_async() is
+ *        ready, or failed to load.
+ *
+ * @param[in] ref Texture reference ID.
+ * @param[in] ok  Non-zero if the texture loaded.
+ * @param[in] ctx Pointer given to qgl_tex_load_async().
+ */
+typedef void qgl_tex_cb_t(unsigned ref, int ok, void *ctx);
+
+/**
+ * @brief Load an image file into a texture in the background.
+ *
+ * Returns at once; the file is decoded by a pool of worker threads
+ * (see QGL_HINT_LOAD_THREADS), and qgl_flush() uploads finished ones
+ * within a time budget (see QGL_HINT_UPLOAD_US). Until then the
+ * texture has size 0 and drawing it does nothing. Loading a file
+ * that is already loaded or loading returns the same reference.
+ * Queueing a load creates a texture, as far as threads recording
+ * with qgl_record_begin() are concerned, but finishing it doesn't.
+ *
+ * @param[in] filename Path to the image file.
+ * @param[in] cb       Called from qgl_flush() or qgl_tex_wait() when
+ *                     done, or NULL.
+ * @param[in] ctx      Passed to `cb`.
+ * @return Texture reference ID.
+ */
+unsigned qgl_tex_load_async(const char *filename,
+                            qgl_tex_cb_t *cb, void *ctx);
+
+/**
+ * @brief Whether a texture can be drawn yet.
+ *
+ * @param[in] ref Texture reference ID.
+ * @return 1 if loaded, 0 while loading, -1 if loading failed or the
+ *         reference is stale.
+ */
+int qgl_tex_ready(unsigned ref);
+
+/**
+ * @brief Finish every pending qgl_tex_load_async(), ignoring the
+ *        upload budget.
+ */
+void qgl_tex_wait(void);
+
+/**
+ * @brief Cache decoded textures on disk.
+ *
+ * Images decoded from then on are also stored as raw pixels in
+ * `dir`, and loading the same file again, in this process or a
+ * later one, maps the stored pixels instead of decoding. An entry
+ * is used while its source keeps the same size and mtime, or the
+ * same content hash if only the mtime changed; otherwise the file
+ * is decoded and the entry replaced. When the directory grows past
+ * `max_bytes`, the entries used longest ago are removed.
+ *
+ * Call before loading textures. Not supported on Windows.
+ *
+ * @param[in] dir       Cache directory, created if missing, or NULL
+ *                      to stop caching.
+ * @param[in] max_bytes Size cap of the directory, or 0 for none.
+ * @return 0 on success, -1 with errno set on failure.
+ */
+int qgl_tex_cache(const char *dir, uint64_t max_bytes);
+
 /**
  * @brief Save a texture to disk (if supported by backend).
  *
@@ -221,6 +661,28 @@ void qgl_tex_paint(unsigned ref,
                    uint32_t x, uint32_t y,
                    uint32_t color);
 
+/**
+ * @brief Texture atlas usage, see qgl_atlas_stats().
+ */
+typedef struct {
+	uint32_t pages;     /**< Atlas pages allocated. */
+	uint32_t textures;  /**< Textures living in the atlas. */
+	uint64_t page_area; /**< Texels across all pages. */
+	uint64_t used_area; /**< Texels held by live textures. */
+	uint64_t lost_area; /**< Packed texels not held by live textures. */
+} qgl_atlas_stats_t;
+
+/**
+ * @brief Report how full the texture atlas is.
+ *
+ * used_area / page_area is the occupancy; lost_area counts
+ * gutters, packing gaps and space of textures since freed,
+ * which is only reclaimed once a page empties.
+ *
+ * @param[out] stats Filled with the current figures.
+ */
+void qgl_atlas_stats(qgl_atlas_stats_t *stats);
+
 /**
  * @brief Apply a global color tint to future draw calls.
  *
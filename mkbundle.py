@@ -0,0 +1,174 @@
+#!/usr/bin/env python3
+"""
+mkbundle.py - Pack textures, tilemaps and fonts into a QGL asset bundle
+
+The manifest has one asset per line ('#' starts a comment):
+
+    tex  PATH
+    tm   NAME PATH TILE_W TILE_H
+    font NAME PATH CELL_W CELL_H [FIRST LAST]
+
+Textures are named by PATH as written, so qgl_tex_load(PATH) finds
+them once the bundle is open. Tilemaps and fonts add their PATH as a
+texture too. See include/ttypt/qgl-bundle.h for the file layout.
+"""
+
+from PIL import Image
+import struct, sys
+
+MAGIC = 0x42474c51
+VERSION = 1
+ALIGN = 4096
+PAD = 1  # transparent gutter, as the runtime atlas leaves
+
+TEX, TM, FONT = 0, 1, 2
+
+if len(sys.argv) < 3:
+    print("Usage: mkbundle.py manifest output.qglb [page_size]")
+    sys.exit(1)
+
+manifest_path = sys.argv[1]
+output_path = sys.argv[2]
+page_size = int(sys.argv[3]) if len(sys.argv) > 3 else 2048
+
+texs = {}   # path -> index
+images = []
+tms = []
+fonts = []
+
+def add_tex(path):
+    if path not in texs:
+        texs[path] = len(images)
+        images.append(Image.open(path).convert("RGBA"))
+    return texs[path]
+
+with open(manifest_path) as f:
+    for n, line in enumerate(f, 1):
+        words = line.split("#", 1)[0].split()
+        if not words:
+            continue
+
+        kind, args = words[0], words[1:]
+        if kind == "tex" and len(args) == 1:
+            add_tex(args[0])
+        elif kind == "tm" and len(args) == 4:
+            tms.append((args[0], add_tex(args[1]), int(args[2]), int(args[3])))
+        elif kind == "font" and len(args) in (4, 6):
+            first, last = (int(args[4]), int(args[5])) if len(args) == 6 else (0, 255)
+            fonts.append((args[0], add_tex(args[1]),
+                          int(args[2]), int(args[3]), first, last))
+        else:
+            print(f"Error: {manifest_path}:{n}: bad line")
+            sys.exit(1)
+
+# Shelf packing, tallest first: each page is filled with rows as tall
+# as their first image. Images too big for a page get one of their own.
+pages = []      # [w, h, [(tex, x, y)]]
+rects = [None] * len(images)
+order = sorted(range(len(images)), key=lambda i: -images[i].height)
+
+shelf_x = shelf_y = shelf_h = 0
+cur = None
+for i in order:
+    w, h = images[i].size
+    if w + PAD > page_size or h + PAD > page_size:
+        pages.append([w, h, [(i, 0, 0)]])
+        rects[i] = (len(pages) - 1, 0, 0)
+        continue
+
+    if cur is None or shelf_x + w + PAD > page_size:
+        shelf_y += shelf_h
+        shelf_x, shelf_h = 0, h + PAD
+    if cur is None or shelf_y + h + PAD > page_size:
+        cur = [0, 0, []]
+        pages.append(cur)
+        shelf_x = shelf_y = 0
+        shelf_h = h + PAD
+
+    cur[2].append((i, shelf_x, shelf_y))
+    rects[i] = (pages.index(cur), shelf_x, shelf_y)
+    cur[0] = max(cur[0], shelf_x + w)
+    cur[1] = max(cur[1], shelf_y + h)
+    shelf_x += w + PAD
+
+# Strings
+strings = bytearray()
+def add_str(s):
+    off = len(strings)
+    strings.extend(s.encode() + b"\0")
+    return off
+
+tex_names = [None] * len(images)
+for path, i in texs.items():
+    tex_names[i] = add_str(path)
+
+# Name index
+def key_hash(kind, name):
+    h = 0xcbf29ce484222325
+    for c in bytes([kind]) + name.encode():
+        h = ((h ^ c) * 0x100000001b3) & 0xffffffffffffffff
+    return h or 1
+
+keys = [(TEX, path, i) for path, i in texs.items()]
+keys += [(TM, t[0], i) for i, t in enumerate(tms)]
+keys += [(FONT, f[0], i) for i, f in enumerate(fonts)]
+
+nindex = 2
+while nindex < 2 * len(keys):
+    nindex *= 2
+index = [(0, 0, 0)] * nindex
+for kind, name, item in keys:
+    h = key_hash(kind, name)
+    slot = h & (nindex - 1)
+    while index[slot][0]:
+        slot = (slot + 1) & (nindex - 1)
+    index[slot] = (h, kind, item)
+
+tm_recs = [(add_str(name), tex, w, h) for name, tex, w, h in tms]
+font_recs = [(add_str(name), tex, cw, ch, first, last)
+             for name, tex, cw, ch, first, last in fonts]
+
+# Layout: header, tables, strings, then page-aligned pixels
+HEADER = "<8I6Q"
+off_pages = struct.calcsize(HEADER)
+off_tex = off_pages + 16 * len(pages)
+off_tm = off_tex + 24 * len(images)
+off_font = off_tm + 16 * len(tm_recs)
+off_index = off_font + 20 * len(font_recs)
+off_strings = off_index + 16 * nindex
+end = off_strings + len(strings)
+
+page_data = []
+for w, h, _ in pages:
+    end = (end + ALIGN - 1) // ALIGN * ALIGN
+    page_data.append(end)
+    end += w * h * 4
+
+with open(output_path, "wb") as out:
+    out.write(struct.pack(HEADER, MAGIC, VERSION, len(pages), len(images),
+                          len(tm_recs), len(font_recs), nindex, len(strings),
+                          off_pages, off_tex, off_tm, off_font, off_index,
+                          off_strings))
+    for (w, h, _), data in zip(pages, page_data):
+        out.write(struct.pack("<2IQ", w, h, data))
+    for i, img in enumerate(images):
+        page, x, y = rects[i]
+        out.write(struct.pack("<6I", tex_names[i], page, x, y,
+                              img.width, img.height))
+    for rec in tm_recs:
+        out.write(struct.pack("<4I", *rec))
+    for rec in font_recs:
+        out.write(struct.pack("<4I2BH", *rec, 0))
+    for h, kind, item in index:
+        out.write(struct.pack("<Q2I", h, kind, item))
+    out.write(strings)
+
+    for (w, h, placed), data in zip(pages, page_data):
+        page = Image.new("RGBA", (w, h), (0, 0, 0, 0))
+        for i, x, y in placed:
+            page.paste(images[i], (x, y))
+        out.seek(data)
+        out.write(page.tobytes())
+
+print(f"Saved {output_path} ({len(pages)} pages, {len(images)} textures, "
+      f"{len(tm_recs)} tilemaps, {len(font_recs)} fonts)")
@@ -1,9 +1,24 @@
 CFLAGS-libqgl-o := -fPIC
 CFLAGS-glfw-o := -fPIC
 CFLAGS-img-o := -fPIC
+CFLAGS-img-async-o := -fPIC
+CFLAGS-img-cache-o := -fPIC
 CFLAGS-png-o := -fPIC
+CFLAGS-atlas-o := -fPIC
+CFLAGS-state-o := -fPIC
+CFLAGS-handle-o := -fPIC
+CFLAGS-layer-o := -fPIC
+CFLAGS-record-o := -fPIC
+CFLAGS-clip-o := -fPIC
+CFLAGS-readback-o := -fPIC
+CFLAGS-pixconv-o := -fPIC
+CFLAGS-pace-o := -fPIC
+CFLAGS-damage-o := -fPIC
+CFLAGS-export-o := -fPIC
+CFLAGS-video-o := -fPIC ${CFLAGS-lz4}
 CFLAGS-tile-o := -fPIC
 CFLAGS-font-o := -fPIC
+CFLAGS-bundle-o := -fPIC
 CFLAGS-ui-o := -fPIC
 CFLAGS-ui-style-o := -fPIC
 CFLAGS-ui-cache-o := -fPIC
@@ -12,3 +27,6 @@ CFLAGS-input-o := -fPIC
 CFLAGS-input-glfw-o := -fPIC
 CFLAGS-fb-o := -fPIC
 CFLAGS-input-dev-o := -fPIC
+CFLAGS-present-o := -fPIC
+CFLAGS-egl-o := -fPIC
+CFLAGS-headless-o := -fPIC
@@ -0,0 +1,256 @@
+/*
+ * atlas.c — runtime texture atlas
+ *
+ * Small textures registered while QGL_HINT_ATLAS is set share a few
+ * large pages, so drawing a mix of them doesn't switch textures.
+ * Each page is packed bottom-left with a skyline: a list of segments
+ * giving, for each horizontal span, the lowest free row.
+ *
+ * Space is only returned to a page when every texture on it is gone;
+ * what is freed before that counts as lost (see qgl_atlas_stats).
+ */
+
+#include "../include/ttypt/qgl.h"
+#include "./gl.h"
+
+#include <ttypt/qsys.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* transparent gutter around each entry, so neighbours never bleed */
+#define ATLAS_PAD 1
+
+typedef struct {
+	uint32_t x, y, w;
+} atlas_seg_t;
+
+typedef struct {
+	GLuint tex;
+	atlas_seg_t *seg;
+	uint32_t nseg, cap;
+	uint32_t count;		/* live entries */
+	uint64_t used;		/* texels held by live entries */
+} atlas_page_t;
+
+static atlas_page_t *g_pages;
+static uint32_t g_npages, g_side;
+
+uint32_t qgl_atlas_side(void)
+{
+	return g_side;
+}
+
+/* lowest y at which a w-wide box fits starting at segment i */
+static int seg_fit(const atlas_page_t *p, uint32_t i,
+		uint32_t w, uint32_t h, uint32_t *y_r)
+{
+	uint32_t x = p->seg[i].x, y = 0, left = w;
+
+	if (x + w > g_side)
+		return 0;
+
+	for (; left > 0; i++) {
+		if (p->seg[i].y > y)
+			y = p->seg[i].y;
+		if (y + h > g_side)
+			return 0;
+		left = left > p->seg[i].w ? left - p->seg[i].w : 0;
+	}
+
+	*y_r = y;
+	return 1;
+}
+
+static void seg_insert(atlas_page_t *p, uint32_t i, atlas_seg_t s)
+{
+	if (p->nseg == p->cap) {
+		p->cap = p->cap ? p->cap * 2 : 16;
+		p->seg = realloc(p->seg, p->cap * sizeof(*p->seg));
+		CBUG(!p->seg, "realloc atlas skyline");
+	}
+
+	memmove(&p->seg[i + 1], &p->seg[i],
+			(p->nseg - i) * sizeof(*p->seg));
+	p->seg[i] = s;
+	p->nseg++;
+}
+
+/* raise the skyline under a box placed at segment i */
+static void seg_place(atlas_page_t *p, uint32_t i,
+		uint32_t w, uint32_t y)
+{
+	atlas_seg_t s = { p->seg[i].x, y, w };
+	uint32_t end = s.x + w, j;
+
+	seg_insert(p, i, s);
+
+	/* shrink or drop the segments the box now covers */
+	for (j = i + 1; j < p->nseg; ) {
+		atlas_seg_t *n = &p->seg[j];
+
+		if (n->x >= end)
+			break;
+
+		if (n->x + n->w <= end) {
+			memmove(n, n + 1, (p->nseg - j - 1) * sizeof(*n));
+			p->nseg--;
+			continue;
+		}
+
+		n->w -= end - n->x;
+		n->x = end;
+		break;
+	}
+
+	/* merge neighbours at the same height */
+	for (j = 0; j + 1 < p->nseg; ) {
+		if (p->seg[j].y == p->seg[j + 1].y) {
+			p->seg[j].w += p->seg[j + 1].w;
+			memmove(&p->seg[j + 1], &p->seg[j + 2],
+					(p->nseg - j - 2) * sizeof(*p->seg));
+			p->nseg--;
+		} else
+			j++;
+	}
+}
+
+static void page_reset(atlas_page_t *p)
+{
+	p->nseg = 0;
+	seg_insert(p, 0, (atlas_seg_t) { 0, 0, g_side });
+	p->count = 0;
+	p->used = 0;
+}
+
+static atlas_page_t *page_new(void)
+{
+	atlas_page_t *p;
+	uint8_t *zero;
+
+	g_pages = realloc(g_pages, (g_npages + 1) * sizeof(*g_pages));
+	CBUG(!g_pages, "realloc atlas pages");
+
+	p = &g_pages[g_npages++];
+	memset(p, 0, sizeof(*p));
+	page_reset(p);
+
+	zero = calloc((size_t) g_side * g_side, 4);
+	CBUG(!zero, "calloc atlas page");
+
+	glGenTextures(1, &p->tex);
+	qgl_bind_tex(0, p->tex);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, g_side, g_side, 0,
+			GL_BGRA, GL_UNSIGNED_BYTE, zero);
+	free(zero);
+
+	return p;
+}
+
+int qgl_atlas_alloc(uint32_t w, uint32_t h, qgl_atlas_slot_t *slot)
+{
+	uint32_t pw = w + 2 * ATLAS_PAD, ph = h + 2 * ATLAS_PAD;
+	uint32_t pi, i, best_i = 0, best_y = 0, best_w = 0, y;
+	atlas_page_t *p = NULL;
+	int limit = qgl_hint_get(QGL_HINT_ATLAS);
+
+	if (limit <= 0 || w == 0 || h == 0
+			|| w > (uint32_t) limit || h > (uint32_t) limit)
+		return -1;
+
+	if (!g_side)
+		g_side = (uint32_t) qgl_hint_get(QGL_HINT_ATLAS_PAGE);
+
+	if (pw > g_side || ph > g_side)
+		return -1;
+
+	/* bottom-left: lowest resulting top edge, then narrowest segment */
+	for (pi = 0; pi < g_npages; pi++) {
+		atlas_page_t *cand = &g_pages[pi];
+
+		for (i = 0; i < cand->nseg; i++) {
+			if (!seg_fit(cand, i, pw, ph, &y))
+				continue;
+
+			if (!p || y < best_y || (y == best_y
+					&& cand->seg[i].w < best_w)) {
+				p = cand;
+				best_i = i;
+				best_y = y;
+				best_w = cand->seg[i].w;
+			}
+		}
+
+		if (p)
+			break;
+	}
+
+	if (!p) {
+		p = page_new();
+		best_i = 0;
+		best_y = 0;
+	}
+
+	slot->page = (uint32_t) (p - g_pages);
+	slot->tex = p->tex;
+	slot->x = p->seg[best_i].x + ATLAS_PAD;
+	slot->y = best_y + ATLAS_PAD;
+
+	seg_place(p, best_i, pw, best_y + ph);
+	p->count++;
+	p->used += (uint64_t) w * h;
+	return 0;
+}
+
+void qgl_atlas_free(uint32_t page, uint32_t w, uint32_t h)
+{
+	atlas_page_t *p;
+
+	if (page >= g_npages)
+		return;
+
+	p = &g_pages[page];
+	p->used -= (uint64_t) w * h;
+
+	if (--p->count == 0)
+		page_reset(p);
+}
+
+void qgl_atlas_stats(qgl_atlas_stats_t *st)
+{
+	uint32_t pi, i;
+
+	memset(st, 0, sizeof(*st));
+	st->pages = g_npages;
+
+	for (pi = 0; pi < g_npages; pi++) {
+		const atlas_page_t *p = &g_pages[pi];
+		uint64_t below = 0;
+
+		for (i = 0; i < p->nseg; i++)
+			below += (uint64_t) p->seg[i].w * p->seg[i].y;
+
+		st->textures += p->count;
+		st->page_area += (uint64_t) g_side * g_side;
+		st->used_area += p->used;
+		st->lost_area += below - p->used;
+	}
+}
+
+void qgl_atlas_deinit(void)
+{
+	uint32_t i;
+
+	for (i = 0; i < g_npages; i++) {
+		qgl_state_forget_tex(g_pages[i].tex);
+		glDeleteTextures(1, &g_pages[i].tex);
+		free(g_pages[i].seg);
+	}
+
+	free(g_pages);
+	g_pages = NULL;
+	g_npages = 0;
+	g_side = 0;
+}
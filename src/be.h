@@ -15,11 +15,80 @@ extern screen_t screen;
 typedef void qgl_be_init_t(uint32_t *w, uint32_t *h);
 typedef void qgl_be_deinit_t(void);
 
+/* the backend presents from screen.canvas, so frames are read back */
+#define QGL_BE_READBACK 1
+
 typedef struct {
 	qgl_be_init_t *init;
 	qgl_be_deinit_t *flush, *deinit;
+	uint32_t flags;
 } qgl_be_t;
 
+/* the active backend, which its init may adjust */
+extern qgl_be_t qgl_be;
+
 extern uint32_t qgl_width, qgl_height;
 
+/*
+ * Surfaceless EGL context (egl.c), for backends without a window.
+ */
+
+/* create the context, make it current and load the GL entry points */
+void qgl_egl_init(uint32_t w, uint32_t h);
+
+void qgl_egl_deinit(void);
+
+/*
+ * Present thread (present.c), for backends whose presentation blocks.
+ *
+ * The function shows a BGRA frame of qgl_width x qgl_height, of which
+ * the given area changed, and returns the rows it wrote.
+ */
+typedef uint64_t qgl_present_fn_t(const uint8_t *frame,
+		uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1);
+
+/* start presenting through `fn` on its own thread, behind `depth` frames */
+void qgl_present_start(uint32_t depth, int drop, qgl_present_fn_t *fn);
+
+/* queue a frame; returns the rows written since the last call */
+uint64_t qgl_present_push(const uint8_t *canvas,
+		uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1);
+
+/* stop the thread, dropping queued frames */
+void qgl_present_stop(void);
+
+/*
+ * Frame pacing (pace.c).
+ */
+
+/* whether the backend should wait for vertical blank */
+int qgl_pace_vsync(void);
+
+/* the backend can't wait for vertical blank: pace with a timer instead */
+void qgl_pace_no_vsync(void);
+
+/* whether the output is hidden, which throttles frames */
+void qgl_pace_hidden(int hidden);
+
+/* end a frame: wait for the next tick if timed, and measure it */
+void qgl_pace_frame(void);
+
+void qgl_pace_deinit(void);
+
+/*
+ * Shared-memory frame export (export.c).
+ */
+
+/* publish the frame just presented, if qgl_export() was called */
+void qgl_export_frame(void);
+
+void qgl_export_deinit(void);
+
+/*
+ * Recording (video.c).
+ */
+
+/* queue the frame just presented, if qgl_video_open() was called */
+void qgl_video_frame(void);
+
 #endif
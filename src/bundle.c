@@ -0,0 +1,331 @@
+/*
+ * bundle.c — packed asset bundles
+ *
+ * qgl_bundle_open() maps a bundle (see qgl-bundle.h) privately, so
+ * qgl_tex_paint() on its textures copies pages instead of writing
+ * back. Each atlas page is uploaded as one texture, and every
+ * texture of the bundle becomes an image whose pixels stay in the
+ * mapping and whose GL side is a rect of its page. Tilemaps and
+ * fonts are then made from those images, which costs a handle each.
+ */
+
+#include "../include/ttypt/qgl.h"
+#include "../include/ttypt/qgl-bundle.h"
+#include "../include/ttypt/qgl-font.h"
+#include "../include/ttypt/qgl-tm.h"
+#include "./tex.h"
+#include "./handle.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ttypt/qmap.h>
+#include <ttypt/qsys.h>
+#ifndef _WIN32
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
+
+typedef struct {
+	uint8_t *map;
+	size_t size;
+	uint32_t *pages;	/* GL texture of each page */
+	uint32_t *refs;		/* textures, then tilemaps, then fonts */
+} bundle_t;
+
+static qgl_htab_t g_bundles = QGL_HTAB(bundle_t);
+
+static uint8_t *bundle_map(const char *path, size_t *size)
+{
+#ifndef _WIN32
+	struct stat st;
+	void *p;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) || st.st_size <= 0) {
+		close(fd);
+		return NULL;
+	}
+
+	p = mmap(NULL, (size_t) st.st_size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
+		return NULL;
+
+	*size = (size_t) st.st_size;
+	return p;
+#else
+	FILE *fp = fopen(path, "rb");
+	uint8_t *p = NULL;
+	long len;
+
+	if (!fp)
+		return NULL;
+
+	if (!fseek(fp, 0, SEEK_END) && (len = ftell(fp)) > 0
+			&& !fseek(fp, 0, SEEK_SET)
+			&& (p = malloc((size_t) len))
+			&& fread(p, 1, (size_t) len, fp) != (size_t) len) {
+		free(p);
+		p = NULL;
+	}
+
+	fclose(fp);
+	*size = p ? (size_t) len : 0;
+	return p;
+#endif
+}
+
+static void bundle_unmap(uint8_t *map, size_t size)
+{
+#ifndef _WIN32
+	munmap(map, size);
+#else
+	(void) size;
+	free(map);
+#endif
+}
+
+static inline int
+in_file(const bundle_t *b, uint64_t off, uint64_t n, uint64_t size)
+{
+	return off <= b->size && n <= (b->size - off) / (size ? size : 1);
+}
+
+static inline const char *
+bundle_str(const bundle_t *b, uint32_t off)
+{
+	const qgl_bundle_header_t *hdr = (const void *) b->map;
+
+	return (const char *) b->map + hdr->strings + off;
+}
+
+/* everything qgl_bundle_open() relies on, before it touches any */
+static int bundle_check(const bundle_t *b)
+{
+	const qgl_bundle_header_t *hdr = (const void *) b->map;
+	const qgl_bundle_page_t *page;
+	const qgl_bundle_tex_t *tex;
+	const qgl_bundle_tm_t *tm;
+	const qgl_bundle_font_t *font;
+	uint32_t i;
+
+	if (b->size < sizeof(*hdr) || hdr->magic != QGL_BUNDLE_MAGIC
+			|| hdr->version != QGL_BUNDLE_VERSION)
+		return -1;
+
+	if (!in_file(b, hdr->pages, hdr->npages, sizeof(*page))
+			|| !in_file(b, hdr->tex, hdr->ntex, sizeof(*tex))
+			|| !in_file(b, hdr->tm, hdr->ntm, sizeof(*tm))
+			|| !in_file(b, hdr->font, hdr->nfont, sizeof(*font))
+			|| !in_file(b, hdr->index, hdr->nindex,
+				sizeof(qgl_bundle_slot_t))
+			|| !in_file(b, hdr->strings, hdr->strings_size, 1)
+			|| !hdr->strings_size
+			|| b->map[hdr->strings + hdr->strings_size - 1]
+			|| !hdr->nindex
+			|| (hdr->nindex & (hdr->nindex - 1)))
+		return -1;
+
+	page = (const void *) (b->map + hdr->pages);
+	for (i = 0; i < hdr->npages; i++)
+		if (!in_file(b, page[i].data,
+					(uint64_t) page[i].w * page[i].h, 4))
+			return -1;
+
+	tex = (const void *) (b->map + hdr->tex);
+	for (i = 0; i < hdr->ntex; i++) {
+		const qgl_bundle_page_t *p;
+
+		if (tex[i].name >= hdr->strings_size
+				|| tex[i].page >= hdr->npages)
+			return -1;
+
+		p = &page[tex[i].page];
+		if (tex[i].x > p->w || tex[i].w > p->w - tex[i].x
+				|| tex[i].y > p->h || tex[i].h > p->h - tex[i].y)
+			return -1;
+	}
+
+	tm = (const void *) (b->map + hdr->tm);
+	for (i = 0; i < hdr->ntm; i++)
+		if (tm[i].name >= hdr->strings_size || tm[i].tex >= hdr->ntex
+				|| !tm[i].w || !tm[i].h)
+			return -1;
+
+	font = (const void *) (b->map + hdr->font);
+	for (i = 0; i < hdr->nfont; i++)
+		if (font[i].name >= hdr->strings_size
+				|| font[i].tex >= hdr->ntex
+				|| !font[i].cell_w || !font[i].cell_h
+				|| font[i].first > font[i].last)
+			return -1;
+
+	return 0;
+}
+
+uint32_t qgl_bundle_open(const char *path)
+{
+	const qgl_bundle_header_t *hdr;
+	const qgl_bundle_page_t *page;
+	const qgl_bundle_tex_t *tex;
+	const qgl_bundle_tm_t *tm;
+	const qgl_bundle_font_t *font;
+	uint32_t i, *tex_refs;
+	bundle_t b = { 0 };
+
+	b.map = bundle_map(path, &b.size);
+	if (!b.map) {
+		WARN("qgl_bundle_open: %s: %s\n", path, strerror(errno));
+		return QM_MISS;
+	}
+
+	if (bundle_check(&b)) {
+		WARN("qgl_bundle_open: %s: not a valid bundle\n", path);
+		bundle_unmap(b.map, b.size);
+		return QM_MISS;
+	}
+
+	hdr = (const void *) b.map;
+	page = (const void *) (b.map + hdr->pages);
+	tex = (const void *) (b.map + hdr->tex);
+	tm = (const void *) (b.map + hdr->tm);
+	font = (const void *) (b.map + hdr->font);
+
+	b.pages = malloc((hdr->npages + 1) * sizeof(*b.pages));
+	b.refs = malloc(((size_t) hdr->ntex + hdr->ntm + hdr->nfont + 1)
+			* sizeof(*b.refs));
+	CBUG(!b.pages || !b.refs, "malloc bundle");
+
+	for (i = 0; i < hdr->npages; i++)
+		b.pages[i] = qgl_tex_page_new(page[i].w, page[i].h,
+				b.map + page[i].data);
+
+	tex_refs = b.refs;
+	for (i = 0; i < hdr->ntex; i++) {
+		const qgl_bundle_page_t *p = &page[tex[i].page];
+		uint8_t *data = b.map + p->data
+			+ ((uint64_t) tex[i].y * p->w + tex[i].x) * 4;
+
+		tex_refs[i] = img_put_shared(data, bundle_str(&b, tex[i].name),
+				tex[i].w, tex[i].h, p->w);
+		qgl_tex_reg_sub(tex_refs[i], b.pages[tex[i].page],
+				p->w, p->h, tex[i].x, tex[i].y,
+				tex[i].w, tex[i].h);
+	}
+
+	for (i = 0; i < hdr->ntm; i++)
+		b.refs[hdr->ntex + i] = qgl_tm_new(tex_refs[tm[i].tex],
+				tm[i].w, tm[i].h);
+
+	for (i = 0; i < hdr->nfont; i++)
+		b.refs[hdr->ntex + hdr->ntm + i] = qgl_font_new(
+				tex_refs[font[i].tex],
+				font[i].cell_w, font[i].cell_h,
+				font[i].first, font[i].last);
+
+	WARN("bundle_open: %s: %u pages, %u textures, %u tilemaps, "
+			"%u fonts\n", path, hdr->npages, hdr->ntex,
+			hdr->ntm, hdr->nfont);
+
+	return qgl_hnew(&g_bundles, &b);
+}
+
+/* name and handle of item `item` of a table; QM_MISS past its end */
+static uint32_t bundle_item(const bundle_t *b, qgl_asset_t type,
+		uint32_t item, uint32_t *name)
+{
+	const qgl_bundle_header_t *hdr = (const void *) b->map;
+
+	switch (type) {
+	case QGL_ASSET_TEX:
+		if (item >= hdr->ntex)
+			return QM_MISS;
+		*name = ((const qgl_bundle_tex_t *)
+				(b->map + hdr->tex))[item].name;
+		return b->refs[item];
+	case QGL_ASSET_TM:
+		if (item >= hdr->ntm)
+			return QM_MISS;
+		*name = ((const qgl_bundle_tm_t *)
+				(b->map + hdr->tm))[item].name;
+		return b->refs[hdr->ntex + item];
+	case QGL_ASSET_FONT:
+		if (item >= hdr->nfont)
+			return QM_MISS;
+		*name = ((const qgl_bundle_font_t *)
+				(b->map + hdr->font))[item].name;
+		return b->refs[hdr->ntex + hdr->ntm + item];
+	}
+
+	return QM_MISS;
+}
+
+uint32_t qgl_bundle_ref(uint32_t bundle, qgl_asset_t type,
+		const char *name)
+{
+	const bundle_t *b = qgl_hget(&g_bundles, bundle);
+	const qgl_bundle_header_t *hdr;
+	const qgl_bundle_slot_t *slot;
+	uint64_t hash;
+	uint32_t mask, i, n;
+
+	if (!b)
+		return QM_MISS;
+
+	hdr = (const void *) b->map;
+	slot = (const void *) (b->map + hdr->index);
+	hash = qgl_bundle_hash(type, name);
+	mask = hdr->nindex - 1;
+
+	for (i = hash & mask, n = 0; n <= mask; i = (i + 1) & mask, n++) {
+		uint32_t ref, off;
+
+		if (!slot[i].hash)
+			break;
+
+		if (slot[i].hash != hash || slot[i].type != (uint32_t) type)
+			continue;
+
+		ref = bundle_item(b, type, slot[i].item, &off);
+		if (ref != QM_MISS && !strcmp(bundle_str(b, off), name))
+			return ref;
+	}
+
+	return QM_MISS;
+}
+
+void qgl_bundle_close(uint32_t bundle)
+{
+	bundle_t *b = qgl_hget(&g_bundles, bundle);
+	const qgl_bundle_header_t *hdr;
+	uint32_t i;
+
+	if (!b)
+		return;
+
+	hdr = (const void *) b->map;
+	for (i = 0; i < hdr->nfont; i++)
+		qgl_font_close(b->refs[hdr->ntex + hdr->ntm + i]);
+	for (i = 0; i < hdr->ntm; i++)
+		qgl_tm_del(b->refs[hdr->ntex + i]);
+	for (i = 0; i < hdr->ntex; i++) {
+		/* it may have been deleted meanwhile */
+		if (qgl_tex_ready(b->refs[i]) == 1)
+			img_del(b->refs[i]);
+	}
+	for (i = 0; i < hdr->npages; i++)
+		qgl_tex_page_del(b->pages[i]);
+
+	bundle_unmap(b->map, b->size);
+	free(b->pages);
+	free(b->refs);
+	qgl_hdel(&g_bundles, bundle);
+}
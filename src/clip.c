@@ -0,0 +1,110 @@
+/*
+ * clip.c — clip rectangle stack
+ *
+ * Clipping is geometric: every quad is axis aligned, so instead of
+ * switching glScissor (and breaking the batch) each quad is trimmed
+ * to the clip before it is queued, and dropped when nothing is left.
+ * Texture coordinates are trimmed in proportion; the SDF kinds keep
+ * their shape box in uv and only lose rasterized area. Quads outside
+ * the render target are dropped the same way, clip or not.
+ */
+
+#include "../include/ttypt/qgl.h"
+#include "./gl.h"
+
+#include <ttypt/qsys.h>
+
+#define CLIP_MAX 64
+
+typedef struct {
+	float x0, y0, x1, y1;
+	GLuint fbo;		/* render target it was pushed on */
+} clip_rect_t;
+
+static clip_rect_t g_clip[CLIP_MAX];
+static uint32_t g_nclip;
+
+void qgl_clip_push(int32_t x, int32_t y, uint32_t w, uint32_t h)
+{
+	clip_rect_t c = {
+		(float) x, (float) y,
+		(float) x + (float) w, (float) y + (float) h,
+		g_view_fbo,
+	};
+
+	CBUG(g_nclip == CLIP_MAX, "clip stack overflow");
+
+	if (g_nclip && g_clip[g_nclip - 1].fbo == c.fbo) {
+		const clip_rect_t *p = &g_clip[g_nclip - 1];
+
+		c.x0 = c.x0 > p->x0 ? c.x0 : p->x0;
+		c.y0 = c.y0 > p->y0 ? c.y0 : p->y0;
+		c.x1 = c.x1 < p->x1 ? c.x1 : p->x1;
+		c.y1 = c.y1 < p->y1 ? c.y1 : p->y1;
+	}
+
+	g_clip[g_nclip++] = c;
+}
+
+void qgl_clip_pop(void)
+{
+	if (!g_nclip) {
+		WARN("qgl_clip_pop: empty clip stack\n");
+		return;
+	}
+
+	g_nclip--;
+}
+
+int qgl_clip_quad(qgl_inst_t *inst)
+{
+	const clip_rect_t *c = g_nclip ? &g_clip[g_nclip - 1] : NULL;
+	float *d = inst->dst;
+	float x0 = d[0], y0 = d[1], x1 = d[0] + d[2], y1 = d[1] + d[3];
+	float nx0 = x0, ny0 = y0, nx1 = x1, ny1 = y1;
+
+	/* no target before qgl_init(), so nothing to test against */
+	if (g_view_w && (x1 <= 0.0f || y1 <= 0.0f
+			|| x0 >= (float) g_view_w || y0 >= (float) g_view_h))
+		goto reject;
+
+	/* clips pushed on another target don't apply here */
+	if (!c || c->fbo != g_view_fbo)
+		return 0;
+
+	if (x1 <= c->x0 || y1 <= c->y0 || x0 >= c->x1 || y0 >= c->y1)
+		goto reject;
+
+	if (x0 >= c->x0 && y0 >= c->y0 && x1 <= c->x1 && y1 <= c->y1)
+		return 0;
+
+	if (nx0 < c->x0)
+		nx0 = c->x0;
+	if (ny0 < c->y0)
+		ny0 = c->y0;
+	if (nx1 > c->x1)
+		nx1 = c->x1;
+	if (ny1 > c->y1)
+		ny1 = c->y1;
+
+	if (inst->kind == QGL_KIND_TEX) {
+		float *uv = inst->uv;
+		float du = (uv[2] - uv[0]) / d[2];
+		float dv = (uv[3] - uv[1]) / d[3];
+
+		uv[2] = uv[0] + (nx1 - x0) * du;
+		uv[3] = uv[1] + (ny1 - y0) * dv;
+		uv[0] += (nx0 - x0) * du;
+		uv[1] += (ny0 - y0) * dv;
+	}
+
+	d[0] = nx0;
+	d[1] = ny0;
+	d[2] = nx1 - nx0;
+	d[3] = ny1 - ny0;
+	return 0;
+
+reject:
+	qgl_stat_add(QGL_STAT_CULLED, 1);
+	return 1;
+}
@@ -0,0 +1,75 @@
+/*
+ * damage.c — damage rectangles and the buffers they keep current
+ */
+
+#include "./damage.h"
+#include "./gl.h"
+#include "./be.h"
+
+#include <string.h>
+
+void qgl_rect_union(qgl_rect_t *r, const qgl_rect_t *o)
+{
+	if (qgl_rect_empty(o))
+		return;
+
+	if (qgl_rect_empty(r)) {
+		*r = *o;
+		return;
+	}
+
+	r->x0 = o->x0 < r->x0 ? o->x0 : r->x0;
+	r->y0 = o->y0 < r->y0 ? o->y0 : r->y0;
+	r->x1 = o->x1 > r->x1 ? o->x1 : r->x1;
+	r->y1 = o->y1 > r->y1 ? o->y1 : r->y1;
+}
+
+void qgl_stale_reset(qgl_rect_t *stale, uint32_t n)
+{
+	uint32_t i;
+
+	for (i = 0; i < n; i++)
+		stale[i] = (qgl_rect_t) { 0, 0, qgl_width, qgl_height };
+}
+
+void qgl_stale_add(qgl_rect_t *stale, uint32_t n, const qgl_rect_t *damage)
+{
+	uint32_t i;
+
+	for (i = 0; i < n; i++)
+		qgl_rect_union(&stale[i], damage);
+}
+
+/* copy `r` of a frame laid out like the canvas, or read it from the FBO */
+static void rect_copy(uint8_t *dst, const uint8_t *src, const qgl_rect_t *r)
+{
+	size_t row = (size_t) qgl_width * 4;
+	uint32_t y;
+
+	if (qgl_rect_empty(r))
+		return;
+
+	if (!src) {
+		qgl_read_rect(dst, row, r->x0, r->y0, r->x1, r->y1);
+		return;
+	}
+
+	for (y = r->y0; y < r->y1; y++)
+		memcpy(dst + (size_t) y * row + (size_t) r->x0 * 4,
+				src + (size_t) y * row + (size_t) r->x0 * 4,
+				(size_t) (r->x1 - r->x0) * 4);
+}
+
+void qgl_stale_fill(qgl_rect_t *stale, uint32_t n, uint32_t i,
+		const qgl_rect_t *damage, uint8_t *dst, const uint8_t *src)
+{
+	uint32_t j;
+
+	qgl_rect_union(&stale[i], damage);
+	rect_copy(dst, src, &stale[i]);
+
+	stale[i] = (qgl_rect_t) { 0, 0, 0, 0 };
+	for (j = 0; j < n; j++)
+		if (j != i)
+			qgl_rect_union(&stale[j], damage);
+}
@@ -0,0 +1,51 @@
+/*
+ * @file damage.h
+ * @brief Whole-frame buffers kept current through damage.
+ *
+ * The present queue, the export ring and the video recorder each
+ * keep several buffers holding a whole frame. Instead of copying
+ * every frame in full, a buffer only gets, when it is filled, what
+ * changed since it was last filled: each one has a stale rectangle
+ * that grows with the damage of every frame it misses. The rectangle
+ * is a bounding box, so a filled buffer may get more than it lacks,
+ * but never less.
+ *
+ * This header is **not** part of the public API.
+ */
+
+#ifndef QGL_DAMAGE_H
+#define QGL_DAMAGE_H
+
+#include <stdint.h>
+
+typedef struct {
+	uint32_t x0, y0, x1, y1;
+} qgl_rect_t;
+
+static inline int qgl_rect_empty(const qgl_rect_t *r)
+{
+	return r->x0 >= r->x1 || r->y0 >= r->y1;
+}
+
+/* grow `r` to cover `o` too */
+void qgl_rect_union(qgl_rect_t *r, const qgl_rect_t *o);
+
+/* mark each of `n` buffers as lacking the whole screen */
+void qgl_stale_reset(qgl_rect_t *stale, uint32_t n);
+
+/* a frame none of the `n` buffers got changed `damage` */
+void qgl_stale_add(qgl_rect_t *stale, uint32_t n,
+		const qgl_rect_t *damage);
+
+/*
+ * @brief Bring buffer `i` of `n` up to date with a frame.
+ *
+ * Copies what buffer `i` lacks, once the frame's `damage` is added,
+ * into `dst` from `src`, both laid out like the canvas. When `src` is
+ * NULL the pixels are read from the FBO instead. The other buffers
+ * now lack `damage`.
+ */
+void qgl_stale_fill(qgl_rect_t *stale, uint32_t n, uint32_t i,
+		const qgl_rect_t *damage, uint8_t *dst, const uint8_t *src);
+
+#endif /* QGL_DAMAGE_H */
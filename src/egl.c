@@ -0,0 +1,154 @@
+/*
+ * egl.c — surfaceless EGL context
+ *
+ * For backends without a window: the context renders only into the
+ * library's FBO, so it needs no surface when the driver supports
+ * surfaceless contexts (Mesa), and a pbuffer otherwise. GL entry
+ * points are resolved through eglGetProcAddress().
+ */
+
+#include "./gl.h"
+#include "./be.h"
+
+#include <stdio.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <ttypt/qsys.h>
+
+#define LOAD_GL(name) do { \
+	name = (typeof(name)) eglGetProcAddress(#name); \
+	if (!name) fprintf(stderr, "missing GL func %s\n", #name); \
+} while (0)
+
+static EGLDisplay egl_dpy = EGL_NO_DISPLAY;
+static EGLContext egl_ctx = EGL_NO_CONTEXT;
+static EGLSurface egl_surf = EGL_NO_SURFACE;
+
+static EGLConfig egl_choose_config(void)
+{
+	const EGLint cfg_attrs[] = {
+		EGL_SURFACE_TYPE,     EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE,  EGL_OPENGL_BIT,
+		EGL_RED_SIZE,         8,
+		EGL_GREEN_SIZE,       8,
+		EGL_BLUE_SIZE,        8,
+		EGL_ALPHA_SIZE,       8,
+		EGL_NONE
+	};
+	EGLConfig cfg;
+	EGLint n = 0;
+
+	CBUG(!eglChooseConfig(egl_dpy, cfg_attrs, &cfg, 1, &n) || n < 1, "eglChooseConfig");
+	return cfg;
+}
+
+static void egl_make_current_or_pbuffer(EGLConfig cfg, EGLint w, EGLint h)
+{
+	if (eglMakeCurrent(egl_dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, egl_ctx))
+		return;
+
+	const EGLint pb_attribs[] = { EGL_WIDTH, w, EGL_HEIGHT, h, EGL_NONE };
+	egl_surf = eglCreatePbufferSurface(egl_dpy, cfg, pb_attribs);
+	CBUG(egl_surf == EGL_NO_SURFACE, "eglCreatePbufferSurface");
+
+	CBUG(!eglMakeCurrent(egl_dpy, egl_surf, egl_surf, egl_ctx), "eglMakeCurrent");
+}
+
+void qgl_egl_init(uint32_t w, uint32_t h)
+{
+	EGLint major = 0, minor = 0;
+	PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display_ext;
+
+	get_platform_display_ext =
+		(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+
+	if (get_platform_display_ext)
+		egl_dpy = get_platform_display_ext(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+
+	if (egl_dpy == EGL_NO_DISPLAY)
+		egl_dpy = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+	CBUG(!eglInitialize(egl_dpy, &major, &minor), "eglInitialize");
+	CBUG(!eglBindAPI(EGL_OPENGL_API), "eglBindAPI");
+
+	EGLConfig cfg = egl_choose_config();
+	egl_ctx = eglCreateContext(egl_dpy, cfg, EGL_NO_CONTEXT, NULL);
+	CBUG(egl_ctx == EGL_NO_CONTEXT, "eglCreateContext");
+
+	egl_make_current_or_pbuffer(cfg, (EGLint)w, (EGLint)h);
+	fprintf(stderr, "EGL: contexto inicializado (OpenGL headless)\n");
+
+	LOAD_GL(glGenFramebuffers);
+	LOAD_GL(glBindFramebuffer);
+	LOAD_GL(glFramebufferTexture2D);
+	LOAD_GL(glCheckFramebufferStatus);
+	LOAD_GL(glDeleteFramebuffers);
+	LOAD_GL(glActiveTexture);
+
+	LOAD_GL(glGenVertexArrays);
+	LOAD_GL(glBindVertexArray);
+	LOAD_GL(glCreateShader);
+	LOAD_GL(glShaderSource);
+	LOAD_GL(glCompileShader);
+	LOAD_GL(glGetShaderiv);
+	LOAD_GL(glGetShaderInfoLog);
+	LOAD_GL(glCreateProgram);
+	LOAD_GL(glAttachShader);
+	LOAD_GL(glLinkProgram);
+	LOAD_GL(glGetProgramiv);
+	LOAD_GL(glGetProgramInfoLog);
+	LOAD_GL(glDeleteShader);
+	LOAD_GL(glUseProgram);
+	LOAD_GL(glGetUniformLocation);
+	LOAD_GL(glUniform1f);
+	LOAD_GL(glUniform2f);
+	LOAD_GL(glUniform1i);
+	LOAD_GL(glUniform4fv);
+	LOAD_GL(glUniformMatrix4fv);
+	LOAD_GL(glDetachShader);
+	LOAD_GL(glBlendFuncSeparate);
+	LOAD_GL(glDeleteProgram);
+
+	LOAD_GL(glGenBuffers);
+	LOAD_GL(glBindBuffer);
+	LOAD_GL(glBufferData);
+	LOAD_GL(glBufferSubData);
+	LOAD_GL(glDeleteBuffers);
+	LOAD_GL(glDeleteVertexArrays);
+	LOAD_GL(glEnableVertexAttribArray);
+	LOAD_GL(glVertexAttribPointer);
+	LOAD_GL(glVertexAttribIPointer);
+	LOAD_GL(glVertexAttribDivisor);
+	LOAD_GL(glDrawArraysInstanced);
+
+	LOAD_GL(glGetStringi);
+	LOAD_GL(glBufferStorage);
+	LOAD_GL(glMapBufferRange);
+	LOAD_GL(glUnmapBuffer);
+	LOAD_GL(glFenceSync);
+	LOAD_GL(glClientWaitSync);
+	LOAD_GL(glDeleteSync);
+
+	LOAD_GL(glBindBufferBase);
+	LOAD_GL(glGetUniformBlockIndex);
+	LOAD_GL(glUniformBlockBinding);
+}
+
+void qgl_egl_deinit(void)
+{
+	if (egl_dpy == EGL_NO_DISPLAY)
+		return;
+
+	CBUG(!eglMakeCurrent(egl_dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT), "eglMakeCurrent");
+
+	if (egl_surf != EGL_NO_SURFACE)
+		eglDestroySurface(egl_dpy, egl_surf);
+	if (egl_ctx != EGL_NO_CONTEXT)
+		eglDestroyContext(egl_dpy, egl_ctx);
+
+	eglTerminate(egl_dpy);
+
+	egl_dpy = EGL_NO_DISPLAY;
+	egl_ctx = EGL_NO_CONTEXT;
+	egl_surf = EGL_NO_SURFACE;
+}
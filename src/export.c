@@ -0,0 +1,171 @@
+/*
+ * export.c — shared-memory frame export
+ *
+ * After the backend presents, qgl_flush() publishes the frame into
+ * the next slot of a ring in a memfd (see qgl-export.h for the
+ * layout). Every slot holds a whole frame, refreshed where it is stale
+ * (see damage.h), from the canvas when the backend keeps one or else
+ * straight from the FBO.
+ */
+
+#define _GNU_SOURCE	/* memfd_create, file seals */
+
+#include "../include/ttypt/qgl.h"
+#include "../include/ttypt/qgl-export.h"
+#include "./gl.h"
+#include "./be.h"
+#include "./damage.h"
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <ttypt/qsys.h>
+#ifdef __linux__
+# include <sys/eventfd.h>
+# include <sys/mman.h>
+# include <fcntl.h>
+# include <unistd.h>
+#endif
+
+static struct {
+	qgl_export_header_t *hdr;
+	size_t size;
+	int mem_fd, event_fd;
+	uint64_t frame;
+	qgl_rect_t stale[QGL_EXPORT_SLOTS_MAX];	/* damage a slot hasn't seen */
+} g_exp = { .mem_fd = -1, .event_fd = -1 };
+
+#ifdef __linux__
+int qgl_export(uint32_t slots, int *mem_fd, int *event_fd)
+{
+	size_t stride = (size_t) qgl_width * 4;
+	size_t page = (size_t) sysconf(_SC_PAGESIZE);
+	size_t data = (sizeof(qgl_export_header_t) + page - 1) / page * page;
+	size_t slot = (stride * qgl_height + page - 1) / page * page;
+
+	if (g_exp.hdr)
+		goto out;
+
+	if (slots < 2)
+		slots = 2;
+	if (slots > QGL_EXPORT_SLOTS_MAX)
+		slots = QGL_EXPORT_SLOTS_MAX;
+
+	g_exp.size = data + slot * slots;
+	g_exp.mem_fd = memfd_create("qgl-export",
+			MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (g_exp.mem_fd < 0)
+		goto fail;
+
+	if (ftruncate(g_exp.mem_fd, (off_t) g_exp.size))
+		goto fail;
+
+	/* consumers may trust the size they map */
+	fcntl(g_exp.mem_fd, F_ADD_SEALS,
+			F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+
+	g_exp.event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (g_exp.event_fd < 0)
+		goto fail;
+
+	g_exp.hdr = mmap(NULL, g_exp.size, PROT_READ | PROT_WRITE,
+			MAP_SHARED, g_exp.mem_fd, 0);
+	if (g_exp.hdr == MAP_FAILED) {
+		g_exp.hdr = NULL;
+		goto fail;
+	}
+
+	g_exp.hdr->magic = QGL_EXPORT_MAGIC;
+	g_exp.hdr->version = QGL_EXPORT_VERSION;
+	g_exp.hdr->width = qgl_width;
+	g_exp.hdr->height = qgl_height;
+	g_exp.hdr->stride = (uint32_t) stride;
+	g_exp.hdr->nslots = slots;
+	g_exp.hdr->data_offset = data;
+	g_exp.hdr->slot_size = slot;
+
+	g_exp.frame = 0;
+	qgl_stale_reset(g_exp.stale, slots);
+
+out:
+	*mem_fd = g_exp.mem_fd;
+	*event_fd = g_exp.event_fd;
+	return 0;
+
+fail:
+	WARN("qgl_export: %s\n", strerror(errno));
+	qgl_export_deinit();
+	return -1;
+}
+#else
+int qgl_export(uint32_t slots, int *mem_fd, int *event_fd)
+{
+	(void) slots;
+	*mem_fd = *event_fd = -1;
+	errno = ENOSYS;
+	return -1;
+}
+#endif
+
+void qgl_export_frame(void)
+{
+	qgl_export_header_t *hdr = g_exp.hdr;
+	qgl_rect_t damage = { screen.min_x, screen.min_y,
+		screen.max_x, screen.max_y };
+	qgl_export_slot_t *s;
+	struct timespec ts;
+	uint64_t f;
+	uint32_t n;
+
+	if (!hdr)
+		return;
+
+	f = ++g_exp.frame;
+	n = f % hdr->nslots;
+	s = &hdr->slot[n];
+
+	/* odd: readers skip or retry the slot while it changes */
+	__atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	qgl_stale_fill(g_exp.stale, hdr->nslots, n, &damage,
+			(uint8_t *) hdr + hdr->data_offset + n * hdr->slot_size,
+			screen.canvas);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	s->frame = f;
+	s->time_ns = (uint64_t) ts.tv_sec * 1000000000ull
+		+ (uint64_t) ts.tv_nsec;
+	s->x0 = damage.x0;
+	s->y0 = damage.y0;
+	s->x1 = damage.x1;
+	s->y1 = damage.y1;
+
+	__atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&hdr->latest, f, __ATOMIC_RELEASE);
+
+#ifdef __linux__
+	{
+		uint64_t one = 1;
+
+		/* a full counter only means nobody is reading */
+		if (write(g_exp.event_fd, &one, sizeof(one)) < 0
+				&& errno != EAGAIN)
+			WARN("qgl_export: eventfd: %s\n", strerror(errno));
+	}
+#endif
+}
+
+void qgl_export_deinit(void)
+{
+#ifdef __linux__
+	if (g_exp.hdr)
+		munmap(g_exp.hdr, g_exp.size);
+	if (g_exp.mem_fd >= 0)
+		close(g_exp.mem_fd);
+	if (g_exp.event_fd >= 0)
+		close(g_exp.event_fd);
+#endif
+	g_exp.hdr = NULL;
+	g_exp.mem_fd = g_exp.event_fd = -1;
+}
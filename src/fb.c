@@ -6,6 +6,7 @@
 #include "../include/ttypt/qgl.h"
 #include "./gl.h"
 #include "./be.h"
+#include "./pixconv.h"
 
 #include <fcntl.h>
 #include <linux/fb.h>
@@ -15,23 +16,13 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
-#include <EGL/egl.h>
-#include <EGL/eglext.h>
 #include <ttypt/qsys.h>
-
-#define LOAD_GL(name) do { \
-	name = (typeof(name)) eglGetProcAddress(#name); \
-	if (!name) fprintf(stderr, "missing GL func %s\n", #name); \
-} while (0)
+#include <xxhash.h>
 
 static int fb_fd = -1;
 static size_t fb_size_bytes;
 static uint8_t *fb_mem;
 
-static EGLDisplay egl_dpy = EGL_NO_DISPLAY;
-static EGLContext egl_ctx = EGL_NO_CONTEXT;
-static EGLSurface egl_surf = EGL_NO_SURFACE;
-
 qgl_be_t qgl_fb;
 
 #ifndef FBIO_WAITFORVSYNC
@@ -47,6 +38,8 @@ static int g_use_pan;
 static int g_front;
 static int g_back = 1;
 static int g_page_lines;
+static int g_direct;		/* frames are read straight into fb_mem */
+static int g_queue;		/* frames go through the present thread */
 static size_t g_page_bytes;
 
 static int wait_vsync(void)
@@ -57,60 +50,11 @@ static int wait_vsync(void)
 	return -1;
 }
 
-static EGLConfig egl_choose_config(void)
-{
-	const EGLint cfg_attrs[] = {
-		EGL_SURFACE_TYPE,     EGL_PBUFFER_BIT,
-		EGL_RENDERABLE_TYPE,  EGL_OPENGL_BIT,
-		EGL_RED_SIZE,         8,
-		EGL_GREEN_SIZE,       8,
-		EGL_BLUE_SIZE,        8,
-		EGL_ALPHA_SIZE,       8,
-		EGL_NONE
-	};
-	EGLConfig cfg;
-	EGLint n = 0;
-
-	CBUG(!eglChooseConfig(egl_dpy, cfg_attrs, &cfg, 1, &n) || n < 1, "eglChooseConfig");
-	return cfg;
-}
-
-static void egl_make_current_or_pbuffer(EGLConfig cfg, EGLint w, EGLint h)
+/* wait for vertical blank if pacing wants it and the driver can */
+static void fb_vsync(void)
 {
-	if (eglMakeCurrent(egl_dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, egl_ctx))
-		return;
-
-	const EGLint pb_attribs[] = { EGL_WIDTH, w, EGL_HEIGHT, h, EGL_NONE };
-	egl_surf = eglCreatePbufferSurface(egl_dpy, cfg, pb_attribs);
-	CBUG(egl_surf == EGL_NO_SURFACE, "eglCreatePbufferSurface");
-
-	CBUG(!eglMakeCurrent(egl_dpy, egl_surf, egl_surf, egl_ctx), "eglMakeCurrent");
-}
-
-static void egl_headless_init(uint32_t w, uint32_t h)
-{
-	EGLint major = 0, minor = 0;
-	PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display_ext;
-
-	get_platform_display_ext =
-		(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
-
-	if (get_platform_display_ext)
-		egl_dpy = get_platform_display_ext(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
-
-	if (egl_dpy == EGL_NO_DISPLAY)
-		egl_dpy = eglGetDisplay(EGL_DEFAULT_DISPLAY);
-
-	CBUG(!eglInitialize(egl_dpy, &major, &minor), "eglInitialize");
-	CBUG(!eglBindAPI(EGL_OPENGL_API), "eglBindAPI");
-
-	EGLConfig cfg = egl_choose_config();
-	egl_ctx = eglCreateContext(egl_dpy, cfg, EGL_NO_CONTEXT, NULL);
-	CBUG(egl_ctx == EGL_NO_CONTEXT, "eglCreateContext");
-
-	egl_make_current_or_pbuffer(cfg, (EGLint)w, (EGLint)h);
-	fprintf(stderr, "EGL: contexto inicializado (OpenGL headless)\n");
-
+	if (qgl_pace_vsync() && wait_vsync())
+		qgl_pace_no_vsync();
 }
 
 static void try_enable_double_buffering(void)
@@ -126,15 +70,60 @@ static void try_enable_double_buffering(void)
 		g_use_pan = 1;
 }
 
-static inline void copy_to_fb_page(uint8_t *dst_page, const uint8_t *src,
-		int w, int h, int bpp, int stride)
+/* damage presented last time; the back page still lacks it */
+static uint32_t g_prev_x0, g_prev_y0, g_prev_x1, g_prev_y1;
+
+/*
+ * Each page remembers a hash of every span it was last given, so rows
+ * that didn't change since that page was shown are not written again.
+ * 0 means unknown; real hashes have their low bit set.
+ */
+#define HASH_SPAN 128	/* pixels per span */
+
+static uint64_t *g_hash[2];
+static uint32_t g_spans;	/* per row */
+
+/* copy the spans of an area that differ from what the page holds */
+static uint64_t copy_to_fb_page(int page, const uint8_t *src,
+		uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1)
 {
-	size_t row_bytes = (size_t)w * bpp;
-	for (int y = 0; y < h; y++)
-		memcpy(dst_page + (size_t)y * stride,
-				src + (size_t)y * row_bytes, row_bytes);
+	uint8_t *dst = fb_mem + (size_t)page * g_page_bytes;
+	size_t src_stride = (size_t)qgl_width * 4;
+	uint32_t s0 = x0 / HASH_SPAN;
+	uint32_t s1 = (x1 + HASH_SPAN - 1) / HASH_SPAN;
+	uint64_t rows = 0;
+
+	for (uint32_t y = y0; y < y1; y++) {
+		const uint8_t *row = src + (size_t)y * src_stride;
+		uint64_t *hash = g_hash[page] + (size_t)y * g_spans;
+		int dirty = 0;
+
+		for (uint32_t s = s0; s < s1; s++) {
+			uint32_t sx0 = s * HASH_SPAN;
+			uint32_t sx1 = sx0 + HASH_SPAN < qgl_width
+				? sx0 + HASH_SPAN : qgl_width;
+			uint64_t h = XXH3_64bits(row + (size_t)sx0 * 4,
+					(size_t)(sx1 - sx0) * 4) | 1;
+
+			if (h == hash[s])
+				continue;
+
+			hash[s] = h;
+			dirty = 1;
+			qgl_pixconv(dst + (size_t)y * g_stride
+					+ (size_t)sx0 * g_bpp,
+					row + (size_t)sx0 * 4, sx1 - sx0, sx0, y);
+		}
+
+		rows += dirty;
+	}
+
+	return rows;
 }
 
+static uint64_t fb_present(const uint8_t *src,
+		uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1);
+
 void fb_init(uint32_t *w, uint32_t *h)
 {
 	fb_fd = open("/dev/fb0", O_RDWR);
@@ -150,6 +139,31 @@ void fb_init(uint32_t *w, uint32_t *h)
 
 	try_enable_double_buffering();
 
+	switch (g_bpp) {
+	case 2:
+		qgl_pixconv_init(QGL_PIX_RGB565,
+				qgl_hint_get(QGL_HINT_DITHER));
+		break;
+	case 3:
+		qgl_pixconv_init(QGL_PIX_RGB888, 0);
+		break;
+	case 4:
+		qgl_pixconv_init(QGL_PIX_XRGB8888, 0);
+		break;
+	default:
+		CBUG(1, "unsupported framebuffer depth\n");
+	}
+
+	g_queue = qgl_hint_get(QGL_HINT_PRESENT_QUEUE) > 0;
+
+	/* BGRA is what the FBO reads back as: no need for a canvas */
+	g_direct = g_bpp == 4 && g_stride % 4 == 0
+		&& g_vinfo.blue.offset == 0 && g_vinfo.green.offset == 8
+		&& g_vinfo.red.offset == 16
+		&& !qgl_hint_get(QGL_HINT_ASYNC_READBACK) && !g_queue;
+	if (g_direct)
+		qgl_be.flags &= ~QGL_BE_READBACK;
+
 	g_page_lines = g_vinfo.yres;
 	g_page_bytes = (size_t)g_stride * g_page_lines;
 	fb_size_bytes = (size_t)g_finfo.smem_len;
@@ -157,55 +171,66 @@ void fb_init(uint32_t *w, uint32_t *h)
 	fb_mem = mmap(NULL, fb_size_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fb_fd, 0);
 	CBUG(fb_mem == MAP_FAILED, "mmap(fb_mem)");
 
-	WARN("FB: %ux%u, %u bpp, stride=%d, yvirt=%u, pan=%s\n",
+	WARN("FB: %ux%u, %u bpp, stride=%d, yvirt=%u, pan=%s, direct=%s\n",
 			*w, *h, g_vinfo.bits_per_pixel, g_stride,
-			g_vinfo.yres_virtual, g_use_pan ? "on" : "off");
-
-	egl_headless_init(*w, *h);
-
-	LOAD_GL(glGenFramebuffers);
-	LOAD_GL(glBindFramebuffer);
-	LOAD_GL(glFramebufferTexture2D);
-	LOAD_GL(glCheckFramebufferStatus);
-	LOAD_GL(glDeleteFramebuffers);
-	LOAD_GL(glActiveTexture);
-
-	LOAD_GL(glGenVertexArrays);
-	LOAD_GL(glBindVertexArray);
-	LOAD_GL(glCreateShader);
-	LOAD_GL(glShaderSource);
-	LOAD_GL(glCompileShader);
-	LOAD_GL(glGetShaderiv);
-	LOAD_GL(glGetShaderInfoLog);
-	LOAD_GL(glCreateProgram);
-	LOAD_GL(glAttachShader);
-	LOAD_GL(glLinkProgram);
-	LOAD_GL(glGetProgramiv);
-	LOAD_GL(glGetProgramInfoLog);
-	LOAD_GL(glDeleteShader);
-	LOAD_GL(glUseProgram);
-	LOAD_GL(glGetUniformLocation);
-	LOAD_GL(glUniform1f);
-	LOAD_GL(glUniform2f);
-	LOAD_GL(glUniform1i);
-	LOAD_GL(glUniform4fv);
-	LOAD_GL(glUniformMatrix4fv);
-	LOAD_GL(glDetachShader);
-	LOAD_GL(glBlendFuncSeparate);
+			g_vinfo.yres_virtual, g_use_pan ? "on" : "off",
+			g_direct ? "on" : "off");
+
+	if (!g_direct) {
+		g_spans = (*w + HASH_SPAN - 1) / HASH_SPAN;
+		for (int i = 0; i < 2; i++) {
+			g_hash[i] = calloc((size_t)g_spans * *h,
+					sizeof(*g_hash[i]));
+			CBUG(!g_hash[i], "calloc fb hashes");
+		}
+	}
+
+	if (g_queue)
+		qgl_present_start((uint32_t)qgl_hint_get(QGL_HINT_PRESENT_QUEUE),
+				qgl_hint_get(QGL_HINT_PRESENT_DROP), fb_present);
+
+	qgl_egl_init(*w, *h);
 }
 
-void fb_flush(void)
+/* show a frame, returning the number of rows written */
+static uint64_t fb_present(const uint8_t *src,
+		uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1)
 {
-	const uint8_t *src = (const uint8_t *)screen.canvas;
+	uint64_t rows;
 
 	if (g_use_pan) {
 		size_t yoff_lines = g_back ? g_page_lines : 0;
 		uint8_t *dst = fb_mem + (size_t)yoff_lines * g_stride;
 		struct fb_var_screeninfo v = g_vinfo;
+		uint32_t cx0 = x0, cy0 = y0, cx1 = x1, cy1 = y1;
 		int tmp;
 
-		copy_to_fb_page(dst, src, qgl_width, qgl_height, g_bpp, g_stride);
-		(void)wait_vsync();
+		if (x0 >= x1 && g_prev_x0 >= g_prev_x1)
+			return 0;
+
+		/* the back page is two frames old: bring both up to date */
+		if (g_prev_x0 < g_prev_x1) {
+			if (cx0 >= cx1) {
+				cx0 = g_prev_x0; cy0 = g_prev_y0;
+				cx1 = g_prev_x1; cy1 = g_prev_y1;
+			} else {
+				cx0 = cx0 < g_prev_x0 ? cx0 : g_prev_x0;
+				cy0 = cy0 < g_prev_y0 ? cy0 : g_prev_y0;
+				cx1 = cx1 > g_prev_x1 ? cx1 : g_prev_x1;
+				cy1 = cy1 > g_prev_y1 ? cy1 : g_prev_y1;
+			}
+		}
+
+		g_prev_x0 = x0; g_prev_y0 = y0;
+		g_prev_x1 = x1; g_prev_y1 = y1;
+
+		if (g_direct) {
+			qgl_read_rect(dst, g_stride, cx0, cy0, cx1, cy1);
+			rows = cy1 - cy0;
+		} else
+			rows = copy_to_fb_page(g_back, src,
+					cx0, cy0, cx1, cy1);
+		fb_vsync();
 
 		v.yoffset = g_back ? g_page_lines : 0;
 		if (ioctl(fb_fd, FBIOPAN_DISPLAY, &v) == -1)
@@ -215,32 +240,45 @@ void fb_flush(void)
 		tmp = g_front;
 		g_front = g_back;
 		g_back = tmp;
-		return;
+		return rows;
 	}
 
 single_path:
-	(void)wait_vsync();
+	if (x0 >= x1)
+		return 0;
 
-	if ((int)((size_t)qgl_width * g_bpp) == g_stride) {
-		ssize_t ret = pwrite(fb_fd, src, (size_t)qgl_height * g_stride, 0);
-		CBUG(ret < 0, "pwrite(fb)");
-		return;
+	fb_vsync();
+
+	if (g_direct) {
+		qgl_read_rect(fb_mem, g_stride, x0, y0, x1, y1);
+		return y1 - y0;
 	}
-	copy_to_fb_page(fb_mem, src, qgl_width, qgl_height, g_bpp, g_stride);
+
+	return copy_to_fb_page(0, src, x0, y0, x1, y1);
 }
 
-void fb_deinit(void)
+void fb_flush(void)
 {
-	if (egl_dpy != EGL_NO_DISPLAY) {
-		CBUG(!eglMakeCurrent(egl_dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT), "eglMakeCurrent");
+	uint64_t rows;
+
+	if (g_queue)
+		rows = qgl_present_push(screen.canvas,
+				screen.min_x, screen.min_y,
+				screen.max_x, screen.max_y);
+	else
+		rows = fb_present(screen.canvas,
+				screen.min_x, screen.min_y,
+				screen.max_x, screen.max_y);
+
+	qgl_stat_add(QGL_STAT_FB_ROWS, rows);
+}
 
-		if (egl_surf != EGL_NO_SURFACE)
-			eglDestroySurface(egl_dpy, egl_surf);
-		if (egl_ctx != EGL_NO_CONTEXT)
-			eglDestroyContext(egl_dpy, egl_ctx);
+void fb_deinit(void)
+{
+	qgl_present_stop();
+	g_queue = 0;
 
-		eglTerminate(egl_dpy);
-	}
+	qgl_egl_deinit();
 
 	if (fb_mem && fb_mem != MAP_FAILED)
 		munmap(fb_mem, fb_size_bytes);
@@ -250,6 +288,11 @@ void fb_deinit(void)
 
 	free(screen.canvas);
 	memset(&screen, 0, sizeof(screen));
+	g_prev_x0 = g_prev_y0 = g_prev_x1 = g_prev_y1 = 0;
+	g_direct = 0;
+	free(g_hash[0]);
+	free(g_hash[1]);
+	g_hash[0] = g_hash[1] = NULL;
 }
 
 void
@@ -258,4 +301,5 @@ fb_construct(void)
 	qgl_fb.init = fb_init;
 	qgl_fb.deinit = fb_deinit;
 	qgl_fb.flush = fb_flush;
+	qgl_fb.flags = QGL_BE_READBACK;
 }
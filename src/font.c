@@ -22,6 +22,8 @@
 #include <ttypt/qmap.h>
 #include <ttypt/qgl-ui.h>	/* qui_white_space_t / qui_word_break_t */
 
+#include "./handle.h"
+
 struct qgl_glyph {
 	uint16_t idx;
 };
@@ -35,36 +37,20 @@ struct qgl_font_i {
 	struct qgl_glyph g[256];
 };
 
-static uint32_t g_hd_fonts;
-static uint32_t g_type_font;
-
-static int ensure_maps(void)
-{
-	if (g_hd_fonts)
-		return 0;
-
-	g_type_font = qmap_reg(sizeof(struct qgl_font_i));
-	g_hd_fonts = qmap_open(NULL, NULL,
-			QM_HNDL, g_type_font,
-			(1u << 8) - 1, QM_AINDEX);
-	return g_hd_fonts ? 0 : -1;
-}
+static qgl_htab_t g_fonts = QGL_HTAB(struct qgl_font_i);
 
 static inline struct qgl_font_i *get_font(uint32_t ref)
 {
-	const void *v = qmap_get(g_hd_fonts, &ref);
-	return (struct qgl_font_i *)v;
+	return qgl_hget(&g_fonts, ref);
 }
 
-uint32_t qgl_font_open(const char *png_path,
-		       unsigned cell_w,
-		       unsigned cell_h,
-		       uint8_t first,
-		       uint8_t last)
+uint32_t qgl_font_new(uint32_t img_ref,
+		      unsigned cell_w,
+		      unsigned cell_h,
+		      uint8_t first,
+		      uint8_t last)
 {
-	if (!png_path || cell_w == 0 || cell_h == 0)
-		return QM_MISS;
-	if (ensure_maps() != 0)
+	if (img_ref == QM_MISS || cell_w == 0 || cell_h == 0)
 		return QM_MISS;
 
 	struct qgl_font_i font;
@@ -76,12 +62,8 @@ uint32_t qgl_font_open(const char *png_path,
 	font.cell_h = (uint16_t)cell_h;
 	font.lineh  = (uint16_t)cell_h;
 
-	/* load atlas and create tilemap */
+	/* create tilemap over the atlas */
 	{
-		uint32_t img_ref = qgl_tex_load(png_path);
-		if (img_ref == QM_MISS)
-			return QM_MISS;
-
 		uint32_t tm_ref = qgl_tm_new(img_ref, cell_w, cell_h);
 		const qgl_tm_t *tm = qgl_tm_get(tm_ref);
 		if (!tm)
@@ -103,17 +85,35 @@ uint32_t qgl_font_open(const char *png_path,
 
 	/* store font */
 	{
-		uint32_t ref = qmap_put(g_hd_fonts, NULL, &font);
+		uint32_t ref = qgl_hnew(&g_fonts, &font);
 		fprintf(stderr, "font_open ref=%u\n", ref);
 		return ref;
 	}
 }
 
+uint32_t qgl_font_open(const char *png_path,
+		       unsigned cell_w,
+		       unsigned cell_h,
+		       uint8_t first,
+		       uint8_t last)
+{
+	if (!png_path || cell_w == 0 || cell_h == 0)
+		return QM_MISS;
+
+	/* load atlas */
+	return qgl_font_new(qgl_tex_load(png_path),
+			cell_w, cell_h, first, last);
+}
+
 void qgl_font_close(uint32_t font_ref)
 {
-	if (!g_hd_fonts)
+	struct qgl_font_i *f = get_font(font_ref);
+
+	if (!f)
 		return;
-	qmap_del(g_hd_fonts, &font_ref);
+
+	qgl_tm_del(f->tm_ref);
+	qgl_hdel(&g_fonts, font_ref);
 }
 
 /*
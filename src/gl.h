@@ -23,27 +23,72 @@
 # include <GL/gl.h>
 #endif
 
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../include/ttypt/qgl.h"
+
 /* Off-screen framebuffer object used as the engine’s main render target. */
 extern GLuint g_fbo;
 
 /* Dummy vertex array (required by core profile). */
 extern GLuint g_vao_dummy;
 
-/* Uniform locations for the texture drawing program. */
-extern GLint g_uProj_tex;
-extern GLint g_uDst_tex;
-extern GLint g_uUV_tex;
-extern GLint g_uTint_tex;
-extern GLint g_uSampler;
+/* Maximum number of quads gathered before a batch is submitted. */
+#define QGL_BATCH_MAX 4096
 
-/* Active texture drawing shader program. */
-extern GLuint g_prog_tex;
+/*
+ * Frame regions in the streaming vertex ring, and the bytes a region
+ * starts with: 16 full batches, some 65k quads a frame. A frame that
+ * needs more grows the ring rather than take the next region.
+ */
+#define QGL_RING_REGIONS 3
+#define QGL_RING_REGION (16 * QGL_BATCH_MAX * sizeof(qgl_inst_t))
 
-/* Global orthographic projection matrix. */
-extern float qgl_ortho_M[16];
+/* What a quad of the shared program draws (see FS_QUAD). */
+typedef enum {
+	QGL_KIND_FILL,		/* solid color */
+	QGL_KIND_TEX,		/* texture times color */
+	QGL_KIND_FILL_ROUND,	/* rounded box */
+	QGL_KIND_STROKE_ROUND,	/* rounded border, param[0] wide */
+	QGL_KIND_SHADOW_ROUND,	/* rounded box shadow */
+} qgl_kind_t;
 
-/* Vertex shader source for solid-color fills. */
-extern const char *VS_FILL;
+/*
+ * Per-instance quad data streamed to the batch programs.
+ * One entry becomes one instance of a 4-vertex triangle fan.
+ * Fields a program doesn't read are left zeroed.
+ */
+typedef struct {
+	float dst[4];	 /* x, y, w, h in pixels */
+	float uv[4];	 /* u0, v0, u1, v1; shape box x, y, w, h for SDFs */
+	float radius[4]; /* corner radii tl, tr, br, bl */
+	float param[4];	 /* kind specific (stroke width, shadow...) */
+	uint32_t color;	 /* 0xAARRGGBB tint or fill color */
+	uint32_t kind;	 /* qgl_kind_t */
+} qgl_inst_t;
+
+/*
+ * A program fed by the quad batch. Every batch program shares
+ * the same instanced vertex shader and `qgl_inst_t` layout, and
+ * reads its projection from the `QglView` uniform block.
+ */
+typedef struct {
+	GLuint prog;
+	int textured;	/* samples the batch texture on unit 0 */
+} qgl_pipe_t;
+
+/*
+ * The shared program, drawing every qgl_kind_t. Quads that don't
+ * sample are pushed with texture 0 and join any batch.
+ */
+extern qgl_pipe_t g_pipe_quad;
+
+/* Uniform buffer binding point of the `QglView` block. */
+#define QGL_UBO_VIEW 0
+
+/* Projection of the current viewport, as held by the `QglView` block. */
+extern float qgl_ortho_M[16];
 
 /*
  * @brief Compute an orthographic projection matrix.
@@ -79,8 +124,8 @@ GLuint qgl_compile(GLenum type, const char *src);
 /*
  * @brief Set the current render target and viewport.
  *
- * Binds the given FBO and updates internal viewport state
- * used by `qgl_apply_ortho()`.
+ * Binds the given FBO and updates the shared projection
+ * when the size changed.
  *
  * @param fbo Framebuffer object ID.
  * @param w   Width of the viewport in pixels.
@@ -96,15 +141,285 @@ void qgl_set_viewport(GLuint fbo, uint32_t w, uint32_t h);
  */
 void qgl_reset_viewport(void);
 
+/* Current render target and its size. */
+extern GLuint g_view_fbo;
+extern uint32_t g_view_w, g_view_h;
+
+/*
+ * @brief Build a batch pipeline around a fragment shader.
+ *
+ * Links `fs` against the shared instanced vertex shader, which
+ * provides `vUV`, `vColor`, `vPos` (relative to the shape box),
+ * and flat `vBox`, `vRadius`, `vParam` and `vKind`.
+ *
+ * @param pipe     Pipeline to fill in.
+ * @param fs       Fragment shader source.
+ * @param textured Whether the program samples `uTex`.
+ */
+void qgl_pipe_init(qgl_pipe_t *pipe, const char *fs, int textured);
+
+/*
+ * @brief Queue one quad for instanced submission.
+ *
+ * Consecutive quads sharing the same pipeline (and, for textured
+ * pipelines, a compatible texture) are gathered and drawn with a single
+ * `glDrawArraysInstanced()`. A change of pipeline or texture, a full
+ * batch, or `qgl_batch_flush()` submits what was gathered so far.
+ *
+ * While a command list is being recorded the quad goes to the list,
+ * and while a layer is set it is queued for sorting instead.
+ *
+ * @param pipe Pipeline to draw with.
+ * @param tex  GL texture name (ignored by untextured pipelines).
+ * @param inst Quad to append.
+ */
+void qgl_batch_push(const qgl_pipe_t *pipe, GLuint tex,
+		const qgl_inst_t *inst);
+
+/*
+ * @brief Append one quad to the batch itself.
+ *
+ * Like `qgl_batch_push()`, but bypasses recording and layers.
+ */
+void qgl_batch_add(const qgl_pipe_t *pipe, GLuint tex,
+		const qgl_inst_t *inst);
+
+/*
+ * @brief Submit any pending batched quads.
+ *
+ * Layered quads are sorted and submitted first. Must be called before
+ * anything that draws outside the batch or changes the state it
+ * depends on (render target, texture contents).
+ */
+void qgl_batch_flush(void);
+
+/* recorded run of instances sharing a pipeline and texture */
+typedef struct {
+	const qgl_pipe_t *pipe;
+	GLuint tex;
+	uint32_t first, n;	/* range inside the list's instances */
+} hw_cmd_t;
+
+/* recorded quads, as kept by command lists and thread recorders */
+typedef struct {
+	hw_cmd_t *cmd;
+	qgl_inst_t *inst;
+	uint32_t ncmd, ninst;
+	uint32_t cmd_cap, inst_cap;
+} hw_list_t;
+
+/*
+ * @brief Append a quad to a list, extending its last run if it can.
+ *
+ * Only grows the list's arrays when they are full, so a list that
+ * is emptied and refilled stops allocating once warm.
+ */
+void qgl_list_push(hw_list_t *l, const qgl_pipe_t *pipe, GLuint tex,
+		const qgl_inst_t *inst);
+
+/*
+ * @brief Hand a list to the batch, offset by dx, dy and tinted.
+ */
+void qgl_list_replay(const hw_list_t *l, int32_t dx, int32_t dy,
+		uint32_t tint);
+
+/* Where this thread's quads go while it records (see record.c). */
+extern _Thread_local hw_list_t *qgl_thread_list;
+
+/*
+ * @brief Free every thread's recording buffers.
+ */
+void qgl_record_deinit(void);
+
+/*
+ * @brief Trim a quad to the current clip.
+ *
+ * @return 1 if nothing of it is visible and it should be dropped.
+ */
+int qgl_clip_quad(qgl_inst_t *inst);
+
+/*
+ * @brief Whether a layer is set, so that batched quads are queued.
+ */
+int qgl_layer_on(void);
+
+/*
+ * @brief Queue a quad in the current layer.
+ *
+ * @return 0 if queued, -1 if no layer is set.
+ */
+int qgl_layer_push(const qgl_pipe_t *pipe, GLuint tex,
+		const qgl_inst_t *inst);
+
+/*
+ * @brief Sort the queued layers and hand them to the batch.
+ */
+void qgl_layer_flush(void);
+
+/*
+ * @brief Free the layer queue.
+ */
+void qgl_layer_deinit(void);
+
 /*
- * @brief Upload the current orthographic matrix to a shader uniform.
+ * @brief Copy vertex data into the streaming ring.
  *
- * Uses the active `g_view_w/h` dimensions to build a matching
- * projection and send it to the specified uniform.
+ * The ring is one buffer split in `QGL_RING_REGIONS` regions, used
+ * in turn one frame each and guarded by one fence per frame, so
+ * writing never waits on the GPU unless it is that many frames
+ * behind. A frame outgrowing its region moves to a new buffer with
+ * regions twice as large. It is mapped persistently when buffer
+ * storage is available, and otherwise written per call.
  *
- * @param uProj Location of the `uProj` uniform in the current program.
+ * @param data Bytes to upload.
+ * @param len  Number of bytes.
+ * @param off  Receives the byte offset of the data in the ring buffer.
+ * @return 0 on success, -1 before there is a GL context.
+ */
+int qgl_ring_write(const void *data, size_t len, size_t *off);
+
+/*
+ * @brief Close the ring region used by this frame.
+ *
+ * Fences it and moves on to the next one. Called by `qgl_flush()`.
+ */
+void qgl_ring_frame(void);
+
+/*
+ * @brief Set up readback for the backend (see readback.c).
+ *
+ * Reads `QGL_HINT_ASYNC_READBACK`; called once the canvas exists.
+ */
+void qgl_readback_init(void);
+
+/*
+ * @brief Read the damaged area of the frame into `screen.canvas`.
+ *
+ * Does nothing for backends that present from the GPU. With
+ * asynchronous readback the canvas receives the previous frame, and
+ * `screen.min/max` are replaced by that frame's area.
+ */
+void qgl_readback(void);
+
+/*
+ * @brief Read an area of the screen target into memory.
+ *
+ * Lets backends read straight into their own memory.
+ *
+ * @param base   Where pixel 0, 0 goes.
+ * @param pitch  Bytes per row, a multiple of 4.
+ * @param x0,y0  Top-left corner of the area.
+ * @param x1,y1  Bottom-right corner, exclusive.
+ */
+void qgl_read_rect(uint8_t *base, size_t pitch,
+		uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1);
+
+/*
+ * @brief Delete the pixel-pack buffers.
+ */
+void qgl_readback_deinit(void);
+
+/*
+ * @brief Read a tunable set with `qgl_hint()`.
+ */
+int qgl_hint_get(qgl_hint_t hint);
+
+/* Page index of textures that own their GL texture. */
+#define QGL_ATLAS_NONE UINT32_MAX
+
+/* Page index of textures inside a page someone else owns (bundles). */
+#define QGL_ATLAS_SHARED (UINT32_MAX - 1)
+
+/* Where `qgl_atlas_alloc()` placed a texture. */
+typedef struct {
+	GLuint tex;		/* page texture */
+	uint32_t page;
+	uint32_t x, y;		/* origin inside the page */
+} qgl_atlas_slot_t;
+
+/*
+ * @brief Reserve room for a texture in a shared atlas page.
+ *
+ * Fails when the atlas is disabled or the texture is above the
+ * `QGL_HINT_ATLAS` threshold, in which case the caller gives the
+ * texture its own GL texture.
+ *
+ * @param w,h  Texture size in pixels.
+ * @param slot Receives the placement.
+ * @return 0 on success, -1 otherwise.
+ */
+int qgl_atlas_alloc(uint32_t w, uint32_t h, qgl_atlas_slot_t *slot);
+
+/*
+ * @brief Release a texture placed by `qgl_atlas_alloc()`.
+ */
+void qgl_atlas_free(uint32_t page, uint32_t w, uint32_t h);
+
+/*
+ * @brief Side of the atlas pages in pixels (0 before the first).
+ */
+uint32_t qgl_atlas_side(void);
+
+/*
+ * @brief Delete all atlas pages.
+ */
+void qgl_atlas_deinit(void);
+
+/*
+ * @brief Add to a statistic of the frame being drawn.
+ */
+void qgl_stat_add(qgl_stat_t stat, uint64_t n);
+
+/*
+ * GL state shadowing (state.c).
+ *
+ * These set a piece of GL state unless it already holds that value,
+ * in which case the call is skipped and counted in
+ * `QGL_STAT_GL_SKIPPED`. Code that changes the same state directly
+ * must call `qgl_state_reset()` afterwards.
+ */
+
+/*
+ * @brief Forget all shadowed state, so the next calls go through.
+ */
+void qgl_state_reset(void);
+
+void qgl_use_program(GLuint prog);
+void qgl_bind_vao(GLuint vao);
+void qgl_bind_fbo(GLuint fbo);
+void qgl_viewport(GLint x, GLint y, GLsizei w, GLsizei h);
+void qgl_blend(int on);
+void qgl_blend_func(GLenum src_rgb, GLenum dst_rgb,
+		GLenum src_a, GLenum dst_a);
+
+/*
+ * @brief Bind a 2D texture to a texture unit.
+ *
+ * Also makes `unit` the active texture unit.
+ */
+void qgl_bind_tex(GLuint unit, GLuint tex);
+
+/*
+ * @brief Drop a texture about to be deleted from the shadowed bindings.
+ */
+void qgl_state_forget_tex(GLuint tex);
+
+/*
+ * @brief Check a uniform of the current program against its last value.
+ *
+ * Records `val` and returns 1 when the upload is needed; returns 0
+ * when the program already holds exactly these bytes.
+ *
+ * @param loc Uniform location in the program bound with `qgl_use_program()`.
+ * @param val Value to upload.
+ * @param len Its size in bytes.
+ */
+int qgl_uniform_changed(GLint loc, const void *val, size_t len);
+
+/*
+ * @brief `glUniform1i()` through the uniform cache.
  */
-void qgl_apply_ortho(GLint uProj);
+void qgl_uniform1i(GLint loc, GLint v);
 
 /*
  * @brief Query the currently bound framebuffer object.
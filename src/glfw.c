@@ -12,6 +12,7 @@ static GLuint g_vao_present;
 static GLuint g_vbo_present;
 
 GLFWwindow *g_win;
+static int g_swap_interval;
 extern GLuint g_tex;
 
 static const char *VS_PRESENT =
@@ -42,7 +43,8 @@ static void glfw_init(uint32_t *w, uint32_t *h)
 	CBUG(!g_win, "glfwCreateWindow");
 
 	glfwMakeContextCurrent(g_win);
-	glfwSwapInterval(1);
+	g_swap_interval = 1;
+	glfwSwapInterval(g_swap_interval);
 
 	glfwGetFramebufferSize(g_win, (int32_t *) w, (int32_t *) h);
 
@@ -68,7 +70,7 @@ static void glfw_init(uint32_t *w, uint32_t *h)
 
 	/* --- create VAO + VBO --- */
 	glGenVertexArrays(1, &g_vao_present);
-	glBindVertexArray(g_vao_present);
+	qgl_bind_vao(g_vao_present);
 
 	const float verts[] = {
 		-1.f, -1.f,
@@ -85,21 +87,31 @@ static void glfw_init(uint32_t *w, uint32_t *h)
 	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void *)0);
 
 	GLint loc = glGetUniformLocation(g_prog_present, "uTex");
-	glUseProgram(g_prog_present);
-	glUniform1i(loc, 0);
+	qgl_use_program(g_prog_present);
+	qgl_uniform1i(loc, 0);
 }
 
 static void glfw_flush(void)
 {
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	glViewport(0, 0, qgl_width, qgl_height);
-	glClear(GL_COLOR_BUFFER_BIT);
+	int interval;
+
+	/* hidden windows may not swap on vsync: let pacing throttle */
+	qgl_pace_hidden(glfwGetWindowAttrib(g_win, GLFW_ICONIFIED)
+			|| !glfwGetWindowAttrib(g_win, GLFW_VISIBLE));
 
-	glUseProgram(g_prog_present);
-	glBindVertexArray(g_vao_present);
+	interval = qgl_pace_vsync();
+	if (interval != g_swap_interval) {
+		g_swap_interval = interval;
+		glfwSwapInterval(interval);
+	}
+
+	qgl_bind_fbo(0);
+	qgl_viewport(0, 0, qgl_width, qgl_height);
+	glClear(GL_COLOR_BUFFER_BIT);
 
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, g_tex);
+	qgl_use_program(g_prog_present);
+	qgl_bind_vao(g_vao_present);
+	qgl_bind_tex(0, g_tex);
 
 	glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
 
@@ -0,0 +1,107 @@
+#include "./handle.h"
+
+#include <ttypt/qsys.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void grow(qgl_htab_t *t, uint32_t need)
+{
+	uint32_t cap = t->cap ? t->cap : 16;
+
+	if (need <= t->cap)
+		return;
+
+	CBUG(need - 1 > QGL_HANDLE_IDX, "handle table full\n");
+
+	while (cap < need)
+		cap *= 2;
+
+	t->data = realloc(t->data, (size_t) cap * t->size);
+	t->tag = realloc(t->tag, (size_t) cap * sizeof(*t->tag));
+	t->free = realloc(t->free, (size_t) cap * sizeof(*t->free));
+	CBUG(!t->data || !t->tag || !t->free, "realloc handle table\n");
+
+	memset(t->tag + t->cap, 0, (size_t) (cap - t->cap) * sizeof(*t->tag));
+	t->cap = cap;
+}
+
+uint32_t qgl_hnew(qgl_htab_t *t, const void *val)
+{
+	uint32_t i, gen;
+
+	if (t->nfree)
+		i = t->free[--t->nfree];
+	else {
+		grow(t, t->n + 1);
+		i = t->n++;
+	}
+
+	gen = t->tag[i] >> 1;
+	t->tag[i] = (gen << 1) | 1;
+	memcpy(t->data + (size_t) i * t->size, val, t->size);
+
+	return (gen << QGL_HANDLE_BITS) | i;
+}
+
+void qgl_hset(qgl_htab_t *t, uint32_t h, const void *val)
+{
+	uint32_t i = h & QGL_HANDLE_IDX;
+
+	grow(t, i + 1);
+	if (t->n <= i)
+		t->n = i + 1;
+
+	t->tag[i] = ((h >> QGL_HANDLE_BITS) << 1) | 1;
+	memcpy(t->data + (size_t) i * t->size, val, t->size);
+}
+
+void qgl_hreserve(qgl_htab_t *t, uint32_t h)
+{
+	uint32_t i = h & QGL_HANDLE_IDX;
+
+	grow(t, i + 1);
+	if (t->n <= i)
+		t->n = i + 1;
+}
+
+void qgl_hdel(qgl_htab_t *t, uint32_t h)
+{
+	uint32_t i = h & QGL_HANDLE_IDX, gen;
+
+	if (!qgl_hget(t, h))
+		return;
+
+	gen = ((t->tag[i] >> 1) + 1) % QGL_HANDLE_GENS;
+	t->tag[i] = gen << 1;
+
+	if (!t->keyed)
+		t->free[t->nfree++] = i;
+}
+
+void *qgl_hnext(const qgl_htab_t *t, uint32_t *it, uint32_t *h)
+{
+	uint32_t i;
+
+	for (i = *it; i < t->n; i++) {
+		if (!(t->tag[i] & 1))
+			continue;
+
+		*it = i + 1;
+		if (h)
+			*h = ((t->tag[i] >> 1) << QGL_HANDLE_BITS) | i;
+		return t->data + (size_t) i * t->size;
+	}
+
+	*it = t->n;
+	return NULL;
+}
+
+void qgl_hfree(qgl_htab_t *t)
+{
+	free(t->data);
+	free(t->tag);
+	free(t->free);
+	t->data = NULL;
+	t->tag = t->free = NULL;
+	t->n = t->cap = t->nfree = 0;
+}
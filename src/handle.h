@@ -0,0 +1,103 @@
+/*
+ * @file handle.h
+ * @brief Dense generational handle tables.
+ *
+ * Images, textures, tilemaps and fonts live in dense arrays and are
+ * referred to by a 32-bit handle: the low `QGL_HANDLE_BITS` bits
+ * index the array, the rest hold the slot's generation. A slot's
+ * generation changes whenever it is freed, so a stale handle fails
+ * the lookup instead of reaching whatever took its place.
+ *
+ * Lookups are a bounds check and a compare. Pointers returned by
+ * `qgl_hget()` stay valid until the table next grows.
+ *
+ * This header is **not** part of the public API.
+ */
+
+#ifndef QGL_HANDLE_H
+#define QGL_HANDLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define QGL_HANDLE_BITS 20
+#define QGL_HANDLE_IDX ((1u << QGL_HANDLE_BITS) - 1)
+
+/*
+ * Generations wrap before reaching the all-ones pattern,
+ * so no handle ever equals QM_MISS.
+ */
+#define QGL_HANDLE_GENS ((1u << (32 - QGL_HANDLE_BITS)) - 1)
+
+typedef struct {
+	unsigned char *data;	/* cap elements of `size` bytes */
+	uint32_t *tag;		/* generation << 1 | live */
+	uint32_t *free;		/* indices ready for reuse */
+	uint32_t n, cap, nfree;
+	size_t size;
+	int keyed;		/* filled with qgl_hset() only */
+} qgl_htab_t;
+
+/* Static initializers for a table of `type` elements. */
+#define QGL_HTAB(type) { .size = sizeof(type) }
+#define QGL_HTAB_KEYED(type) { .size = sizeof(type), .keyed = 1 }
+
+/*
+ * @brief Look up a live element.
+ *
+ * @return Pointer to the element, or NULL if the handle is stale
+ *         or out of range.
+ */
+static inline void *qgl_hget(const qgl_htab_t *t, uint32_t h)
+{
+	uint32_t i = h & QGL_HANDLE_IDX;
+
+	if (i >= t->n || t->tag[i] != (((h >> QGL_HANDLE_BITS) << 1) | 1))
+		return NULL;
+
+	return t->data + (size_t) i * t->size;
+}
+
+/*
+ * @brief Store a copy of `val` in a fresh slot.
+ *
+ * @return The new handle.
+ */
+uint32_t qgl_hnew(qgl_htab_t *t, const void *val);
+
+/*
+ * @brief Store a copy of `val` under a handle issued by another table.
+ *
+ * Lets a table hold data keyed by the handles of another one (GL
+ * textures by image, for instance). Replaces whatever lived there.
+ * Only for tables declared with `QGL_HTAB_KEYED`.
+ */
+void qgl_hset(qgl_htab_t *t, uint32_t h, const void *val);
+
+/*
+ * @brief Make room for `h` in a keyed table.
+ *
+ * A later qgl_hset() of `h` then doesn't grow the table, so it
+ * doesn't move the elements other threads may be reading.
+ */
+void qgl_hreserve(qgl_htab_t *t, uint32_t h);
+
+/*
+ * @brief Free a slot. Stale handles are ignored.
+ */
+void qgl_hdel(qgl_htab_t *t, uint32_t h);
+
+/*
+ * @brief Iterate over live elements.
+ *
+ * Start with `*it = 0`; each call returns the next live element
+ * and its handle, or NULL at the end.
+ */
+void *qgl_hnext(const qgl_htab_t *t, uint32_t *it, uint32_t *h);
+
+/*
+ * @brief Release the table's memory.
+ */
+void qgl_hfree(qgl_htab_t *t);
+
+#endif /* QGL_HANDLE_H */
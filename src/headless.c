@@ -0,0 +1,118 @@
+/*
+ * headless.c — backend presenting into memory
+ *
+ * Renders through a surfaceless EGL context, with no window and no
+ * framebuffer device, and hands each frame to the application. When
+ * it supplied a buffer, the damaged area is read straight into it;
+ * otherwise frames are read into the canvas. Without a buffer or a
+ * callback nothing is read back at all, which is what benchmarks want.
+ */
+
+#include "../include/ttypt/qgl.h"
+#include "./gl.h"
+#include "./be.h"
+#include "./input.h"
+
+#include <string.h>
+#include <ttypt/qsys.h>
+
+qgl_be_t qgl_mem;
+qgl_input_t qgl_input_none;
+
+static struct {
+	uint8_t *pixels;
+	qgl_frame_cb_t *cb;
+	void *ctx;
+	int direct;		/* frames are read straight into pixels */
+} g_hl;
+
+static void headless_init(uint32_t *w, uint32_t *h)
+{
+	g_hl.direct = g_hl.pixels
+		&& !qgl_hint_get(QGL_HINT_ASYNC_READBACK);
+	if (g_hl.direct || (!g_hl.pixels && !g_hl.cb))
+		qgl_be.flags &= ~QGL_BE_READBACK;
+
+	WARN("headless: %ux%u, %s\n", *w, *h, g_hl.direct ? "direct"
+			: qgl_be.flags & QGL_BE_READBACK ? "canvas" : "discard");
+
+	qgl_egl_init(*w, *h);
+}
+
+static void headless_flush(void)
+{
+	size_t row = (size_t) qgl_width * 4;
+	const uint8_t *frame = g_hl.pixels;
+	uint32_t y;
+
+	if (screen.min_x < screen.max_x) {
+		if (g_hl.direct)
+			qgl_read_rect(g_hl.pixels, row, screen.min_x,
+					screen.min_y, screen.max_x,
+					screen.max_y);
+		else if (g_hl.pixels && screen.canvas)
+			/* async: the canvas holds the last frame read */
+			for (y = screen.min_y; y < screen.max_y; y++)
+				memcpy(g_hl.pixels + y * row
+						+ (size_t) screen.min_x * 4,
+						screen.canvas + y * row
+						+ (size_t) screen.min_x * 4,
+						(size_t) (screen.max_x
+							- screen.min_x) * 4);
+	}
+
+	if (!frame)
+		frame = screen.canvas;
+
+	if (g_hl.cb && frame)
+		g_hl.cb(frame, qgl_width, qgl_height,
+				screen.min_x, screen.min_y,
+				screen.max_x, screen.max_y, g_hl.ctx);
+}
+
+static void headless_deinit(void)
+{
+	qgl_egl_deinit();
+	g_hl.direct = 0;
+}
+
+static void input_none(void)
+{
+}
+
+static void input_none_init(int flags)
+{
+	(void) flags;
+}
+
+void headless_construct(void)
+{
+	qgl_mem.init = headless_init;
+	qgl_mem.flush = headless_flush;
+	qgl_mem.deinit = headless_deinit;
+	qgl_mem.flags = QGL_BE_READBACK;
+
+	qgl_input_none.init = input_none_init;
+	qgl_input_none.deinit = input_none;
+	qgl_input_none.poll = input_none;
+}
+
+void qgl_headless(uint32_t w, uint32_t h, void *pixels,
+		qgl_frame_cb_t *cb, void *ctx)
+{
+	CBUG(screen.size, "qgl_headless after qgl_init\n");
+
+	g_hl.pixels = pixels;
+	g_hl.cb = cb;
+	g_hl.ctx = ctx;
+
+	if (w && h) {
+		qgl_width = w;
+		qgl_height = h;
+	}
+
+	/* the backend chosen at load time never started: just swap it */
+	headless_construct();
+	qgl_be = qgl_mem;
+	qgl_input = qgl_input_none;
+}
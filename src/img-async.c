@@ -0,0 +1,192 @@
+/*
+ * img-async.c — image decoding on worker threads
+ *
+ * qgl_tex_load_async() queues a job per file; a pool of workers,
+ * started with the first job, decodes them and queues the pixels
+ * back. Only the GL thread touches images and textures: it takes
+ * finished jobs with img_async_pop() and registers them itself.
+ */
+
+#include "../include/ttypt/qgl.h"
+#include "./gl.h"
+#include "./tex.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <ttypt/qsys.h>
+
+#define ASYNC_THREADS_MAX 8
+
+typedef struct img_job {
+	unsigned ref;
+	char *filename;
+	img_decode_t *decode;
+	uint8_t *data;
+	uint32_t w, h;
+	size_t map_len;
+	struct img_job *next;
+} img_job_t;
+
+typedef struct {
+	img_job_t *head, *tail;
+} job_list_t;
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t todo_cond, done_cond;
+	job_list_t todo, done;
+	uint32_t pending;	/* queued or decoding */
+	int stop;
+	pthread_t threads[ASYNC_THREADS_MAX];
+	uint32_t nthreads;
+} g_async = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.todo_cond = PTHREAD_COND_INITIALIZER,
+	.done_cond = PTHREAD_COND_INITIALIZER,
+};
+
+static void job_put(job_list_t *l, img_job_t *j)
+{
+	j->next = NULL;
+	if (l->tail)
+		l->tail->next = j;
+	else
+		l->head = j;
+	l->tail = j;
+}
+
+static img_job_t *job_take(job_list_t *l)
+{
+	img_job_t *j = l->head;
+
+	if (j) {
+		l->head = j->next;
+		if (!l->head)
+			l->tail = NULL;
+	}
+
+	return j;
+}
+
+static void *async_loop(void *arg)
+{
+	(void) arg;
+
+	pthread_mutex_lock(&g_async.lock);
+	for (;;) {
+		img_job_t *j;
+
+		while (!g_async.todo.head && !g_async.stop)
+			pthread_cond_wait(&g_async.todo_cond, &g_async.lock);
+		if (g_async.stop)
+			break;
+
+		j = job_take(&g_async.todo);
+		pthread_mutex_unlock(&g_async.lock);
+
+		j->data = img_cache_decode(j->filename, j->decode,
+				&j->w, &j->h, &j->map_len);
+
+		pthread_mutex_lock(&g_async.lock);
+		job_put(&g_async.done, j);
+		pthread_cond_signal(&g_async.done_cond);
+	}
+	pthread_mutex_unlock(&g_async.lock);
+
+	return NULL;
+}
+
+static void async_start(void)
+{
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	int n = qgl_hint_get(QGL_HINT_LOAD_THREADS);
+	uint32_t i;
+
+	/* by default leave a core to the render thread */
+	if (n <= 0)
+		n = ncpu > 1 ? (int) ncpu - 1 : 1;
+	if (n > ASYNC_THREADS_MAX)
+		n = ASYNC_THREADS_MAX;
+
+	for (i = 0; i < (uint32_t) n; i++)
+		CBUG(pthread_create(&g_async.threads[i], NULL,
+					async_loop, NULL),
+				"pthread_create loader");
+
+	g_async.nthreads = (uint32_t) n;
+}
+
+void img_async_push(unsigned ref, const char *filename,
+		img_decode_t *decode)
+{
+	img_job_t *j = calloc(1, sizeof(*j));
+
+	CBUG(!j, "calloc img job");
+	j->ref = ref;
+	j->filename = strdup(filename);
+	j->decode = decode;
+	CBUG(!j->filename, "strdup img job");
+
+	if (!g_async.nthreads)
+		async_start();
+
+	pthread_mutex_lock(&g_async.lock);
+	job_put(&g_async.todo, j);
+	g_async.pending++;
+	pthread_cond_signal(&g_async.todo_cond);
+	pthread_mutex_unlock(&g_async.lock);
+}
+
+int img_async_pop(unsigned *ref, uint8_t **data,
+		uint32_t *w, uint32_t *h, size_t *map_len, int wait)
+{
+	img_job_t *j;
+
+	pthread_mutex_lock(&g_async.lock);
+	while (wait && !g_async.done.head && g_async.pending)
+		pthread_cond_wait(&g_async.done_cond, &g_async.lock);
+
+	j = job_take(&g_async.done);
+	if (j)
+		g_async.pending--;
+	pthread_mutex_unlock(&g_async.lock);
+
+	if (!j)
+		return 0;
+
+	*ref = j->ref;
+	*data = j->data;
+	*w = j->w;
+	*h = j->h;
+	*map_len = j->map_len;
+	free(j->filename);
+	free(j);
+	return 1;
+}
+
+void img_async_deinit(void)
+{
+	img_job_t *j;
+	uint32_t i;
+
+	pthread_mutex_lock(&g_async.lock);
+	g_async.stop = 1;
+	pthread_cond_broadcast(&g_async.todo_cond);
+	pthread_mutex_unlock(&g_async.lock);
+
+	for (i = 0; i < g_async.nthreads; i++)
+		pthread_join(g_async.threads[i], NULL);
+	g_async.nthreads = 0;
+
+	while ((j = job_take(&g_async.todo)) || (j = job_take(&g_async.done))) {
+		if (j->data)
+			img_cache_free(j->data, j->map_len);
+		free(j->filename);
+		free(j);
+	}
+
+	g_async.pending = 0;
+	g_async.stop = 0;
+}
@@ -0,0 +1,425 @@
+/*
+ * img-cache.c — on-disk cache of decoded images
+ *
+ * With qgl_tex_cache() set, every image decoded through a backend's
+ * decode hook is also written to the cache directory as raw pixels,
+ * and later loads of the same file map the cached pixels instead of
+ * decoding. Entries are named after a hash of the source's absolute
+ * path. Each is a page of header followed by the pixels, exactly as
+ * images keep them in memory, so a hit is an mmap and nothing else.
+ *
+ * An entry is valid while its source keeps the size and mtime it
+ * was written with. When only the mtime moved, the source is hashed
+ * and compared with the hash the entry recorded, so touched or
+ * re-checked-out files don't decode again. Hits bump the entry's
+ * mtime, and once the directory grows past its cap the entries used
+ * longest ago are removed.
+ *
+ * Workers call in here concurrently: the configuration only changes
+ * through qgl_tex_cache(), which must not race with loads.
+ */
+
+#include "../include/ttypt/qgl.h"
+#include "./tex.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ttypt/qsys.h>
+
+#ifndef _WIN32
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <xxhash.h>
+
+#define CACHE_MAGIC 0x43544751u	/* "QGTC" */
+#define CACHE_VERSION 1
+#define CACHE_DATA 4096		/* pixels start on their own page */
+#define CACHE_EXT ".qtc"
+
+typedef struct {
+	uint32_t magic, version;
+	uint32_t w, h;
+	uint64_t src_size;
+	int64_t src_mtime;	/* ns */
+	uint64_t src_hash;	/* XXH3 of the source file */
+	uint32_t path_len;
+	uint32_t pad;
+	char path[];		/* absolute source path, to catch collisions */
+} cache_hdr_t;
+
+typedef struct {
+	char name[32];
+	int64_t used;
+	uint64_t size;
+} cache_ent_t;
+
+static struct {
+	int on;
+	char dir[PATH_MAX];
+	uint64_t max;
+	atomic_uint_fast64_t total;	/* bytes in the directory */
+	atomic_uint tmp_seq;
+	pthread_mutex_t prune_lock;
+} g_cache = { .prune_lock = PTHREAD_MUTEX_INITIALIZER };
+
+static int64_t st_mtime_ns(const struct stat *st)
+{
+#ifdef __APPLE__
+	return (int64_t) st->st_mtimespec.tv_sec * 1000000000
+		+ st->st_mtimespec.tv_nsec;
+#else
+	return (int64_t) st->st_mtim.tv_sec * 1000000000
+		+ st->st_mtim.tv_nsec;
+#endif
+}
+
+/* the entry of an absolute source path */
+static void cache_entry(char *out, size_t len, const char *abs)
+{
+	snprintf(out, len, "%s/%016llx" CACHE_EXT, g_cache.dir,
+			(unsigned long long) XXH3_64bits(abs, strlen(abs)));
+}
+
+/* XXH3 of a whole file, or 0 if it can't be read */
+static uint64_t file_hash(const char *path, uint64_t size)
+{
+	uint64_t hash = 0;
+	void *p;
+	int fd;
+
+	if (!size || (fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+		return 0;
+
+	p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
+		return 0;
+
+	hash = XXH3_64bits(p, size);
+	munmap(p, size);
+	return hash;
+}
+
+static int ent_cmp(const void *a, const void *b)
+{
+	const cache_ent_t *x = a, *y = b;
+
+	return (x->used > y->used) - (x->used < y->used);
+}
+
+/* list entries, oldest use first; returns how many, -1 on error */
+static int cache_scan(cache_ent_t **ents, uint64_t *total)
+{
+	DIR *d = opendir(g_cache.dir);
+	cache_ent_t *e = NULL;
+	struct dirent *de;
+	size_t n = 0, cap = 0;
+	char path[PATH_MAX + NAME_MAX + 2];
+	struct stat st;
+
+	*total = 0;
+	if (!d)
+		return -1;
+
+	while ((de = readdir(d))) {
+		size_t len = strlen(de->d_name);
+
+		if (len < sizeof(CACHE_EXT) || len >= sizeof(e->name)
+				|| strcmp(de->d_name + len
+					- (sizeof(CACHE_EXT) - 1), CACHE_EXT))
+			continue;
+
+		snprintf(path, sizeof(path), "%s/%s", g_cache.dir, de->d_name);
+		if (stat(path, &st) || !S_ISREG(st.st_mode))
+			continue;
+
+		if (n == cap) {
+			cache_ent_t *ne;
+
+			cap = cap ? cap * 2 : 64;
+			ne = realloc(e, cap * sizeof(*e));
+			CBUG(!ne, "realloc cache entries");
+			e = ne;
+		}
+
+		memcpy(e[n].name, de->d_name, len + 1);
+		e[n].used = st_mtime_ns(&st);
+		e[n].size = (uint64_t) st.st_size;
+		*total += e[n].size;
+		n++;
+	}
+
+	closedir(d);
+	qsort(e, n, sizeof(*e), ent_cmp);
+	*ents = e;
+	return (int) n;
+}
+
+/* drop the least recently used entries down to 3/4 of the cap */
+static void cache_prune(void)
+{
+	cache_ent_t *e = NULL;
+	uint64_t total, goal = g_cache.max / 4 * 3;
+	char path[PATH_MAX + 32];
+	int i, n;
+
+	if (pthread_mutex_trylock(&g_cache.prune_lock))
+		return;
+
+	n = cache_scan(&e, &total);
+	for (i = 0; i < n && total > goal; i++) {
+		snprintf(path, sizeof(path), "%s/%s", g_cache.dir, e[i].name);
+		if (!unlink(path))
+			total -= e[i].size;
+	}
+
+	atomic_store(&g_cache.total, total);
+	pthread_mutex_unlock(&g_cache.prune_lock);
+	free(e);
+}
+
+int qgl_tex_cache(const char *dir, uint64_t max_bytes)
+{
+	cache_ent_t *e = NULL;
+	uint64_t total;
+
+	g_cache.on = 0;
+	if (!dir)
+		return 0;
+
+	if (strlen(dir) + 32 >= sizeof(g_cache.dir)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	if (mkdir(dir, 0755) && errno != EEXIST) {
+		WARN("qgl_tex_cache: %s: %s\n", dir, strerror(errno));
+		return -1;
+	}
+
+	strcpy(g_cache.dir, dir);
+	g_cache.max = max_bytes;
+	if (cache_scan(&e, &total) < 0) {
+		WARN("qgl_tex_cache: %s: %s\n", dir, strerror(errno));
+		return -1;
+	}
+	free(e);
+
+	atomic_store(&g_cache.total, total);
+	g_cache.on = 1;
+	if (g_cache.max && total > g_cache.max)
+		cache_prune();
+
+	return 0;
+}
+
+static uint8_t *
+cache_get(const char *abs, uint32_t *w, uint32_t *h, size_t *map_len)
+{
+	char path[PATH_MAX];
+	const cache_hdr_t *hdr;
+	struct stat st, src;
+	uint8_t *p;
+	int fd;
+
+	cache_entry(path, sizeof(path), abs);
+	fd = open(path, O_RDWR | O_CLOEXEC);
+	if (fd < 0)
+		fd = open(path, O_RDONLY | O_CLOEXEC);	/* read-only cache */
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) || st.st_size < CACHE_DATA
+			|| stat(abs, &src)) {
+		close(fd);
+		return NULL;
+	}
+
+	/* private and writable: qgl_tex_paint() copies pages on write */
+	p = mmap(NULL, (size_t) st.st_size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE, fd, 0);
+	if (p == MAP_FAILED) {
+		close(fd);
+		return NULL;
+	}
+
+	hdr = (const cache_hdr_t *) p;
+	if (hdr->magic != CACHE_MAGIC || hdr->version != CACHE_VERSION
+			|| hdr->path_len != strlen(abs)
+			|| hdr->path_len > CACHE_DATA - sizeof(*hdr)
+			|| memcmp(hdr->path, abs, hdr->path_len)
+			|| (uint64_t) st.st_size != CACHE_DATA
+				+ (uint64_t) hdr->w * hdr->h * 4
+			|| hdr->src_size != (uint64_t) src.st_size)
+		goto miss;
+
+	if (hdr->src_mtime != st_mtime_ns(&src)) {
+		int64_t mtime = st_mtime_ns(&src);
+
+		if (file_hash(abs, hdr->src_size) != hdr->src_hash)
+			goto miss;
+
+		/* same content: remember the new mtime */
+		if (pwrite(fd, &mtime, sizeof(mtime),
+					offsetof(cache_hdr_t, src_mtime)) < 0)
+			WARN("qgl_tex_cache: %s: %s\n", path, strerror(errno));
+	}
+
+	/* the entry's mtime is its last use */
+	futimens(fd, NULL);
+	close(fd);
+
+	*w = hdr->w;
+	*h = hdr->h;
+	*map_len = (size_t) st.st_size;
+	return p + CACHE_DATA;
+
+miss:
+	munmap(p, (size_t) st.st_size);
+	close(fd);
+	return NULL;
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+
+	while (len) {
+		ssize_t ret = write(fd, p, len);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		p += ret;
+		len -= (size_t) ret;
+	}
+
+	return 0;
+}
+
+static void
+cache_put(const char *abs, const uint8_t *data, uint32_t w, uint32_t h)
+{
+	char path[PATH_MAX], tmp[PATH_MAX + 32];
+	uint8_t page[CACHE_DATA] = { 0 };
+	cache_hdr_t *hdr = (cache_hdr_t *) page;
+	size_t size = (size_t) w * h * 4;
+	uint64_t total;
+	struct stat src, old;
+	int fd;
+
+	if (strlen(abs) > CACHE_DATA - sizeof(*hdr) || stat(abs, &src))
+		return;
+
+	hdr->magic = CACHE_MAGIC;
+	hdr->version = CACHE_VERSION;
+	hdr->w = w;
+	hdr->h = h;
+	hdr->src_size = (uint64_t) src.st_size;
+	hdr->src_mtime = st_mtime_ns(&src);
+	hdr->src_hash = file_hash(abs, hdr->src_size);
+	hdr->path_len = (uint32_t) strlen(abs);
+	memcpy(hdr->path, abs, hdr->path_len);
+
+	/* written aside and renamed, so readers never see half an entry */
+	cache_entry(path, sizeof(path), abs);
+	snprintf(tmp, sizeof(tmp), "%s.%ld-%u", path, (long) getpid(),
+			atomic_fetch_add(&g_cache.tmp_seq, 1));
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+	if (fd < 0)
+		goto fail;
+
+	if (write_all(fd, page, sizeof(page)) || write_all(fd, data, size)) {
+		close(fd);
+		unlink(tmp);
+		goto fail;
+	}
+	close(fd);
+
+	if (!stat(path, &old))
+		atomic_fetch_sub(&g_cache.total, (uint64_t) old.st_size);
+
+	if (rename(tmp, path)) {
+		unlink(tmp);
+		goto fail;
+	}
+
+	total = atomic_fetch_add(&g_cache.total, CACHE_DATA + size)
+		+ CACHE_DATA + size;
+	if (g_cache.max && total > g_cache.max)
+		cache_prune();
+	return;
+
+fail:
+	WARN("qgl_tex_cache: %s: %s\n", path, strerror(errno));
+}
+
+uint8_t *
+img_cache_decode(const char *filename, img_decode_t *decode,
+		uint32_t *w, uint32_t *h, size_t *map_len)
+{
+	char abs[PATH_MAX];
+	uint8_t *data;
+
+	*map_len = 0;
+	if (!g_cache.on || !realpath(filename, abs))
+		return decode(filename, w, h);
+
+	data = cache_get(abs, w, h, map_len);
+	if (data)
+		return data;
+
+	data = decode(filename, w, h);
+	if (data)
+		cache_put(abs, data, *w, *h);
+
+	return data;
+}
+
+void img_cache_free(uint8_t *data, size_t map_len)
+{
+	if (map_len)
+		munmap(data - CACHE_DATA, map_len);
+	else
+		free(data);
+}
+
+#else
+
+int qgl_tex_cache(const char *dir, uint64_t max_bytes)
+{
+	(void) max_bytes;
+	if (!dir)
+		return 0;
+	errno = ENOSYS;
+	return -1;
+}
+
+uint8_t *
+img_cache_decode(const char *filename, img_decode_t *decode,
+		uint32_t *w, uint32_t *h, size_t *map_len)
+{
+	*map_len = 0;
+	return decode(filename, w, h);
+}
+
+void img_cache_free(uint8_t *data, size_t map_len)
+{
+	(void) map_len;
+	free(data);
+}
+
+#endif
@@ -1,18 +1,38 @@
 #include "../include/ttypt/qgl.h"
 
+#include "gl.h"
 #include "tex.h"
+#include "handle.h"
 
 #include <ttypt/qmap.h>
 #include <ttypt/qsys.h>
 #include <string.h>
+#include <time.h>
+
+enum img_state {
+	IMG_READY,
+	IMG_PENDING,	/* decoding on a worker */
+	IMG_FAILED,
+};
 
 typedef struct {
 	char *filename;
 	struct img_be *be;
 	uint8_t *data;
 	uint32_t w, h;
+	int state;
+	size_t map_len;	/* data is mapped from the texture cache */
+	uint32_t stride;	/* pixels per row of data */
+	int borrowed;	/* data belongs to a bundle */
 } img_t;
 
+/* completion callback of an asynchronous load */
+typedef struct {
+	unsigned ref;
+	qgl_tex_cb_t *cb;
+	void *ctx;
+} img_waiter_t;
+
 typedef struct {
 	const img_t *img;
 	uint32_t cx, cy, sw, sh, dw, dh,
@@ -20,16 +40,21 @@ typedef struct {
 	uint32_t tint;
 } img_ctx_t;
 
-static unsigned img_be_hd, img_hd, img_name_hd;
+static unsigned img_be_hd, img_name_hd;
+static qgl_htab_t img_tab = QGL_HTAB(img_t);
 static uint32_t tint;
+static img_waiter_t *g_waiters;
+static uint32_t g_nwaiters, g_waiters_cap;
 
 void img_be_load(char *ext,
 		img_load_t *load,
-		img_save_t *save)
+		img_save_t *save,
+		img_decode_t *decode)
 {
 	img_be_t img_be = {
 		.load = load,
 		.save = save,
+		.decode = decode,
 	};
 
 	qmap_put(img_be_hd, ext, &img_be);
@@ -37,15 +62,11 @@ void img_be_load(char *ext,
 
 void
 img_construct(void) {
-	unsigned qm_img_be = qmap_reg(sizeof(img_be_t)),
-		 qm_img = qmap_reg(sizeof(img_t));
+	unsigned qm_img_be = qmap_reg(sizeof(img_be_t));
 
 	img_be_hd = qmap_open(NULL, NULL, QM_STR,
 			qm_img_be, 0xF, 0);
 
-	img_hd = qmap_open(NULL, NULL, QM_HNDL,
-			qm_img, 0xF, QM_AINDEX);
-
 	img_name_hd = qmap_open(NULL, NULL, QM_STR,
 			QM_HNDL, 0xF, 0);
 
@@ -73,54 +94,117 @@ static inline void
 img_free(img_t *img)
 {
 	free(img->filename);
-	free(img->data);
+	if (img->data && !img->borrowed)
+		img_cache_free(img->data, img->map_len);
 }
 
 void
 img_deinit(void)
 {
-	unsigned cur;
-	const void *key, *value;
+	uint32_t it = 0;
+	img_t *img;
+
+	img_async_deinit();
+	free(g_waiters);
+	g_waiters = NULL;
+	g_nwaiters = g_waiters_cap = 0;
 
 	/* qdb_sync(img_name_hd); */
-	cur = qmap_iter(img_hd, NULL, 0);
+	while ((img = qgl_hnext(&img_tab, &it, NULL)))
+		img_free(img);
 
-	while (qmap_next(&key, &value, cur))
-		img_free((img_t *) value);
+	qgl_hfree(&img_tab);
 }
 
-unsigned
-img_new(uint8_t **data,
+static unsigned
+img_add(uint8_t *data,
 		const char *filename,
 		uint32_t w, uint32_t h,
 		unsigned flags UNUSED)
 {
-	img_t img;
+	img_t img, *old;
 	unsigned ref;
 	const unsigned *ref_r;
 	char *ext = strrchr(filename, '.');
 
 	img.w = w;
 	img.h = h;
-	img.data = malloc(img.w * img.h * 4);
+	img.data = data;
 	img.filename = strdup(filename);
 	img.be = (img_be_t *) qmap_get(img_be_hd, ext + 1);
-
-	if (data)
-		*data = img.data;
+	img.state = IMG_READY;
+	img.map_len = 0;
+	img.stride = w;
+	img.borrowed = 0;
 
 	ref_r = qmap_get(img_name_hd, filename);
-	ref = qmap_put(img_hd, ref_r, &img);
+	old = ref_r ? qgl_hget(&img_tab, *ref_r) : NULL;
+	if (old) {
+		/* loaded again, say after failing: drop what it held */
+		ref = *ref_r;
+		qgl_tex_ureg(ref);
+		qmap_del(img_name_hd, old->filename);
+		img_free(old);
+		*old = img;
+	} else
+		ref = qgl_hnew(&img_tab, &img);
 	qmap_put(img_name_hd, img.filename, &ref);
 
 
-	if (!(flags & IMG_LOAD))
-		qgl_tex_reg(ref, img.data,
-				img.w, img.h);
+	/*
+	 * Pending asynchronous loads get their texture when decoded; the
+	 * others upload their RGBA pixels once, with qgl_tex_upd().
+	 */
+	if (!(flags & IMG_LOAD) && data)
+		qgl_tex_reg(ref, NULL, img.w, img.h);
 
 	return ref;
 }
 
+unsigned
+img_new(uint8_t **data,
+		const char *filename,
+		uint32_t w, uint32_t h,
+		unsigned flags)
+{
+	uint8_t *buf = malloc(w * h * 4);
+
+	if (data)
+		*data = buf;
+
+	return img_add(buf, filename, w, h, flags);
+}
+
+unsigned
+img_put(uint8_t *data, const char *filename, uint32_t w, uint32_t h)
+{
+	return img_add(data, filename, w, h, 0);
+}
+
+unsigned
+img_put_shared(uint8_t *data, const char *name,
+		uint32_t w, uint32_t h, uint32_t stride)
+{
+	const char *ext = strrchr(name, '.');
+	img_t img = {
+		.filename = strdup(name),
+		.be = ext ? (img_be_t *) qmap_get(img_be_hd, ext + 1) : NULL,
+		.data = data,
+		.w = w,
+		.h = h,
+		.state = IMG_READY,
+		.stride = stride,
+		.borrowed = 1,
+	};
+	unsigned ref = qgl_hnew(&img_tab, &img);
+
+	/* the name now finds this one; an older image keeps its ref */
+	qmap_put(img_name_hd, img.filename, &ref);
+	return ref;
+}
+
+static void img_async_wait(unsigned ref);
+
 unsigned qgl_tex_load(const char *filename) {
 	char *ext = strrchr(filename, '.');
 	img_be_t *be;
@@ -129,7 +213,14 @@ unsigned qgl_tex_load(const char *filename) {
 	img_t *img;
 
 	ref_r = qmap_get(img_name_hd, filename);
-	if (ref_r && qmap_get(img_hd, ref_r))
+	img = ref_r ? qgl_hget(&img_tab, *ref_r) : NULL;
+	while (img && img->state == IMG_PENDING) {
+		/* callbacks may queue loads, moving both: look again */
+		img_async_wait(*ref_r);
+		ref_r = qmap_get(img_name_hd, filename);
+		img = ref_r ? qgl_hget(&img_tab, *ref_r) : NULL;
+	}
+	if (img && img->state == IMG_READY)
 		return *ref_r;
 
 	CBUG(!ext, "IMG: invalid filename %s\n", filename);
@@ -137,8 +228,22 @@ unsigned qgl_tex_load(const char *filename) {
 	be = (img_be_t *) qmap_get(img_be_hd, ext + 1);
 	CBUG(!be, "IMG: %s backend not present.\n", ext);
 
-	ref = be->load(filename);
-	img = (img_t *) qmap_get(img_hd, &ref);
+	if (be->decode) {
+		uint8_t *data;
+		uint32_t w, h;
+		size_t map_len;
+
+		data = img_cache_decode(filename, be->decode, &w, &h, &map_len);
+		CBUG(!data, "IMG: can't load %s\n", filename);
+
+		ref = img_put(data, filename, w, h);
+		qgl_tex_upd(ref, 0, 0, w, h, data);
+		img = (img_t *) qgl_hget(&img_tab, ref);
+		img->map_len = map_len;
+	} else {
+		ref = be->load(filename);
+		img = (img_t *) qgl_hget(&img_tab, ref);
+	}
 	img->be = be;
 
 	WARN("img_load %u: %s\n", ref, filename);
@@ -146,26 +251,197 @@ unsigned qgl_tex_load(const char *filename) {
 	return ref;
 }
 
+static void img_notify(unsigned ref, int ok)
+{
+	uint32_t i = 0;
+
+	/* callbacks may queue more loads: don't hold on to entries */
+	while (i < g_nwaiters) {
+		img_waiter_t w = g_waiters[i];
+
+		if (w.ref != ref) {
+			i++;
+			continue;
+		}
+
+		g_waiters[i] = g_waiters[--g_nwaiters];
+		w.cb(ref, ok, w.ctx);
+	}
+}
+
+unsigned qgl_tex_load_async(const char *filename,
+		qgl_tex_cb_t *cb, void *ctx)
+{
+	char *ext = strrchr(filename, '.');
+	const unsigned *ref_r;
+	img_be_t *be;
+	img_t *img;
+	unsigned ref;
+
+	ref_r = qmap_get(img_name_hd, filename);
+	img = ref_r ? qgl_hget(&img_tab, *ref_r) : NULL;
+	if (img && img->state == IMG_FAILED)
+		img = NULL;
+
+	if (img) {
+		ref = *ref_r;
+	} else {
+		CBUG(!ext, "IMG: invalid filename %s\n", filename);
+		be = (img_be_t *) qmap_get(img_be_hd, ext + 1);
+		CBUG(!be, "IMG: %s backend not present.\n", ext);
+		CBUG(!be->decode, "IMG: %s can't load asynchronously.\n", ext);
+
+		/* a placeholder of size 0 and no texture until it's decoded */
+		ref = img_add(NULL, filename, 0, 0, 0);
+		img = (img_t *) qgl_hget(&img_tab, ref);
+		img->be = be;
+		img->state = IMG_PENDING;
+		/* qgl_flush() registers it while other threads may record */
+		qgl_tex_reserve(ref);
+		img_async_push(ref, filename, be->decode);
+	}
+
+	if (!cb)
+		return ref;
+
+	if (img->state != IMG_PENDING) {
+		cb(ref, 1, ctx);
+		return ref;
+	}
+
+	if (g_nwaiters == g_waiters_cap) {
+		g_waiters_cap = g_waiters_cap ? g_waiters_cap * 2 : 16;
+		g_waiters = realloc(g_waiters,
+				g_waiters_cap * sizeof(*g_waiters));
+		CBUG(!g_waiters, "realloc img waiters");
+	}
+	g_waiters[g_nwaiters++] = (img_waiter_t) { ref, cb, ctx };
+
+	return ref;
+}
+
+/* register one finished decode; returns the ref it was for */
+static unsigned img_async_finish(int wait)
+{
+	unsigned ref;
+	uint8_t *data;
+	uint32_t w, h;
+	size_t map_len;
+	img_t *img;
+
+	if (!img_async_pop(&ref, &data, &w, &h, &map_len, wait))
+		return QM_MISS;
+
+	img = qgl_hget(&img_tab, ref);
+	if (!img || img->state != IMG_PENDING) {
+		/* deleted meanwhile */
+		if (data)
+			img_cache_free(data, map_len);
+		return ref;
+	}
+
+	if (!data) {
+		WARN("img_load_async %u: %s failed\n", ref, img->filename);
+		img->state = IMG_FAILED;
+		img_notify(ref, 0);
+		return ref;
+	}
+
+	img->data = data;
+	img->w = w;
+	img->h = h;
+	img->map_len = map_len;
+	img->stride = w;
+	img->state = IMG_READY;
+
+	/* make room, then upload the RGBA pixels once */
+	qgl_tex_reg(ref, NULL, w, h);
+	qgl_tex_upd(ref, 0, 0, w, h, data);
+
+	img_notify(ref, 1);
+	return ref;
+}
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000;
+}
+
+void img_async_drain(void)
+{
+	uint64_t end = now_us() + (uint64_t) qgl_hint_get(QGL_HINT_UPLOAD_US);
+
+	do {
+		if (img_async_finish(0) == QM_MISS)
+			return;
+	} while (now_us() < end);
+}
+
+static void img_async_wait(unsigned ref)
+{
+	const img_t *img = qgl_hget(&img_tab, ref);
+
+	while (img && img->state == IMG_PENDING) {
+		if (img_async_finish(1) == QM_MISS)
+			return;
+		img = qgl_hget(&img_tab, ref);
+	}
+}
+
+void qgl_tex_wait(void)
+{
+	while (img_async_finish(1) != QM_MISS)
+		;
+}
+
+int qgl_tex_ready(unsigned ref)
+{
+	const img_t *img = qgl_hget(&img_tab, ref);
+
+	if (!img || img->state == IMG_FAILED)
+		return -1;
+
+	return img->state == IMG_READY;
+}
+
 void
 qgl_tex_save(unsigned ref)
 {
-	const img_t *img = qmap_get(img_hd, &ref);
-
-	img->be->save(img->filename, img->data,
-			img->w, img->h);
+	const img_t *img = qgl_hget(&img_tab, ref);
+	uint8_t *rows;
+	uint32_t y;
+
+	if (img->stride == img->w) {
+		img->be->save(img->filename, img->data,
+				img->w, img->h);
+		return;
+	}
+
+	/* part of a bundle page: gather its rows */
+	rows = malloc((size_t) img->w * img->h * 4);
+	CBUG(!rows, "malloc img rows");
+	for (y = 0; y < img->h; y++)
+		memcpy(rows + (size_t) y * img->w * 4,
+				img->data + (size_t) y * img->stride * 4,
+				(size_t) img->w * 4);
+	img->be->save(img->filename, rows, img->w, img->h);
+	free(rows);
 }
 
 const img_t *
 img_get(unsigned ref)
 {
-	return qmap_get(img_hd, &ref);
+	return qgl_hget(&img_tab, ref);
 }
 
 static inline uint8_t *
 _img_pick(const img_t *img, uint32_t x, uint32_t y)
 {
 	uint8_t *pixel = &img->data[
-		(y * img->w + x) * 4
+		((size_t) y * img->stride + x) * 4
 	];
 
 	return pixel;
@@ -174,7 +450,7 @@ _img_pick(const img_t *img, uint32_t x, uint32_t y)
 void qgl_tex_draw(uint32_t ref, int32_t x, int32_t y,
 		uint32_t dw, uint32_t dh)
 {
-	const img_t *img = qmap_get(img_hd, &ref);
+	const img_t *img = qgl_hget(&img_tab, ref);
 
 	qgl_tex_draw_x(ref, x, y, 0, 0,
 			img->w, img->h, dw, dh, qgl_default_tint);
@@ -189,7 +465,7 @@ qgl_tint(uint32_t atint)
 void
 qgl_tex_size(uint32_t *w, uint32_t *h, unsigned ref)
 {
-	const img_t *img = qmap_get(img_hd, &ref);
+	const img_t *img = qgl_hget(&img_tab, ref);
 
 	*w = img->w;
 	*h = img->h;
@@ -198,7 +474,7 @@ qgl_tex_size(uint32_t *w, uint32_t *h, unsigned ref)
 uint32_t
 qgl_tex_pick(unsigned ref, uint32_t x, uint32_t y)
 {
-	const img_t *img = qmap_get(img_hd, &ref);
+	const img_t *img = qgl_hget(&img_tab, ref);
 	uint8_t *color = _img_pick(img, x, y);
 
 	return color[0]
@@ -210,7 +486,7 @@ qgl_tex_pick(unsigned ref, uint32_t x, uint32_t y)
 void
 qgl_tex_paint(unsigned ref, uint32_t x, uint32_t y, uint32_t c)
 {
-	const img_t *img = qmap_get(img_hd, &ref);
+	const img_t *img = qgl_hget(&img_tab, ref);
 	uint8_t *color = _img_pick(img, x, y);
 
 	color[0] = c & 0xFF;
@@ -226,10 +502,11 @@ img_del(unsigned ref)
 {
 	qgl_tex_ureg(ref);
 
-	const img_t *img = qmap_get(img_hd, &ref);
+	const img_t *img = qgl_hget(&img_tab, ref);
 	qmap_del(img_name_hd, img->filename);
 	free(img->filename);
-	free(img->data);
-	qmap_del(img_hd, &ref);
+	if (img->data && !img->borrowed)
+		img_cache_free(img->data, img->map_len);
+	qgl_hdel(&img_tab, ref);
 }
 
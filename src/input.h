@@ -9,6 +9,9 @@ typedef struct {
 	input_deinit_t *deinit, *poll;
 } qgl_input_t;
 
+/* the active input backend */
+extern qgl_input_t qgl_input;
+
 void input_call(unsigned short code,
 		unsigned short value,
 		int type);
@@ -0,0 +1,168 @@
+/*
+ * layer.c — layer-sorted submission
+ *
+ * While a layer is set (qgl_layer), batched quads are queued with a
+ * sort key instead of going to the batch. At the next flush point the
+ * queue is radix sorted and handed to the batch: layers in ascending
+ * order, and inside a layer by program and texture, so that
+ * interleaved draws merge. The sort is stable, so quads with equal
+ * keys keep their call order; strict layers key on the layer alone.
+ */
+
+#include "../include/ttypt/qgl.h"
+#include "./gl.h"
+
+#include <ttypt/qsys.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* key: layer << 32 | program << 24 | texture, 6 bytes in use */
+#define KEY_BYTES 6
+
+typedef struct {
+	uint64_t key;
+	uint32_t idx;
+} layer_ent_t;
+
+typedef struct {
+	const qgl_pipe_t *pipe;
+	GLuint tex;
+} layer_src_t;
+
+static struct {
+	qgl_inst_t *inst;
+	layer_src_t *src;
+	layer_ent_t *ent, *tmp;
+	uint32_t n, cap;
+} g_q;
+
+static uint32_t g_layer = QGL_LAYER_NONE;
+
+/* pipelines seen so far; their index is the program part of the key */
+static const qgl_pipe_t *g_pipes[256];
+static uint32_t g_npipes;
+
+void qgl_layer(uint32_t layer)
+{
+	/* later unlayered draws must land on top */
+	if (layer == QGL_LAYER_NONE)
+		qgl_layer_flush();
+
+	g_layer = layer;
+}
+
+int qgl_layer_on(void)
+{
+	return g_layer != QGL_LAYER_NONE;
+}
+
+static void queue_grow(void)
+{
+	g_q.cap = g_q.cap ? g_q.cap * 2 : 1024;
+	g_q.inst = realloc(g_q.inst, g_q.cap * sizeof(*g_q.inst));
+	g_q.src = realloc(g_q.src, g_q.cap * sizeof(*g_q.src));
+	g_q.ent = realloc(g_q.ent, g_q.cap * sizeof(*g_q.ent));
+	g_q.tmp = realloc(g_q.tmp, g_q.cap * sizeof(*g_q.tmp));
+	CBUG(!g_q.inst || !g_q.src || !g_q.ent || !g_q.tmp,
+			"realloc layer queue");
+}
+
+static uint32_t pipe_id(const qgl_pipe_t *pipe)
+{
+	uint32_t i;
+
+	for (i = 0; i < g_npipes; i++)
+		if (g_pipes[i] == pipe)
+			return i;
+
+	CBUG(g_npipes == 256, "too many pipelines");
+	g_pipes[g_npipes] = pipe;
+	return g_npipes++;
+}
+
+int qgl_layer_push(const qgl_pipe_t *pipe, GLuint tex,
+		const qgl_inst_t *inst)
+{
+	uint64_t key;
+
+	if (g_layer == QGL_LAYER_NONE)
+		return -1;
+
+	if (g_q.n == g_q.cap)
+		queue_grow();
+
+	key = (uint64_t) (g_layer & 0xffff) << 32;
+	if (!(g_layer & QGL_LAYER_STRICT))
+		key |= (uint64_t) pipe_id(pipe) << 24
+			| (pipe->textured ? tex & 0xffffff : 0);
+
+	g_q.inst[g_q.n] = *inst;
+	g_q.src[g_q.n] = (layer_src_t) { pipe, tex };
+	g_q.ent[g_q.n] = (layer_ent_t) { key, g_q.n };
+	g_q.n++;
+	return 0;
+}
+
+/* LSD radix sort on the key bytes, skipping bytes that never vary */
+static layer_ent_t *sort(void)
+{
+	layer_ent_t *a = g_q.ent, *b = g_q.tmp, *t;
+	uint32_t count[256], i, d, sum;
+	unsigned byte;
+
+	for (byte = 0; byte < KEY_BYTES; byte++) {
+		unsigned sh = byte * 8;
+
+		memset(count, 0, sizeof(count));
+		for (i = 0; i < g_q.n; i++)
+			count[(a[i].key >> sh) & 0xff]++;
+
+		if (count[(a[0].key >> sh) & 0xff] == g_q.n)
+			continue;
+
+		for (d = 0, sum = 0; d < 256; d++) {
+			uint32_t c = count[d];
+
+			count[d] = sum;
+			sum += c;
+		}
+
+		for (i = 0; i < g_q.n; i++)
+			b[count[(a[i].key >> sh) & 0xff]++] = a[i];
+
+		t = a;
+		a = b;
+		b = t;
+	}
+
+	return a;
+}
+
+void qgl_layer_flush(void)
+{
+	const layer_ent_t *ent;
+	uint32_t i, n = g_q.n;
+
+	if (!n)
+		return;
+
+	ent = sort();
+	g_q.n = 0;
+
+	for (i = 0; i < n; i++) {
+		const layer_src_t *src = &g_q.src[ent[i].idx];
+
+		qgl_batch_add(src->pipe, src->tex, &g_q.inst[ent[i].idx]);
+	}
+}
+
+void qgl_layer_deinit(void)
+{
+	free(g_q.inst);
+	free(g_q.src);
+	free(g_q.ent);
+	free(g_q.tmp);
+	memset(&g_q, 0, sizeof(g_q));
+	g_npipes = 0;
+	g_layer = QGL_LAYER_NONE;
+}
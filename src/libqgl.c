@@ -2,13 +2,18 @@
 #include "./gl.h"
 #include "./be.h"
 #include "./input.h"
+#include "./handle.h"
+#include "./tex.h"
 #include <ttypt/qsys.h>
 #include <ttypt/qmap.h>
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <math.h>
+#include <unistd.h>
 
 qgl_be_t qgl_be;
 qgl_input_t qgl_input;
@@ -16,15 +21,44 @@ qgl_input_t qgl_input;
 GLuint g_fbo;
 GLuint g_tex;
 
-GLuint g_prog_tex;
-static GLuint g_prog_fill;
-GLint  g_uProj_tex, g_uDst_tex, g_uUV_tex,
-       g_uTint_tex, g_uSampler;
-static GLint  g_uProj_fill, g_uDst_fill, g_uColor_fill;
+qgl_pipe_t g_pipe_quad;
 
 GLuint g_vao_dummy;
 
-static uint32_t g_tex_map_hd;
+/* projection shared by all batch programs (see view_upload) */
+static GLuint g_ubo_view;
+static uint32_t g_ubo_w, g_ubo_h;
+
+/* instanced quad batch (see qgl_batch_push) */
+static GLuint g_vao_batch;
+static qgl_inst_t g_batch[QGL_BATCH_MAX];
+static uint32_t g_batch_n;
+static const qgl_pipe_t *g_batch_pipe;
+static GLuint g_batch_tex;
+
+/* streaming vertex ring (see qgl_ring_write) */
+static struct {
+	GLuint vbo;
+	uint8_t *map;		/* persistent mapping, NULL if mapping per write */
+	size_t region;		/* bytes per region */
+	size_t head;		/* write offset inside the current region */
+	unsigned cur;		/* region being filled */
+	GLsync fence[QGL_RING_REGIONS];
+} g_ring;
+
+static uint64_t g_stat_cur[QGL_STAT_MAX], g_stat_last[QGL_STAT_MAX];
+
+/* area of the screen target drawn to this frame (see qgl_damage) */
+static struct {
+	float x0, y0, x1, y1;
+} g_damage;
+static int g_retained;
+
+static int g_hint[QGL_HINT_MAX] = {
+	[QGL_HINT_ATLAS_PAGE] = 2048,
+	[QGL_HINT_UPLOAD_US] = 2000,
+};
+
 uint32_t qgl_height, qgl_width;
 screen_t screen;
 
@@ -35,63 +69,127 @@ GLuint g_view_fbo = 0;
 uint32_t g_view_w = 0;
 uint32_t g_view_h = 0;
 
-static const char *VS_TEX = "#version 330 core\n"
-"uniform mat4 uProj;\n"
-"uniform vec4 uDst;  // x,y,w,h em pixels\n"
-"uniform vec4 uUV;   // u0,v0,u1,v1\n"
+/* one instance per quad; corners come from gl_VertexID (triangle fan) */
+static const char *VS_QUAD = "#version 330 core\n"
+"layout(location = 0) in vec4 iDst;    // x,y,w,h em pixels\n"
+"layout(location = 1) in vec4 iUV;     // u0,v0,u1,v1 ou caixa x,y,w,h\n"
+"layout(location = 2) in vec4 iColor;  // RGBA 0..1\n"
+"layout(location = 3) in vec4 iRadius; // tl,tr,br,bl\n"
+"layout(location = 4) in vec4 iParam;\n"
+"layout(location = 5) in uint iKind;\n"
+"layout(std140) uniform QglView { mat4 uProj; };\n"
 "out vec2 vUV;\n"
+"out vec4 vColor;\n"
+"out vec2 vPos;\n"
+"flat out vec4 vBox;\n"
+"flat out vec4 vRadius;\n"
+"flat out vec4 vParam;\n"
+"flat out uint vKind;\n"
 "void main(){\n"
 "  // 0:(0,0) 1:(1,0) 2:(1,1) 3:(0,1)\n"
 "  int id = gl_VertexID;\n"
 "  vec2 p = vec2((id==1||id==2)?1.0:0.0, (id>=2)?1.0:0.0);\n"
-"  vec2 pos = uDst.xy + p * uDst.zw;\n"
+"  vec2 pos = iDst.xy + p * iDst.zw;\n"
 "  gl_Position = uProj * vec4(pos, 0.0, 1.0);\n"
-"  vec2 uv0 = uUV.xy, uv1 = uUV.zw;\n"
-"  vUV = mix(uv0, uv1, p);\n"
+"  vUV = mix(iUV.xy, iUV.zw, p);\n"
+"  vColor = iColor;\n"
+"  vPos = pos - iUV.xy;\n"
+"  vBox = iUV;\n"
+"  vRadius = iRadius;\n"
+"  vParam = iParam;\n"
+"  vKind = iKind;\n"
 "}\n";
 
-static const char *FS_TEX = "#version 330 core\n"
+/* every qgl_kind_t in one program; the kind is flat per quad */
+static const char *FS_QUAD =
+"#version 330 core\n"
 "in vec2 vUV;\n"
+"in vec2 vPos;\n"
+"in vec4 vColor;\n"
+"flat in vec4 vBox;       /* shape box for SDF kinds */\n"
+"flat in vec4 vRadius;\n"
+"flat in vec4 vParam;\n"
+"flat in uint vKind;\n"
 "uniform sampler2D uTex;\n"
-"uniform vec4 uTint; // RGBA 0..1\n"
 "out vec4 FragColor;\n"
-"void main(){ FragColor = texture(uTex, vUV) * uTint; }\n";
-
-/* shared vertex shader for fill/stroke (local coords relative to uDst.xy) */
-const char *VS_FILL =
-"#version 330 core\n"
-"uniform mat4 uProj;\n"
-"uniform vec4 uDst;     /* x,y,w,h */\n"
-"out vec2 vPos;\n"
+"float sdRoundedBox(vec2 p, vec2 b, vec4 r)\n"
+"{\n"
+"\tfloat m = 0.5 * min(b.x, b.y);\n"
+"\tr = clamp(r, 0.0, m);\n"
+"\tvec2 pc = p - b * 0.5;\n"
+"\tvec2 bh = b * 0.5;\n"
+"\tfloat rq = (pc.x > 0.0) ? ((pc.y > 0.0) ? r.y : r.z)\n"
+"\t\t\t       : ((pc.y > 0.0) ? r.x : r.w);\n"
+"\tvec2 q = abs(pc) - bh + rq;\n"
+"\treturn min(max(q.x, q.y), 0.0) + length(max(q, 0.0)) - rq;\n"
+"}\n"
+"void fill_round(float d, float aa)\n"
+"{\n"
+"\tfloat edge_in = smoothstep(0.0, aa, -d);\n"
+"\tif (edge_in <= 0.0) discard;\n"
+"\tFragColor = vec4(vColor.rgb, vColor.a * edge_in);\n"
+"}\n"
+"/* vParam.x: border width */\n"
+"void stroke_round(vec2 size, float dOuter, float aa)\n"
+"{\n"
+"\tfloat w = vParam.x * 1.25;\n"
+"\tfloat dInner = sdRoundedBox(vPos - vec2(w, w), size - 2.0 * vec2(w), max(vRadius - w, 0.0));\n"
+"\tif (dOuter > 0.0 || dInner < 0.0) discard;\n"
+"\tfloat aOuter = smoothstep(0.0, aa, -dOuter);\n"
+"\tfloat aInner = smoothstep(0.0, aa, dInner);\n"
+"\tfloat alpha = aOuter * aInner;\n"
+"\tFragColor = vec4(vColor.rgb, vColor.a * alpha);\n"
+"}\n"
+"/* vBox: div geometry; vParam: spread, offset x, offset y, clip div */\n"
+"void shadow_round(float d0, float d1, float aa1)\n"
+"{\n"
+"\tfloat aa = max(aa1, 1e-4);\n"
+"\tif (d1 <= -aa) discard;\n"
+"\tfloat edge = smoothstep(-aa, aa, d1);\n"
+"\tfloat sig = max(vParam.x, 0.5);\n"
+"\tfloat fall = exp(-(d1 * d1) / (sig * sig));\n"
+"\tfloat alpha = vColor.a * edge * fall;\n"
+"\tfloat clip = smoothstep(0.0, aa, d0);\n"
+"\talpha *= mix(1.0, clip, clamp(vParam.w, 0.0, 1.0));\n"
+"\tif (alpha < 0.001) discard;\n"
+"\tFragColor = vec4(vColor.rgb, alpha);\n"
+"}\n"
 "void main(void)\n"
 "{\n"
-"	vec2 a;\n"
-"	if      (gl_VertexID == 0) a = vec2(0.0, 0.0);\n"
-"	else if (gl_VertexID == 1) a = vec2(1.0, 0.0);\n"
-"	else if (gl_VertexID == 2) a = vec2(1.0, 1.0);\n"
-"	else                       a = vec2(0.0, 1.0);\n"
-"\n"
-"	vec2 worldPos = uDst.xy + a * uDst.zw;\n"
-"	gl_Position = uProj * vec4(worldPos, 0.0, 1.0);\n"
-"	vPos = worldPos - uDst.xy;\n"
+"\t/* 2x2 pixel blocks may straddle quads of other kinds, so\n"
+"\t * everything needing derivatives is computed before the switch */\n"
+"\tvec2 size = vBox.zw;\n"
+"\tvec4 texel = texture(uTex, vUV);\n"
+"\tfloat d0 = sdRoundedBox(vPos, size, vRadius);\n"
+"\tfloat d1 = sdRoundedBox(vPos - 0.5 * vParam.yz,\n"
+"\t\t\tmax(size - abs(vParam.yz) + 2.0, vec2(1.0)), vRadius);\n"
+"\tfloat aa0 = fwidth(d0);\n"
+"\tfloat aa1 = fwidth(d1);\n"
+"\tswitch (vKind) {\n"
+"\tcase 0u: FragColor = vColor; break;\n"
+"\tcase 1u: FragColor = texel * vColor; break;\n"
+"\tcase 2u: fill_round(d0, aa0); break;\n"
+"\tcase 3u: stroke_round(size, d0, aa0); break;\n"
+"\tdefault: shadow_round(d0, d1, aa1); break;\n"
+"\t}\n"
 "}\n";
 
-
-static const char *FS_FILL = "#version 330 core\n"
-"uniform vec4 uColor;\n"
-"out vec4 FragColor;\n"
-"void main(){ FragColor = uColor; }\n";
-
 typedef struct {
-	GLuint id;
+	GLuint id;		/* own texture, or the atlas page */
 	uint32_t w, h;
+	uint32_t x, y;		/* origin inside id */
+	uint32_t tw, th;	/* size of id */
+	uint32_t page;		/* atlas page, QGL_ATLAS_NONE if standalone */
 } gl_tex_info_t;
 
-typedef struct {
-	uint32_t ref;
-	int32_t x, y;
-	uint32_t cx, cy, sw, sh, dw, dh, tint;
-} hw_cmd_t;
+/* GL side of each image, keyed by image handle */
+static qgl_htab_t g_tex_tab = QGL_HTAB_KEYED(gl_tex_info_t);
+
+/* command lists (see qgl_cmdlist_begin) */
+static qgl_htab_t g_list_tab = QGL_HTAB(hw_list_t);
+static hw_list_t g_rec;
+static int g_recording;
+static GLuint g_rec_fbo;
 
 GLuint qgl_compile(GLenum type, const char *src) {
 	GLuint s = glCreateShader(type);
@@ -128,29 +226,563 @@ extern qgl_be_t __attribute__((weak)) qgl_fb;
 extern qgl_be_t qgl_glfw;
 extern qgl_input_t __attribute__((weak)) qgl_input_dev;
 extern qgl_input_t qgl_input_glfw;
+extern qgl_be_t __attribute__((weak)) qgl_mem;
+extern qgl_input_t __attribute__((weak)) qgl_input_none;
 
 extern void shadow_init(void);
 
+static int gl_has_ext(const char *name)
+{
+	GLint i, n = 0;
+
+	glGetIntegerv(GL_NUM_EXTENSIONS, &n);
+	for (i = 0; i < n; i++) {
+		const char *ext = (const char *) glGetStringi(GL_EXTENSIONS, i);
+
+		if (ext && !strcmp(ext, name))
+			return 1;
+	}
+
+	return 0;
+}
+
+/* a new buffer of free regions `region` bytes each */
+static void ring_alloc(size_t region)
+{
+	GLsizeiptr size = (GLsizeiptr) (QGL_RING_REGIONS * region);
+
+	g_ring.region = region;
+	g_ring.cur = 0;
+	g_ring.head = 0;
+
+	glGenBuffers(1, &g_ring.vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, g_ring.vbo);
+
+#ifdef GL_MAP_PERSISTENT_BIT
+	GLint major = 0, minor = 0;
+
+	glGetIntegerv(GL_MAJOR_VERSION, &major);
+	glGetIntegerv(GL_MINOR_VERSION, &minor);
+
+	if (major > 4 || (major == 4 && minor >= 4)
+			|| gl_has_ext("GL_ARB_buffer_storage")) {
+		GLbitfield flags = GL_MAP_WRITE_BIT
+			| GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+		glBufferStorage(GL_ARRAY_BUFFER, size, NULL, flags);
+		g_ring.map = glMapBufferRange(GL_ARRAY_BUFFER, 0, size, flags);
+		if (g_ring.map)
+			return;
+
+		/* immutable storage can't be respecified; start over */
+		WARN("persistent vertex ring unavailable, mapping per batch\n");
+		glDeleteBuffers(1, &g_ring.vbo);
+		glGenBuffers(1, &g_ring.vbo);
+		glBindBuffer(GL_ARRAY_BUFFER, g_ring.vbo);
+	}
+#endif
+
+	glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_STREAM_DRAW);
+}
+
+/* drop the buffer; GL keeps it until the draws reading it are done */
+static void ring_free(void)
+{
+	unsigned i;
+
+	for (i = 0; i < QGL_RING_REGIONS; i++)
+		if (g_ring.fence[i]) {
+			glDeleteSync(g_ring.fence[i]);
+			g_ring.fence[i] = NULL;
+		}
+
+	if (g_ring.map) {
+		glBindBuffer(GL_ARRAY_BUFFER, g_ring.vbo);
+		glUnmapBuffer(GL_ARRAY_BUFFER);
+		g_ring.map = NULL;
+	}
+
+	glDeleteBuffers(1, &g_ring.vbo);
+	g_ring.vbo = 0;
+}
+
+static void ring_init(void)
+{
+	ring_alloc(QGL_RING_REGION);
+}
+
+/* fence the region just filled and wait until the next one is free */
+static void ring_advance(void)
+{
+	GLsync *fence;
+
+	g_ring.fence[g_ring.cur] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	g_ring.cur = (g_ring.cur + 1) % QGL_RING_REGIONS;
+	g_ring.head = 0;
+
+	fence = &g_ring.fence[g_ring.cur];
+	if (!*fence)
+		return;
+
+	if (glClientWaitSync(*fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+		g_stat_cur[QGL_STAT_RING_WAITS]++;
+		while (glClientWaitSync(*fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+					1000000000) == GL_TIMEOUT_EXPIRED)
+			;
+	}
+
+	glDeleteSync(*fence);
+	*fence = NULL;
+}
+
+/*
+ * A frame that outgrows its region gets a buffer with larger ones.
+ * Taking the next region instead would have the next frame wait on
+ * this one. The new buffer is all free, and the old one is only read
+ * by draws already issued.
+ */
+static void ring_grow(size_t len)
+{
+	size_t region = g_ring.region * 2;
+
+	while (region < g_ring.head + len)
+		region *= 2;
+
+	WARN("vertex ring: %zu KiB a frame\n", region >> 10);
+	ring_free();
+	ring_alloc(region);
+}
+
+int qgl_ring_write(const void *data, size_t len, size_t *off)
+{
+	size_t at;
+	void *dst;
+
+	if (!g_ring.vbo)
+		return -1;
+
+	if (g_ring.head + len > g_ring.region)
+		ring_grow(len);
+
+	at = (size_t) g_ring.cur * g_ring.region + g_ring.head;
+
+	if (g_ring.map)
+		memcpy(g_ring.map + at, data, len);
+	else {
+		/* the fences already keep us off bytes the GPU may read */
+		glBindBuffer(GL_ARRAY_BUFFER, g_ring.vbo);
+		dst = glMapBufferRange(GL_ARRAY_BUFFER, (GLintptr) at,
+				(GLsizeiptr) len, GL_MAP_WRITE_BIT
+				| GL_MAP_INVALIDATE_RANGE_BIT
+				| GL_MAP_UNSYNCHRONIZED_BIT);
+		if (dst) {
+			memcpy(dst, data, len);
+			glUnmapBuffer(GL_ARRAY_BUFFER);
+		} else
+			glBufferSubData(GL_ARRAY_BUFFER, (GLintptr) at,
+					(GLsizeiptr) len, data);
+	}
+
+	g_ring.head += (len + 15) & ~(size_t) 15;
+	*off = at;
+	return 0;
+}
+
+void qgl_ring_frame(void)
+{
+	if (g_ring.head)
+		ring_advance();
+}
+
+static void ring_deinit(void)
+{
+	ring_free();
+	memset(&g_ring, 0, sizeof(g_ring));
+}
+
+static void batch_init(void)
+{
+	GLuint i;
+
+	glGenVertexArrays(1, &g_vao_batch);
+	qgl_bind_vao(g_vao_batch);
+
+	for (i = 0; i < 6; i++) {
+		glEnableVertexAttribArray(i);
+		glVertexAttribDivisor(i, 1);
+	}
+
+	qgl_bind_vao(g_vao_dummy);
+}
+
+/* point the instance attributes at a batch written to the ring */
+static void batch_attribs(size_t base)
+{
+	const GLsizei stride = sizeof(qgl_inst_t);
+
+	glBindBuffer(GL_ARRAY_BUFFER, g_ring.vbo);
+	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, stride,
+			(void *) (base + offsetof(qgl_inst_t, dst)));
+	glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, stride,
+			(void *) (base + offsetof(qgl_inst_t, uv)));
+	/* 0xAARRGGBB little-endian is B,G,R,A in memory */
+	glVertexAttribPointer(2, GL_BGRA, GL_UNSIGNED_BYTE, GL_TRUE, stride,
+			(void *) (base + offsetof(qgl_inst_t, color)));
+	glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, stride,
+			(void *) (base + offsetof(qgl_inst_t, radius)));
+	glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, stride,
+			(void *) (base + offsetof(qgl_inst_t, param)));
+	glVertexAttribIPointer(5, 1, GL_UNSIGNED_INT, stride,
+			(void *) (base + offsetof(qgl_inst_t, kind)));
+}
+
+void qgl_pipe_init(qgl_pipe_t *pipe, const char *fs, int textured)
+{
+	pipe->prog = qgl_link(
+			qgl_compile(GL_VERTEX_SHADER, VS_QUAD),
+			qgl_compile(GL_FRAGMENT_SHADER, fs));
+	pipe->textured = textured;
+
+	glUniformBlockBinding(pipe->prog,
+			glGetUniformBlockIndex(pipe->prog, "QglView"),
+			QGL_UBO_VIEW);
+
+	if (textured) {
+		qgl_use_program(pipe->prog);
+		qgl_uniform1i(glGetUniformLocation(pipe->prog, "uTex"), 0);
+	}
+}
+
+static void batch_submit(void)
+{
+	const qgl_pipe_t *pipe = g_batch_pipe;
+	uint32_t n = g_batch_n;
+	size_t off;
+
+	if (!n)
+		return;
+
+	g_batch_n = 0;
+	g_stat_cur[QGL_STAT_DRAW_CALLS]++;
+	g_stat_cur[QGL_STAT_QUADS] += n;
+
+	/* only fails with no context, where nothing is ever drawn */
+	if (qgl_ring_write(g_batch, n * sizeof(qgl_inst_t), &off))
+		return;
+
+	qgl_use_program(pipe->prog);
+	qgl_bind_vao(g_vao_batch);
+
+	if (pipe->textured && g_batch_tex)
+		qgl_bind_tex(0, g_batch_tex);
+
+	batch_attribs(off);
+
+	glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, 4, (GLsizei) n);
+}
+
+static void damage_union(const float *d)
+{
+	if (g_damage.x0 >= g_damage.x1) {
+		g_damage.x0 = d[0];
+		g_damage.y0 = d[1];
+		g_damage.x1 = d[0] + d[2];
+		g_damage.y1 = d[1] + d[3];
+		return;
+	}
+
+	if (d[0] < g_damage.x0)
+		g_damage.x0 = d[0];
+	if (d[1] < g_damage.y0)
+		g_damage.y0 = d[1];
+	if (d[0] + d[2] > g_damage.x1)
+		g_damage.x1 = d[0] + d[2];
+	if (d[1] + d[3] > g_damage.y1)
+		g_damage.y1 = d[1] + d[3];
+}
+
+/* grow the damage by a quad landing on the screen target */
+static inline void damage_add(const float *d)
+{
+	if (g_view_fbo == g_fbo)
+		damage_union(d);
+}
+
+/* texture 0 marks quads that don't sample, which fit any batch */
+static inline int tex_clash(const qgl_pipe_t *pipe, GLuint a, GLuint b)
+{
+	return pipe->textured && a && b && a != b;
+}
+
+void qgl_list_push(hw_list_t *l, const qgl_pipe_t *pipe, GLuint tex,
+		const qgl_inst_t *inst)
+{
+	hw_cmd_t *c = l->ncmd ? &l->cmd[l->ncmd - 1] : NULL;
+
+	if (!c || c->pipe != pipe || tex_clash(pipe, c->tex, tex)) {
+		if (l->ncmd == l->cmd_cap) {
+			l->cmd_cap = l->cmd_cap ? l->cmd_cap * 2 : 16;
+			l->cmd = realloc(l->cmd,
+					l->cmd_cap * sizeof(*l->cmd));
+			CBUG(!l->cmd, "realloc command list");
+		}
+
+		c = &l->cmd[l->ncmd++];
+		c->pipe = pipe;
+		c->tex = tex;
+		c->first = l->ninst;
+		c->n = 0;
+	}
+
+	if (l->ninst == l->inst_cap) {
+		l->inst_cap = l->inst_cap ? l->inst_cap * 2 : 64;
+		l->inst = realloc(l->inst, l->inst_cap * sizeof(*l->inst));
+		CBUG(!l->inst, "realloc command list");
+	}
+
+	if (tex)
+		c->tex = tex;
+	l->inst[l->ninst++] = *inst;
+	c->n++;
+}
+
+void qgl_batch_flush(void)
+{
+	qgl_layer_flush();
+	batch_submit();
+}
+
+void qgl_batch_add(const qgl_pipe_t *pipe, GLuint tex,
+		const qgl_inst_t *inst)
+{
+	if (g_batch_n && (pipe != g_batch_pipe
+				|| tex_clash(pipe, g_batch_tex, tex)))
+		batch_submit();
+	else if (g_batch_n == QGL_BATCH_MAX)
+		batch_submit();
+
+	if (!g_batch_n || tex)
+		g_batch_tex = tex;
+	g_batch_pipe = pipe;
+	g_batch[g_batch_n++] = *inst;
+}
+
+void qgl_batch_push(const qgl_pipe_t *pipe, GLuint tex,
+		const qgl_inst_t *inst)
+{
+	qgl_inst_t q;
+
+	/* recordings are clipped when they are drawn */
+	if (qgl_thread_list) {
+		qgl_list_push(qgl_thread_list, pipe, tex, inst);
+		return;
+	}
+
+	if (g_recording && g_view_fbo == g_rec_fbo) {
+		qgl_list_push(&g_rec, pipe, tex, inst);
+		return;
+	}
+
+	q = *inst;
+	if (qgl_clip_quad(&q))
+		return;
+
+	damage_add(q.dst);
+
+	if (qgl_layer_push(pipe, tex, &q))
+		qgl_batch_add(pipe, tex, &q);
+}
+
+void qgl_cmdlist_begin(void)
+{
+	if (g_recording) {
+		WARN("qgl_cmdlist_begin: already recording\n");
+		return;
+	}
+
+	memset(&g_rec, 0, sizeof(g_rec));
+	g_rec_fbo = g_view_fbo;
+	g_recording = 1;
+}
+
+unsigned qgl_cmdlist_end(void)
+{
+	hw_list_t l = g_rec;
+
+	if (!g_recording) {
+		WARN("qgl_cmdlist_end: not recording\n");
+		return QM_MISS;
+	}
+
+	g_recording = 0;
+	memset(&g_rec, 0, sizeof(g_rec));
+
+	/* replay never appends, so trim the slack */
+	if (l.ncmd) {
+		l.cmd = realloc(l.cmd, l.ncmd * sizeof(*l.cmd));
+		l.inst = realloc(l.inst, l.ninst * sizeof(*l.inst));
+		CBUG(!l.cmd || !l.inst, "realloc command list");
+	}
+
+	return qgl_hnew(&g_list_tab, &l);
+}
+
+/* per-channel product of two 0xAARRGGBB colors */
+static inline uint32_t color_mul(uint32_t a, uint32_t b)
+{
+	uint32_t r = 0, sh;
+
+	for (sh = 0; sh < 32; sh += 8) {
+		uint32_t x = (a >> sh) & 0xff, y = (b >> sh) & 0xff;
+
+		r |= ((x * y + 127) / 255) << sh;
+	}
+
+	return r;
+}
+
+static void inst_move(qgl_inst_t *inst, float dx, float dy, uint32_t tint)
+{
+	inst->dst[0] += dx;
+	inst->dst[1] += dy;
+
+	/* everything but textured quads keeps its shape box in uv */
+	if (inst->kind != QGL_KIND_TEX) {
+		inst->uv[0] += dx;
+		inst->uv[1] += dy;
+	}
+
+	if (tint != qgl_default_tint)
+		inst->color = color_mul(inst->color, tint);
+}
+
+void qgl_list_replay(const hw_list_t *l, int32_t dx, int32_t dy,
+		uint32_t tint)
+{
+	int moved = dx || dy || tint != qgl_default_tint;
+	int deferred = qgl_thread_list || qgl_layer_on()
+		|| (g_recording && g_view_fbo == g_rec_fbo);
+	uint32_t ci, i, k;
+
+	for (ci = 0; ci < l->ncmd; ci++) {
+		const hw_cmd_t *c = &l->cmd[ci];
+		const qgl_inst_t *src = l->inst + c->first;
+		uint32_t left = c->n;
+
+		/* nested in a recording or a layer: queue quad by quad */
+		if (deferred) {
+			for (i = 0; i < left; i++) {
+				qgl_inst_t inst = src[i];
+
+				inst_move(&inst, (float) dx, (float) dy,
+						tint);
+				qgl_batch_push(c->pipe, c->tex, &inst);
+			}
+			continue;
+		}
+
+		/* otherwise copy straight into the batch, a run at a time */
+		while (left) {
+			qgl_inst_t *dst;
+
+			if (g_batch_n && (c->pipe != g_batch_pipe
+					|| tex_clash(c->pipe, g_batch_tex,
+						c->tex)
+					|| g_batch_n == QGL_BATCH_MAX))
+				batch_submit();
+
+			if (!g_batch_n || c->tex)
+				g_batch_tex = c->tex;
+			g_batch_pipe = c->pipe;
+
+			k = QGL_BATCH_MAX - g_batch_n;
+			if (k > left)
+				k = left;
+
+			dst = g_batch + g_batch_n;
+			for (i = 0; i < k; i++) {
+				*dst = src[i];
+				if (moved)
+					inst_move(dst, (float) dx,
+							(float) dy, tint);
+				if (!qgl_clip_quad(dst)) {
+					damage_add(dst->dst);
+					dst++;
+				}
+			}
+
+			g_batch_n = (uint32_t) (dst - g_batch);
+			src += k;
+			left -= k;
+		}
+	}
+}
+
+void qgl_cmdlist_replay(unsigned ref, int32_t dx, int32_t dy, uint32_t tint)
+{
+	const hw_list_t *l = qgl_hget(&g_list_tab, ref);
+
+	if (l)
+		qgl_list_replay(l, dx, dy, tint);
+}
+
+void qgl_cmdlist_free(unsigned ref)
+{
+	hw_list_t *l = qgl_hget(&g_list_tab, ref);
+
+	if (!l)
+		return;
+
+	free(l->cmd);
+	free(l->inst);
+	qgl_hdel(&g_list_tab, ref);
+}
+
+void qgl_hint(qgl_hint_t hint, int value)
+{
+	if (hint < QGL_HINT_MAX)
+		g_hint[hint] = value;
+}
+
+int qgl_hint_get(qgl_hint_t hint)
+{
+	return hint < QGL_HINT_MAX ? g_hint[hint] : 0;
+}
+
+void qgl_stat_add(qgl_stat_t stat, uint64_t n)
+{
+	g_stat_cur[stat] += n;
+}
+
+uint64_t qgl_stat(qgl_stat_t stat)
+{
+	if (stat >= QGL_STAT_MAX)
+		return 0;
+
+	return g_stat_last[stat];
+}
+
 void gl_init(uint32_t *w_r, uint32_t *h_r)
 {
 	uint32_t w, h;
 
+	qgl_state_reset();
 	qgl_be.init(w_r, h_r);
 	w = *w_r; h = *h_r;
 
 	glDisable(GL_DEPTH_TEST);
-	glEnable(GL_BLEND);
-	glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA,
+	qgl_blend(1);
+	qgl_blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA,
 			GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
 
 
 	// VAO obrigatório em core profile
 	glGenVertexArrays(1, &g_vao_dummy);
-	glBindVertexArray(g_vao_dummy);
+	qgl_bind_vao(g_vao_dummy);
 
 	// FBO com texture alvo (framebuffer “virtual” do teu engine)
 	glGenTextures(1, &g_tex);
-	glBindTexture(GL_TEXTURE_2D, g_tex);
+	qgl_bind_tex(0, g_tex);
 	glTexParameteri(GL_TEXTURE_2D,
 			GL_TEXTURE_MIN_FILTER,
 			GL_NEAREST);
@@ -167,7 +799,7 @@ void gl_init(uint32_t *w_r, uint32_t *h_r)
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, w, h, 0, GL_BGRA, GL_UNSIGNED_BYTE, NULL);
 
 	glGenFramebuffers(1, &g_fbo);
-	glBindFramebuffer(GL_FRAMEBUFFER, g_fbo);
+	qgl_bind_fbo(g_fbo);
 	glFramebufferTexture2D(GL_FRAMEBUFFER,
 			GL_COLOR_ATTACHMENT0,
 			GL_TEXTURE_2D, g_tex, 0);
@@ -176,53 +808,33 @@ void gl_init(uint32_t *w_r, uint32_t *h_r)
 		exit(1);
 	}
 
-	// Shaders
-	g_prog_tex  = qgl_link(
-			qgl_compile(GL_VERTEX_SHADER, VS_TEX),
-			qgl_compile(GL_FRAGMENT_SHADER, FS_TEX));
-	g_prog_fill = qgl_link(
-			qgl_compile(GL_VERTEX_SHADER, VS_FILL),
-			qgl_compile(GL_FRAGMENT_SHADER, FS_FILL));
-
-	// Locais
-	glUseProgram(g_prog_tex);
-	g_uProj_tex = glGetUniformLocation(g_prog_tex, "uProj");
-	g_uDst_tex  = glGetUniformLocation(g_prog_tex, "uDst");
-	g_uUV_tex   = glGetUniformLocation(g_prog_tex, "uUV");
-	g_uTint_tex = glGetUniformLocation(g_prog_tex, "uTint");
-	g_uSampler  = glGetUniformLocation(g_prog_tex, "uTex");
-	glUniform1i(g_uSampler, 0); // texture unit 0
-
-	glUseProgram(g_prog_fill);
-	g_uProj_fill = glGetUniformLocation(g_prog_fill, "uProj");
-	g_uDst_fill  = glGetUniformLocation(g_prog_fill, "uDst");
-	g_uColor_fill= glGetUniformLocation(g_prog_fill, "uColor");
-
-	shadow_init();
+	glGenBuffers(1, &g_ubo_view);
+	glBindBuffer(GL_UNIFORM_BUFFER, g_ubo_view);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(qgl_ortho_M), NULL,
+			GL_DYNAMIC_DRAW);
+	glBindBufferBase(GL_UNIFORM_BUFFER, QGL_UBO_VIEW, g_ubo_view);
 
-	// Projeção inicial
-	qgl_ortho((float)w, (float)h, qgl_ortho_M);
-
-	glUseProgram(g_prog_tex);
-	glUniformMatrix4fv(g_uProj_tex,  1, GL_FALSE, qgl_ortho_M);
+	// Shaders
+	qgl_pipe_init(&g_pipe_quad, FS_QUAD, 1);
 
-	glUseProgram(g_prog_fill);
-	glUniformMatrix4fv(g_uProj_fill, 1, GL_FALSE, qgl_ortho_M);
+	ring_init();
+	batch_init();
 
+	shadow_init();
 
-	glBindFramebuffer(GL_FRAMEBUFFER, g_fbo);
-	glViewport(0, 0, (GLint)w, (GLint)h);
+	qgl_bind_fbo(g_fbo);
+	qgl_viewport(0, 0, (GLint)w, (GLint)h);
 	glClearColor(0,0,0,1);
 	glClear(GL_COLOR_BUFFER_BIT);
 
-	// assets CPU side
+	// assets CPU side, for backends that present from memory
 	screen.channels = 4;
 	screen.size = w * h;
-	screen.canvas = calloc(screen.size, screen.channels);
-	CBUG(!screen.canvas, "calloc canvas");
-
-	uint32_t qm_gl_tex = qmap_reg(sizeof(gl_tex_info_t));
-	g_tex_map_hd = qmap_open(NULL, NULL, QM_HNDL, qm_gl_tex, 0xF, 0);
+	if (qgl_be.flags & QGL_BE_READBACK) {
+		screen.canvas = calloc(screen.size, screen.channels);
+		CBUG(!screen.canvas, "calloc canvas");
+	}
+	qgl_readback_init();
 
 	qgl_reset_viewport();
 }
@@ -232,9 +844,9 @@ void qlfw_construct(void);
 void __attribute__((weak)) fb_construct(void);
 void input_glfw_construct(void);
 void __attribute__((weak)) input_dev_construct(void);
+void __attribute__((weak)) headless_construct(void);
 void img_construct(void);
 void png_construct(void);
-void tile_construct(void);
 
 void qui_init(uint32_t screen_w, uint32_t screen_h);
 
@@ -243,7 +855,6 @@ static void construct(void)
 {
 	img_construct();
 	png_construct();
-	tile_construct();
 	img_load_all();
 	qgl_width = 1024;
 	qgl_height = 768;
@@ -254,16 +865,23 @@ static void construct(void)
 	qgl_be = qgl_glfw;
 	qgl_input = qgl_input_glfw;
 #else
-	if (getenv("DISPLAY")) {
+	const char *be = getenv("QGL_BACKEND");
+	int headless = be && !strcmp(be, "headless");
+
+	if (!headless && getenv("DISPLAY")) {
 		qlfw_construct();
 		input_glfw_construct();
 		qgl_be = qgl_glfw;
 		qgl_input = qgl_input_glfw;
-	} else if (&qgl_fb) {
+	} else if (!headless && &qgl_fb && !access("/dev/fb0", F_OK)) {
 		fb_construct();
 		input_dev_construct();
 		qgl_be = qgl_fb;
 		qgl_input = qgl_input_dev;
+	} else if (&qgl_mem) {
+		headless_construct();
+		qgl_be = qgl_mem;
+		qgl_input = qgl_input_none;
 	} else {
 		CBUG(1, "No backend supported\n");
 	}
@@ -277,22 +895,113 @@ void qgl_init(void)
 	qgl_input.init(0);
 }
 
-void qgl_flush(void)
+void qgl_damage(int32_t x, int32_t y, uint32_t w, uint32_t h)
 {
-	// update reading FBO -> screen.canvas
-	glBindFramebuffer(GL_FRAMEBUFFER, g_fbo);
+	float d[4] = { (float) x, (float) y, (float) w, (float) h };
+	GLuint fbo = g_view_fbo;
+
+	if (!w || !h)
+		return;
+
+	qgl_batch_flush();
+	damage_union(d);
+
+	qgl_bind_fbo(g_fbo);
+	glEnable(GL_SCISSOR_TEST);
+	glScissor(x, y, (GLsizei) w, (GLsizei) h);
+	glClearColor(0, 0, 0, 1);
+	glClear(GL_COLOR_BUFFER_BIT);
+	glDisable(GL_SCISSOR_TEST);
+	qgl_bind_fbo(fbo);
+}
+
+/* round the damage out to whole pixels on screen, into screen.min/max */
+static void damage_latch(void)
+{
+	float x0 = g_damage.x0 > 0.0f ? g_damage.x0 : 0.0f;
+	float y0 = g_damage.y0 > 0.0f ? g_damage.y0 : 0.0f;
+	float x1 = g_damage.x1, y1 = g_damage.y1;
+
+	memset(&g_damage, 0, sizeof(g_damage));
+
+	if (x1 > (float) qgl_width)
+		x1 = (float) qgl_width;
+	if (y1 > (float) qgl_height)
+		y1 = (float) qgl_height;
+
+	if (x0 >= x1 || y0 >= y1) {
+		screen.min_x = screen.max_x = 0;
+		screen.min_y = screen.max_y = 0;
+		return;
+	}
+
+	screen.min_x = (uint32_t) x0;
+	screen.min_y = (uint32_t) y0;
+	screen.max_x = (uint32_t) ceilf(x1);
+	screen.max_y = (uint32_t) ceilf(y1);
+}
+
+void qgl_capture(void *pixels)
+{
+	GLuint fbo = g_view_fbo;
+
+	qgl_batch_flush();
+
+	qgl_bind_fbo(g_fbo);
 	glReadBuffer(GL_COLOR_ATTACHMENT0);
 	glPixelStorei(GL_PACK_ALIGNMENT, 1);
-	glReadPixels(0, 0, qgl_width, qgl_height, GL_BGRA, GL_UNSIGNED_BYTE, screen.canvas);
+	glReadPixels(0, 0, qgl_width, qgl_height,
+			GL_BGRA, GL_UNSIGNED_BYTE, pixels);
+	qgl_bind_fbo(fbo);
+}
+
+void qgl_flush(void)
+{
+	int retain = qgl_hint_get(QGL_HINT_RETAIN);
+	uint32_t dw, dh;
+
+	qgl_batch_flush();
+	qgl_ring_frame();
+
+	/* everything counts as damaged unless the frame is retained */
+	if (!retain || !g_retained) {
+		g_damage.x0 = g_damage.y0 = 0.0f;
+		g_damage.x1 = (float) qgl_width;
+		g_damage.y1 = (float) qgl_height;
+	}
+	g_retained = retain;
+
+	damage_latch();
+	dw = screen.max_x - screen.min_x;
+	dh = screen.max_y - screen.min_y;
+	g_stat_cur[QGL_STAT_PRESENTED] += (uint64_t) dw * dh;
+
+	// update reading FBO -> screen.canvas (only what changed)
+	qgl_readback();
 
 	// deliver to backend (that swaps buffers)
 	qgl_be.flush();
+	qgl_export_frame();
+	qgl_video_frame();
+	qgl_pace_frame();
+
+	/* textures loaded asynchronously show up from the next frame */
+	img_async_drain();
+
+	memcpy(g_stat_last, g_stat_cur, sizeof(g_stat_last));
+	memset(g_stat_cur, 0, sizeof(g_stat_cur));
+
+	// clean FBO, unless the next frame builds on this one
+	if (!retain) {
+		qgl_bind_fbo(g_fbo);
+		qgl_viewport(0, 0, (GLint)qgl_width, (GLint)qgl_height);
+		glClearColor(0, 0, 0, 1);
+		glClear(GL_COLOR_BUFFER_BIT);
+	}
 
-	// clean FBO
-	glBindFramebuffer(GL_FRAMEBUFFER, g_fbo);
-	glViewport(0, 0, (GLint)qgl_width, (GLint)qgl_height);
-	glClearColor(0, 0, 0, 1);
-	glClear(GL_COLOR_BUFFER_BIT);
+	/* the backend may have bound its own target: draw to ours again */
+	qgl_bind_fbo(g_view_fbo);
+	qgl_viewport(0, 0, (GLint)g_view_w, (GLint)g_view_h);
 }
 
 void qgl_size(uint32_t *w, uint32_t *h)
@@ -303,16 +1012,37 @@ void qgl_size(uint32_t *w, uint32_t *h)
 
 static void gl_deinit(void)
 {
-	const void *key, *val;
-	uint32_t it;
-
+	gl_tex_info_t *tex;
+	hw_list_t *list;
+	uint32_t it = 0;
+
+	ring_deinit();
+	glDeleteProgram(g_pipe_quad.prog);
+	glDeleteBuffers(1, &g_ubo_view);
+	glDeleteVertexArrays(1, &g_vao_batch);
 	glDeleteTextures(1, &g_tex);
 	glDeleteFramebuffers(1, &g_fbo);
 
-	it = qmap_iter(g_tex_map_hd, NULL, 0);
-	while (qmap_next(&key, &val, it))
-		glDeleteTextures(1, &((gl_tex_info_t *)val)->id);
-	qmap_close(g_tex_map_hd);
+	while ((tex = qgl_hnext(&g_tex_tab, &it, NULL)))
+		if (tex->page == QGL_ATLAS_NONE)
+			glDeleteTextures(1, &tex->id);
+	qgl_hfree(&g_tex_tab);
+
+	it = 0;
+	while ((list = qgl_hnext(&g_list_tab, &it, NULL))) {
+		free(list->cmd);
+		free(list->inst);
+	}
+	qgl_hfree(&g_list_tab);
+	free(g_rec.cmd);
+	free(g_rec.inst);
+	qgl_layer_deinit();
+	qgl_record_deinit();
+	qgl_atlas_deinit();
+	qgl_readback_deinit();
+	qgl_pace_deinit();
+	qgl_export_deinit();
+	qgl_video_close();
 	free(screen.canvas);
 	memset(&screen, 0, sizeof(screen));
 }
@@ -334,75 +1064,136 @@ void qgl_tex_draw_x(uint32_t ref, int32_t x, int32_t y,
                     uint32_t cx, uint32_t cy, uint32_t sw, uint32_t sh,
                     uint32_t dw, uint32_t dh, uint32_t tint)
 {
-	const gl_tex_info_t *tex = qmap_get(g_tex_map_hd, &ref);
-	if (!tex) return;
-
-	float u0 = (float)cx / (float)tex->w;
-	float v0 = (float)cy / (float)tex->h;
-	float u1 = (float)(cx + sw) / (float)tex->w;
-	float v1 = (float)(cy + sh) / (float)tex->h;
-
-	float dst[4] = { (float)x, (float)y, (float)dw, (float)dh };
-	float uv [4] = { u0, v0, u1, v1 };
-
-	float ta = ((tint >> 24) & 0xFF) / 255.0f;
-	float tr = ((tint >> 16) & 0xFF) / 255.0f;
-	float tg = ((tint >>  8) & 0xFF) / 255.0f;
-	float tb = ((tint      ) & 0xFF) / 255.0f;
-	float rgba[4] = { tr, tg, tb, ta };
+	const gl_tex_info_t *tex = qgl_hget(&g_tex_tab, ref);
+	qgl_inst_t inst = { .color = tint, .kind = QGL_KIND_TEX };
 
-	glUseProgram(g_prog_tex);
-	glBindVertexArray(g_vao_dummy);
+	if (!tex) return;
 
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, tex->id);
+	inst.dst[0] = (float)x;
+	inst.dst[1] = (float)y;
+	inst.dst[2] = (float)dw;
+	inst.dst[3] = (float)dh;
 
-	glUniform4fv(g_uDst_tex, 1, dst);
-	glUniform4fv(g_uUV_tex,  1, uv);
-	glUniform4fv(g_uTint_tex,1, rgba);
-	qgl_apply_ortho(g_uProj_tex);
+	cx += tex->x;
+	cy += tex->y;
+	inst.uv[0] = (float)cx / (float)tex->tw;
+	inst.uv[1] = (float)cy / (float)tex->th;
+	inst.uv[2] = (float)(cx + sw) / (float)tex->tw;
+	inst.uv[3] = (float)(cy + sh) / (float)tex->th;
 
-	glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+	qgl_batch_push(&g_pipe_quad, tex->id, &inst);
 }
 
 void qgl_tex_reg(uint32_t ref, uint8_t *data, uint32_t w, uint32_t h)
 {
-	gl_tex_info_t tex = { .w = w, .h = h };
+	gl_tex_info_t tex = { .w = w, .h = h, .tw = w, .th = h };
+	qgl_atlas_slot_t slot;
+
+	if (!qgl_atlas_alloc(w, h, &slot)) {
+		tex.id = slot.tex;
+		tex.page = slot.page;
+		tex.x = slot.x;
+		tex.y = slot.y;
+		tex.tw = tex.th = qgl_atlas_side();
+
+		if (data) {
+			qgl_batch_flush();
+			qgl_bind_tex(0, tex.id);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+			glTexSubImage2D(GL_TEXTURE_2D, 0, tex.x, tex.y, w, h,
+					GL_BGRA, GL_UNSIGNED_BYTE, data);
+		}
+
+		qgl_hset(&g_tex_tab, ref, &tex);
+		return;
+	}
 
+	tex.page = QGL_ATLAS_NONE;
 	glGenTextures(1, &tex.id);
-	glBindTexture(GL_TEXTURE_2D, tex.id);
+	qgl_bind_tex(0, tex.id);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, w, h, 0,
 		     GL_BGRA, GL_UNSIGNED_BYTE, data);
 
-	qmap_put(g_tex_map_hd, &ref, &tex);
+	qgl_hset(&g_tex_tab, ref, &tex);
 }
 
 void qgl_tex_upd(uint32_t ref, uint32_t x, uint32_t y,
 		 uint32_t w, uint32_t h, uint8_t *data)
 {
-	const gl_tex_info_t *t = qmap_get(g_tex_map_hd, &ref);
+	const gl_tex_info_t *t = qgl_hget(&g_tex_tab, ref);
 	if (!t)
 		return;
 
-	glBindTexture(GL_TEXTURE_2D, t->id);
+	qgl_batch_flush();
+	qgl_bind_tex(0, t->id);
 	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-	glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, w, h,
+	glTexSubImage2D(GL_TEXTURE_2D, 0, t->x + x, t->y + y, w, h,
 			GL_RGBA, GL_UNSIGNED_BYTE, data);
 }
 
+void qgl_tex_reserve(uint32_t ref)
+{
+	qgl_hreserve(&g_tex_tab, ref);
+}
+
 void qgl_tex_ureg(uint32_t ref)
 {
-	const gl_tex_info_t *t = qmap_get(g_tex_map_hd, &ref);
+	const gl_tex_info_t *t = qgl_hget(&g_tex_tab, ref);
 
 	if (t) {
-		glDeleteTextures(1, &t->id);
-		qmap_del(g_tex_map_hd, &ref);
+		qgl_batch_flush();
+		if (t->page == QGL_ATLAS_NONE) {
+			qgl_state_forget_tex(t->id);
+			glDeleteTextures(1, &t->id);
+		} else if (t->page != QGL_ATLAS_SHARED)
+			qgl_atlas_free(t->page, t->w, t->h);
+		qgl_hdel(&g_tex_tab, ref);
 	}
 }
 
+uint32_t qgl_tex_page_new(uint32_t w, uint32_t h, const uint8_t *data)
+{
+	GLuint id;
+
+	qgl_batch_flush();
+	glGenTextures(1, &id);
+	qgl_bind_tex(0, id);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, w, h, 0,
+		     GL_RGBA, GL_UNSIGNED_BYTE, data);
+
+	return id;
+}
+
+void qgl_tex_page_del(uint32_t id)
+{
+	GLuint tex = id;
+
+	qgl_batch_flush();
+	qgl_state_forget_tex(tex);
+	glDeleteTextures(1, &tex);
+}
+
+void qgl_tex_reg_sub(uint32_t ref, uint32_t page_id,
+		uint32_t tw, uint32_t th,
+		uint32_t x, uint32_t y, uint32_t w, uint32_t h)
+{
+	gl_tex_info_t tex = {
+		.id = page_id,
+		.w = w, .h = h,
+		.x = x, .y = y,
+		.tw = tw, .th = th,
+		.page = QGL_ATLAS_SHARED,
+	};
+
+	qgl_hset(&g_tex_tab, ref, &tex);
+}
+
 void qgl_poll(void)
 {
 	qgl_input.poll();
@@ -410,51 +1201,50 @@ void qgl_poll(void)
 
 void qgl_fill(int32_t x, int32_t y, uint32_t w, uint32_t h, uint32_t color)
 {
-	float a = ((color >> 24) & 0xFF) / 255.0f;
-	float r = ((color >> 16) & 0xFF) / 255.0f;
-	float g = ((color >>  8) & 0xFF) / 255.0f;
-	float b = ((color      ) & 0xFF) / 255.0f;
+	qgl_inst_t inst = {
+		.dst = { (float)x, (float)y, (float)w, (float)h },
+		.color = color,
+		.kind = QGL_KIND_FILL,
+	};
+
+	qgl_batch_push(&g_pipe_quad, 0, &inst);
+}
+
+/* the projection only changes with the viewport size */
+static void view_upload(void)
+{
+	if (g_ubo_w == g_view_w && g_ubo_h == g_view_h)
+		return;
 
-	float dst[4]  = { (float)x, (float)y, (float)w, (float)h };
-	float rgba[4] = { r, g, b, a };
+	g_ubo_w = g_view_w;
+	g_ubo_h = g_view_h;
+	qgl_ortho((float)g_view_w, (float)g_view_h, qgl_ortho_M);
 
-	glUseProgram(g_prog_fill);
-	glBindVertexArray(g_vao_dummy);
-	glUniform4fv(g_uDst_fill, 1, dst);
-	glUniform4fv(g_uColor_fill, 1, rgba);
-	glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+	glBindBuffer(GL_UNIFORM_BUFFER, g_ubo_view);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(qgl_ortho_M),
+			qgl_ortho_M);
 }
 
 void qgl_set_viewport(GLuint fbo, uint32_t w, uint32_t h)
 {
+	qgl_batch_flush();
 	g_view_fbo = fbo;
 	g_view_w = w;
 	g_view_h = h;
 
-	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-	glViewport(0, 0, (GLint)w, (GLint)h);
+	qgl_bind_fbo(fbo);
+	qgl_viewport(0, 0, (GLint)w, (GLint)h);
+	view_upload();
 }
 
 void qgl_reset_viewport(void)
 {
+	qgl_batch_flush();
 	g_view_fbo = g_fbo;
 	g_view_w = qgl_width;
 	g_view_h = qgl_height;
 
-	glBindFramebuffer(GL_FRAMEBUFFER, g_fbo);
-	glViewport(0, 0, (GLint)qgl_width, (GLint)qgl_height);
-}
-
-void qgl_apply_ortho(GLint uProj)
-{
-    float M[16];
-    /* usa o viewport em vigor, não a matriz global do arranque */
-    qgl_ortho((float)g_view_w, (float)g_view_h, M);
-    glUniformMatrix4fv(uProj, 1, GL_FALSE, M);
-}
-
-GLuint qgl_current_fbo(void) {
-    GLint fbo;
-    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &fbo);
-    return (GLuint)fbo;
+	qgl_bind_fbo(g_fbo);
+	qgl_viewport(0, 0, (GLint)qgl_width, (GLint)qgl_height);
+	view_upload();
 }
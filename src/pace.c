@@ -0,0 +1,218 @@
+/*
+ * pace.c — frame pacing
+ *
+ * qgl_flush() ends each frame in qgl_pace_frame(), which sleeps until
+ * the next tick when the mode runs on a timer, and measures how long
+ * frames take: the interval between presentations, and the work done
+ * between the start of a frame and its hand-over. From these
+ * qgl_pace_wait() predicts the next deadline and sleeps until just
+ * enough time is left to draw, so input is read as late as possible.
+ *
+ * Vsync is left to the backends, which ask qgl_pace_vsync() whether
+ * to wait and report when they can't; the timer then stands in for
+ * the display. Hidden outputs are throttled whatever the mode.
+ */
+
+#include "../include/ttypt/qgl.h"
+#include "./gl.h"
+#include "./be.h"
+
+#include <stdatomic.h>
+#include <time.h>
+#include <errno.h>
+#ifdef __linux__
+# include <sys/timerfd.h>
+# include <unistd.h>
+#endif
+
+#define NS 1000000000ull
+
+#define PACE_HIDDEN_HZ 10	/* rate while the output can't be seen */
+#define PACE_FALLBACK_HZ 60	/* vsync mode without vsync */
+#define PACE_ADAPT_FRAMES 8	/* frames in a row before changing rate */
+#define PACE_DIV_MAX 4		/* lowest adaptive rate is hz / 4 */
+#define PACE_MARGIN (NS / 1000)	/* slack kept before a deadline */
+
+static struct {
+	_Atomic int mode;
+	uint32_t hz;
+	atomic_int no_vsync, hidden;
+	uint32_t div;		/* adaptive: presenting at hz / div */
+	int streak;		/* adaptive: > 0 missed, < 0 had room */
+	uint64_t next;		/* next tick, 0 to start over */
+	uint64_t last;		/* end of the last frame */
+	uint64_t start;		/* start of the frame's work */
+	uint64_t period;	/* average interval between frames */
+	uint64_t work;		/* average work per frame */
+	int tfd;
+} g_pace = { .hz = 60, .div = 1, .tfd = -1 };
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * NS + (uint64_t) ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t t)
+{
+#ifdef __linux__
+	struct itimerspec its = {
+		.it_value = { (time_t) (t / NS), (long) (t % NS) },
+	};
+	uint64_t ticks;
+
+	if (g_pace.tfd < 0)
+		g_pace.tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+
+	if (g_pace.tfd >= 0 && !timerfd_settime(g_pace.tfd,
+				TFD_TIMER_ABSTIME, &its, NULL)) {
+		while (read(g_pace.tfd, &ticks, sizeof(ticks)) < 0
+				&& errno == EINTR)
+			;
+		return;
+	}
+#endif
+	for (;;) {
+		uint64_t now = now_ns();
+		struct timespec ts;
+
+		if (now >= t)
+			return;
+
+		ts.tv_sec = (time_t) ((t - now) / NS);
+		ts.tv_nsec = (long) ((t - now) % NS);
+		nanosleep(&ts, NULL);
+	}
+}
+
+/* average in new samples with weight 1/8 */
+static inline uint64_t ewma(uint64_t avg, uint64_t x)
+{
+	return avg ? avg - avg / 8 + x / 8 : x;
+}
+
+/* interval between timer ticks, 0 when not timed */
+static uint64_t tick(uint32_t div)
+{
+	if (atomic_load(&g_pace.hidden))
+		return NS / PACE_HIDDEN_HZ;
+
+	switch (atomic_load(&g_pace.mode)) {
+	case QGL_PACE_FIXED:
+		return NS / g_pace.hz;
+	case QGL_PACE_ADAPTIVE:
+		return NS * div / g_pace.hz;
+	case QGL_PACE_VSYNC:
+		return atomic_load(&g_pace.no_vsync)
+			? NS / PACE_FALLBACK_HZ : 0;
+	default:
+		return 0;
+	}
+}
+
+void qgl_pace(qgl_pace_t mode, uint32_t hz)
+{
+	atomic_store(&g_pace.mode, mode);
+	g_pace.hz = hz ? hz : 60;
+	g_pace.div = 1;
+	g_pace.streak = 0;
+	g_pace.next = 0;
+}
+
+int qgl_pace_vsync(void)
+{
+	return atomic_load(&g_pace.mode) == QGL_PACE_VSYNC
+		&& !atomic_load(&g_pace.hidden)
+		&& !atomic_load(&g_pace.no_vsync);
+}
+
+void qgl_pace_no_vsync(void)
+{
+	atomic_store(&g_pace.no_vsync, 1);
+}
+
+void qgl_pace_hidden(int hidden)
+{
+	atomic_store(&g_pace.hidden, !!hidden);
+}
+
+/* adaptive: lower the rate while frames miss it, raise it once they fit */
+static void adapt(int missed, uint64_t work)
+{
+	if (atomic_load(&g_pace.mode) != QGL_PACE_ADAPTIVE)
+		return;
+
+	if (missed)
+		g_pace.streak = g_pace.streak > 0 ? g_pace.streak + 1 : 1;
+	else if (g_pace.div > 1 && work < tick(g_pace.div - 1) * 3 / 4)
+		g_pace.streak = g_pace.streak < 0 ? g_pace.streak - 1 : -1;
+	else
+		g_pace.streak = 0;
+
+	if (g_pace.streak >= PACE_ADAPT_FRAMES
+			&& g_pace.div < PACE_DIV_MAX) {
+		g_pace.div++;
+		g_pace.streak = 0;
+	} else if (g_pace.streak <= -PACE_ADAPT_FRAMES) {
+		g_pace.div--;
+		g_pace.streak = 0;
+	}
+}
+
+void qgl_pace_frame(void)
+{
+	uint64_t now = now_ns(), period = tick(g_pace.div);
+	uint64_t work = g_pace.start ? now - g_pace.start : 0;
+
+	g_pace.work = ewma(g_pace.work, work);
+
+	if (!period)
+		g_pace.next = 0;
+	else if (!g_pace.next || now > g_pace.next) {
+		/* late or starting: count from here */
+		if (g_pace.next) {
+			qgl_stat_add(QGL_STAT_MISSED, 1);
+			adapt(1, work);
+		}
+		g_pace.next = now + period;
+	} else {
+		adapt(0, work);
+		sleep_until(g_pace.next);
+		g_pace.next += tick(g_pace.div);
+	}
+
+	now = now_ns();
+	if (g_pace.last) {
+		qgl_stat_add(QGL_STAT_FRAME_NS, now - g_pace.last);
+		g_pace.period = ewma(g_pace.period, now - g_pace.last);
+	}
+	g_pace.last = g_pace.start = now;
+}
+
+void qgl_pace_wait(void)
+{
+	uint64_t deadline = g_pace.next;
+
+	if (!deadline && qgl_pace_vsync() && g_pace.last)
+		deadline = g_pace.last + g_pace.period;
+
+	if (deadline > g_pace.work + PACE_MARGIN) {
+		uint64_t t = deadline - g_pace.work - PACE_MARGIN;
+
+		if (t > now_ns())
+			sleep_until(t);
+	}
+
+	g_pace.start = now_ns();
+}
+
+void qgl_pace_deinit(void)
+{
+#ifdef __linux__
+	if (g_pace.tfd >= 0)
+		close(g_pace.tfd);
+	g_pace.tfd = -1;
+#endif
+}
@@ -0,0 +1,289 @@
+/*
+ * pixconv.c — BGRA to framebuffer pixel conversion
+ *
+ * Every kernel converts a run of pixels whose dither phase starts at
+ * 0: the 4x4 Bayer thresholds for a row are laid out as 8 BGRA
+ * pixels and added (saturating) before the channels are truncated,
+ * so the vector kernels dither with a single add. Without dithering
+ * the thresholds are all zero. Vector loops step by multiples of 4
+ * pixels, so the scalar kernel finishing a run keeps the phase.
+ */
+
+#include "./pixconv.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+# include <immintrin.h>
+# define PIX_X86 1
+#elif defined(__ARM_NEON)
+# include <arm_neon.h>
+# define PIX_NEON 1
+#endif
+
+/* thresholds for 8 pixels, starting at a given phase */
+#define PAT_BYTES 32
+
+typedef void row_fn_t(uint8_t *dst, const uint8_t *src, uint32_t n,
+		const uint8_t *pat);
+
+static const uint8_t g_bayer[4][4] = {
+	{  0,  8,  2, 10 },
+	{ 12,  4, 14,  6 },
+	{  3, 11,  1,  9 },
+	{ 15,  7, 13,  5 },
+};
+
+static uint8_t g_pat[4][4][PAT_BYTES];	/* [y & 3][x & 3] */
+static const uint8_t g_nopat[PAT_BYTES];
+static qgl_pixfmt_t g_fmt;
+static int g_dither;
+static row_fn_t *g_to565, *g_to888;
+
+static inline uint32_t sat_add(uint32_t a, uint32_t b)
+{
+	return a + b > 255 ? 255 : a + b;
+}
+
+static void to565_c(uint8_t *dst, const uint8_t *src, uint32_t n,
+		const uint8_t *pat)
+{
+	uint32_t i;
+
+	for (i = 0; i < n; i++) {
+		const uint8_t *s = src + (size_t) i * 4;
+		const uint8_t *t = pat + (i & 3) * 4;
+		uint16_t v = (uint16_t) ((sat_add(s[2], t[2]) >> 3) << 11
+				| (sat_add(s[1], t[1]) >> 2) << 5
+				| sat_add(s[0], t[0]) >> 3);
+
+		memcpy(dst + (size_t) i * 2, &v, sizeof(v));
+	}
+}
+
+static void to888_c(uint8_t *dst, const uint8_t *src, uint32_t n,
+		const uint8_t *pat)
+{
+	uint32_t i;
+
+	(void) pat;
+	for (i = 0; i < n; i++) {
+		dst[i * 3] = src[i * 4];
+		dst[i * 3 + 1] = src[i * 4 + 1];
+		dst[i * 3 + 2] = src[i * 4 + 2];
+	}
+}
+
+#ifdef PIX_X86
+/* 4 BGRA pixels to 565 in the low half of each 32-bit lane, sign extended */
+__attribute__((target("sse2")))
+static inline __m128i pack565_sse2(__m128i v)
+{
+	__m128i r = _mm_and_si128(_mm_srli_epi32(v, 8),
+			_mm_set1_epi32(0xf800));
+	__m128i g = _mm_and_si128(_mm_srli_epi32(v, 5),
+			_mm_set1_epi32(0x07e0));
+	__m128i b = _mm_and_si128(_mm_srli_epi32(v, 3),
+			_mm_set1_epi32(0x001f));
+
+	v = _mm_or_si128(_mm_or_si128(r, g), b);
+	/* SSE2 only packs with signed saturation */
+	return _mm_srai_epi32(_mm_slli_epi32(v, 16), 16);
+}
+
+__attribute__((target("sse2")))
+static void to565_sse2(uint8_t *dst, const uint8_t *src, uint32_t n,
+		const uint8_t *pat)
+{
+	__m128i t = _mm_loadu_si128((const __m128i *) pat);
+	uint32_t i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+		const uint8_t *s = src + (size_t) i * 4;
+		__m128i a = _mm_adds_epu8(
+				_mm_loadu_si128((const __m128i *) s), t);
+		__m128i b = _mm_adds_epu8(
+				_mm_loadu_si128((const __m128i *) (s + 16)), t);
+
+		_mm_storeu_si128((__m128i *) (dst + (size_t) i * 2),
+				_mm_packs_epi32(pack565_sse2(a),
+					pack565_sse2(b)));
+	}
+
+	to565_c(dst + (size_t) i * 2, src + (size_t) i * 4, n - i, pat);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i pack565_avx2(__m256i v)
+{
+	__m256i r = _mm256_and_si256(_mm256_srli_epi32(v, 8),
+			_mm256_set1_epi32(0xf800));
+	__m256i g = _mm256_and_si256(_mm256_srli_epi32(v, 5),
+			_mm256_set1_epi32(0x07e0));
+	__m256i b = _mm256_and_si256(_mm256_srli_epi32(v, 3),
+			_mm256_set1_epi32(0x001f));
+
+	return _mm256_or_si256(_mm256_or_si256(r, g), b);
+}
+
+__attribute__((target("avx2")))
+static void to565_avx2(uint8_t *dst, const uint8_t *src, uint32_t n,
+		const uint8_t *pat)
+{
+	__m256i t = _mm256_loadu_si256((const __m256i *) pat);
+	uint32_t i = 0;
+
+	for (; i + 16 <= n; i += 16) {
+		const uint8_t *s = src + (size_t) i * 4;
+		__m256i a = _mm256_adds_epu8(
+				_mm256_loadu_si256((const __m256i *) s), t);
+		__m256i b = _mm256_adds_epu8(
+				_mm256_loadu_si256((const __m256i *) (s + 32)), t);
+		__m256i v = _mm256_packus_epi32(pack565_avx2(a),
+				pack565_avx2(b));
+
+		/* packing works per 128-bit lane: put the halves in order */
+		_mm256_storeu_si256((__m256i *) (dst + (size_t) i * 2),
+				_mm256_permute4x64_epi64(v, 0xd8));
+	}
+
+	to565_sse2(dst + (size_t) i * 2, src + (size_t) i * 4, n - i, pat);
+}
+
+__attribute__((target("ssse3")))
+static void to888_ssse3(uint8_t *dst, const uint8_t *src, uint32_t n,
+		const uint8_t *pat)
+{
+	const __m128i drop_x = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10,
+			12, 13, 14, -1, -1, -1, -1);
+	uint32_t i = 0;
+
+	/* 12 bytes out per 16 in; each store runs 4 bytes past */
+	for (; i + 6 <= n; i += 4)
+		_mm_storeu_si128((__m128i *) (dst + (size_t) i * 3),
+				_mm_shuffle_epi8(_mm_loadu_si128(
+					(const __m128i *) (src + (size_t) i * 4)),
+					drop_x));
+
+	to888_c(dst + (size_t) i * 3, src + (size_t) i * 4, n - i, pat);
+}
+#endif
+
+#ifdef PIX_NEON
+static void to565_neon(uint8_t *dst, const uint8_t *src, uint32_t n,
+		const uint8_t *pat)
+{
+	uint8x8x4_t t = vld4_u8(pat);
+	uint32_t i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+		uint8x8x4_t p = vld4_u8(src + (size_t) i * 4);
+		uint16x8_t v = vshll_n_u8(vqadd_u8(p.val[2], t.val[2]), 8);
+
+		v = vsriq_n_u16(v, vshll_n_u8(vqadd_u8(p.val[1], t.val[1]), 8), 5);
+		v = vsriq_n_u16(v, vshll_n_u8(vqadd_u8(p.val[0], t.val[0]), 8), 11);
+		vst1q_u8(dst + (size_t) i * 2, vreinterpretq_u8_u16(v));
+	}
+
+	to565_c(dst + (size_t) i * 2, src + (size_t) i * 4, n - i, pat);
+}
+
+static void to888_neon(uint8_t *dst, const uint8_t *src, uint32_t n,
+		const uint8_t *pat)
+{
+	uint32_t i = 0;
+
+	for (; i + 16 <= n; i += 16) {
+		uint8x16x4_t p = vld4q_u8(src + (size_t) i * 4);
+		uint8x16x3_t o = { { p.val[0], p.val[1], p.val[2] } };
+
+		vst3q_u8(dst + (size_t) i * 3, o);
+	}
+
+	to888_c(dst + (size_t) i * 3, src + (size_t) i * 4, n - i, pat);
+}
+#endif
+
+void qgl_pixconv_init(qgl_pixfmt_t fmt, int dither)
+{
+	uint32_t y, x, i;
+
+	g_fmt = fmt;
+	g_dither = dither && fmt == QGL_PIX_RGB565;
+
+	for (y = 0; y < 4; y++)
+		for (x = 0; x < 4; x++)
+			for (i = 0; i < PAT_BYTES / 4; i++) {
+				uint8_t b = g_bayer[y][(x + i) & 3];
+				uint8_t *t = &g_pat[y][x][i * 4];
+
+				/* below one step of 5 and 6-bit channels */
+				t[0] = t[2] = b >> 1;
+				t[1] = b >> 2;
+				t[3] = 0;
+			}
+
+	g_to565 = to565_c;
+	g_to888 = to888_c;
+
+#if defined(PIX_X86)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2"))
+		g_to565 = to565_sse2;
+	if (__builtin_cpu_supports("ssse3"))
+		g_to888 = to888_ssse3;
+	if (__builtin_cpu_supports("avx2"))
+		g_to565 = to565_avx2;
+#elif defined(PIX_NEON)
+	g_to565 = to565_neon;
+	g_to888 = to888_neon;
+#endif
+}
+
+int qgl_pixconv_use(const char *name)
+{
+	row_fn_t *to565 = NULL, *to888 = NULL;
+
+	if (!strcmp(name, "c")) {
+		to565 = to565_c;
+		to888 = to888_c;
+	}
+#if defined(PIX_X86)
+	else if (!strcmp(name, "sse2") && __builtin_cpu_supports("sse2"))
+		to565 = to565_sse2;
+	else if (!strcmp(name, "ssse3") && __builtin_cpu_supports("ssse3"))
+		to888 = to888_ssse3;
+	else if (!strcmp(name, "avx2") && __builtin_cpu_supports("avx2"))
+		to565 = to565_avx2;
+#elif defined(PIX_NEON)
+	else if (!strcmp(name, "neon")) {
+		to565 = to565_neon;
+		to888 = to888_neon;
+	}
+#endif
+
+	if (!to565 && !to888)
+		return -1;
+
+	g_to565 = to565 ? to565 : to565_c;
+	g_to888 = to888 ? to888 : to888_c;
+	return 0;
+}
+
+void qgl_pixconv(uint8_t *dst, const uint8_t *src, uint32_t n,
+		uint32_t x, uint32_t y)
+{
+	const uint8_t *pat = g_dither ? g_pat[y & 3][x & 3] : g_nopat;
+
+	switch (g_fmt) {
+	case QGL_PIX_RGB565:
+		g_to565(dst, src, n, pat);
+		break;
+	case QGL_PIX_RGB888:
+		g_to888(dst, src, n, pat);
+		break;
+	default:
+		memcpy(dst, src, (size_t) n * 4);
+		break;
+	}
+}
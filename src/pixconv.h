@@ -0,0 +1,54 @@
+/*
+ * @file pixconv.h
+ * @brief Conversion of BGRA rows to framebuffer pixel formats.
+ *
+ * The renderer reads frames back as 32-bit BGRA. Framebuffers that
+ * store pixels differently get each row converted on the way out,
+ * by the widest kernel the CPU supports (AVX2, SSSE3 or SSE2 picked
+ * at run time on x86, NEON on ARM), with a plain C fallback.
+ *
+ * This header is **not** part of the public API.
+ */
+
+#ifndef QGL_PIXCONV_H
+#define QGL_PIXCONV_H
+
+#include <stdint.h>
+
+typedef enum {
+	QGL_PIX_XRGB8888,	/* 4 bytes B, G, R, X: a plain copy */
+	QGL_PIX_RGB888,		/* 3 bytes B, G, R */
+	QGL_PIX_RGB565,		/* 16 bits, red on top */
+} qgl_pixfmt_t;
+
+/*
+ * @brief Pick the format to convert to and the kernels for this CPU.
+ *
+ * @param fmt    Destination format.
+ * @param dither Non-zero to apply 4x4 ordered dithering (RGB565 only).
+ */
+void qgl_pixconv_init(qgl_pixfmt_t fmt, int dither);
+
+/*
+ * @brief Convert with one named kernel only, for tests.
+ *
+ * After qgl_pixconv_init(), makes qgl_pixconv() use kernel `name`
+ * ("c", "sse2", "ssse3", "avx2" or "neon"), and the plain C one for
+ * the format it doesn't handle.
+ *
+ * @return 0, or -1 if there is no such kernel on this CPU.
+ */
+int qgl_pixconv_use(const char *name);
+
+/*
+ * @brief Convert a run of BGRA pixels.
+ *
+ * @param dst  First destination pixel.
+ * @param src  First source pixel.
+ * @param n    Number of pixels.
+ * @param x,y  Screen position of the first pixel, for the dither phase.
+ */
+void qgl_pixconv(uint8_t *dst, const uint8_t *src, uint32_t n,
+		uint32_t x, uint32_t y);
+
+#endif /* QGL_PIXCONV_H */
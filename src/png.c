@@ -1,27 +1,116 @@
 #include <sys/time.h>
 #include <limits.h>
 #include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <fcntl.h>
+# include <unistd.h>
+#endif
 #include <ttypt/qsys.h>
 #include <png.h>
 
 #include "tex.h"
 
-unsigned
-pngi_load(const char *filename)
+typedef struct {
+	const uint8_t *p;
+	size_t size, pos;
+} png_src_t;
+
+/* map a whole file read-only; NULL if it can't be read */
+static const uint8_t *
+file_map(const char *filename, size_t *size)
 {
+#ifndef _WIN32
+	struct stat st;
+	void *p;
+	int fd = open(filename, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) || st.st_size <= 0) {
+		close(fd);
+		return NULL;
+	}
+
+	p = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
+		return NULL;
+
+	/* decoding reads it front to back, once */
+	madvise(p, (size_t) st.st_size, MADV_SEQUENTIAL);
+	*size = (size_t) st.st_size;
+	return p;
+#else
 	FILE *fp = fopen(filename, "rb");
-	unsigned char header[8];
+	uint8_t *p = NULL;
+	long len;
+
+	if (!fp)
+		return NULL;
+
+	if (!fseek(fp, 0, SEEK_END) && (len = ftell(fp)) > 0
+			&& !fseek(fp, 0, SEEK_SET)
+			&& (p = malloc((size_t) len))
+			&& fread(p, 1, (size_t) len, fp) != (size_t) len) {
+		free(p);
+		p = NULL;
+	}
+
+	fclose(fp);
+	*size = p ? (size_t) len : 0;
+	return p;
+#endif
+}
+
+static void
+file_unmap(const uint8_t *p, size_t size)
+{
+#ifndef _WIN32
+	munmap((void *) p, size);
+#else
+	(void) size;
+	free((void *) p);
+#endif
+}
+
+static void
+png_src_read(png_structp png, png_bytep out, size_t len)
+{
+	png_src_t *src = png_get_io_ptr(png);
+
+	if (len > src->size - src->pos)
+		png_error(png, "truncated file");
+
+	memcpy(out, src->p + src->pos, len);
+	src->pos += len;
+}
+
+/* decode to RGBA; thread-safe, so it also serves async loads */
+uint8_t *
+pngi_decode(const char *filename, uint32_t *wp, uint32_t *hp)
+{
+	png_src_t src = { .pos = 8 };
 	png_structp png;
 	uint8_t *data;
 	uint32_t w, h;
 	png_bytep *rows;
 	int color_type, bit_depth;
-	unsigned ref;
 
-	CBUG(!fp, "fopen");
+	src.p = file_map(filename, &src.size);
+	if (!src.p) {
+		WARN("png: can't open %s\n", filename);
+		return NULL;
+	}
 
-	fread(header, 1, 8, fp);
-	CBUG(png_sig_cmp(header, 0, 8), "Not a PNG file");
+	if (src.size < 8 || png_sig_cmp(src.p, 0, 8)) {
+		WARN("png: %s is not a PNG file\n", filename);
+		file_unmap(src.p, src.size);
+		return NULL;
+	}
 
 	 png = png_create_read_struct(
 			 PNG_LIBPNG_VER_STRING,
@@ -34,13 +123,12 @@ pngi_load(const char *filename)
 
 	 CBUG(setjmp(png_jmpbuf(png)), "setjmp");
 
-	 png_init_io(png, fp);
+	 png_set_read_fn(png, &src, png_src_read);
 	 png_set_sig_bytes(png, 8);
 	 png_read_info(png, info);
 
 	 w = png_get_image_width(png, info);
 	 h = png_get_image_height(png, info);
-	 ref = img_new(&data, filename, w, h, IMG_LOAD);
 
 	 color_type = png_get_color_type(png, info);
 	 bit_depth = png_get_bit_depth(png, info);
@@ -55,6 +143,10 @@ pngi_load(const char *filename)
 			 && bit_depth < 8)
 		 png_set_expand_gray_1_2_4_to_8(png);
 
+	 if (color_type == PNG_COLOR_TYPE_GRAY
+			 || color_type == PNG_COLOR_TYPE_GRAY_ALPHA)
+		 png_set_gray_to_rgb(png);
+
 	 if (png_get_valid(png, info, PNG_INFO_tRNS))
 		 png_set_tRNS_to_alpha(png);
 
@@ -62,40 +154,42 @@ pngi_load(const char *filename)
 
 
 	 png_read_update_info(png, info);
+	 CBUG(png_get_rowbytes(png, info) != (size_t) w * 4,
+			 "png: %s doesn't decode to RGBA\n", filename);
 
+	 /* libpng writes every row straight into the image */
+	 data = malloc((size_t) w * h * 4);
 	 rows = malloc(sizeof(png_bytep) * h);
+	 CBUG(!data || !rows, "malloc png data");
 
 	 for (uint32_t y = 0; y < h; y++)
-		 rows[y] = malloc(png_get_rowbytes(png,
-					 info));
+		 rows[y] = data + (size_t) y * w * 4;
 
 	 png_read_image(png, rows);
 
-	 uint8_t *pos = data;
-
-	 for (uint32_t y = 0; y < h; y++) {
-		 png_bytep row = rows[y];
-
-		 for (uint32_t x = 0; x < w; x++, pos += 4) {
-			 png_byte *pixel = &(row[x * 4]);
-			 pos[0] = pixel[0];
-			 pos[1] = pixel[1];
-			 pos[2] = pixel[2];
-			 pos[3] = pixel[3];
-		 }
-	 }
+	 png_destroy_read_struct(&png, &info, NULL);
+	 file_unmap(src.p, src.size);
+	 free(rows);
 
-	 qgl_tex_upd(ref, 0, 0, w, h, data);
+	 *wp = w;
+	 *hp = h;
+	 return data;
+}
 
-	 fclose(fp);
-	 png_destroy_read_struct(&png, &info, NULL);
+unsigned
+pngi_load(const char *filename)
+{
+	uint8_t *data;
+	uint32_t w, h;
+	unsigned ref;
 
-	 for (uint32_t y = 0; y < h; y++)
-		 free(rows[y]);
+	data = pngi_decode(filename, &w, &h);
+	CBUG(!data, "png: can't load %s\n", filename);
 
-	 free(rows);
+	ref = img_put(data, filename, w, h);
+	qgl_tex_upd(ref, 0, 0, w, h, data);
 
-	 return ref;
+	return ref;
 }
 
 int
@@ -147,7 +241,7 @@ pngi_save(const char *filename,
 
 void
 png_construct(void) {
-	img_be_load("png", pngi_load, pngi_save);
+	img_be_load("png", pngi_load, pngi_save, pngi_decode);
 }
 
 __attribute__((constructor))
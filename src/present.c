@@ -0,0 +1,224 @@
+/*
+ * present.c — present thread and frame queue
+ *
+ * Lets a backend hand finished frames to a thread of its own, so the
+ * render thread doesn't sit through the copy and the vsync wait.
+ *
+ * Frames live in depth + 1 buffers: up to depth waiting and one being
+ * presented. Each buffer is a full copy of the frame, refreshed where
+ * it is stale (see damage.h), so the present thread may read any part
+ * of it. Buffers move FREE -> QUEUED -> SHOWING -> FREE through atomic
+ * states: only the render thread fills FREE ones, only the present
+ * thread takes QUEUED ones, and a full queue either waits for a buffer
+ * or takes back the oldest queued frame, whose damage the new frame
+ * inherits.
+ */
+
+#include "../include/ttypt/qgl.h"
+#include "./gl.h"
+#include "./be.h"
+#include "./damage.h"
+
+#include <ttypt/qsys.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+enum {
+	FRAME_FREE,
+	FRAME_QUEUED,
+	FRAME_SHOWING,
+};
+
+typedef struct {
+	uint8_t *buf;
+	qgl_rect_t damage;	/* what this frame changed */
+	_Atomic uint64_t seq;	/* push count, read before owning it */
+	_Atomic int state;
+} frame_t;
+
+static frame_t *g_frames;
+static qgl_rect_t *g_stale;	/* render thread: damage each hasn't seen */
+static uint32_t g_nframes;
+static uint64_t g_seq;
+static int g_drop;
+static qgl_present_fn_t *g_present;
+
+static pthread_t g_thread;
+static sem_t g_queued, g_freed;
+static atomic_int g_stop;
+static atomic_uint_fast64_t g_rows;
+
+/* the queued frame pushed first and its seq, or NULL */
+static frame_t *oldest_queued(uint64_t *seq)
+{
+	frame_t *best = NULL;
+	uint32_t i;
+
+	for (i = 0; i < g_nframes; i++) {
+		frame_t *f = &g_frames[i];
+		uint64_t s;
+
+		if (atomic_load(&f->state) != FRAME_QUEUED)
+			continue;
+
+		s = atomic_load(&f->seq);
+		if (!best || s < *seq) {
+			best = f;
+			*seq = s;
+		}
+	}
+
+	return best;
+}
+
+/*
+ * Take the oldest queued frame for presenting. The render thread may
+ * take a frame back and queue it again as a newer one between the scan
+ * and the CAS, so the seq is checked again once the frame is ours, and
+ * a frame that turned out newer goes back for an older one to go first.
+ */
+static frame_t *frame_take(void)
+{
+	for (;;) {
+		int queued = FRAME_QUEUED;
+		uint64_t seq;
+		frame_t *f = oldest_queued(&seq);
+
+		if (!f)
+			return NULL;
+
+		if (!atomic_compare_exchange_strong(&f->state, &queued,
+					FRAME_SHOWING))
+			continue;
+
+		if (atomic_load(&f->seq) == seq)
+			return f;
+
+		atomic_store(&f->state, FRAME_QUEUED);
+	}
+}
+
+static void *present_loop(void *arg)
+{
+	(void) arg;
+
+	for (;;) {
+		frame_t *f;
+
+		sem_wait(&g_queued);
+		if (atomic_load(&g_stop))
+			return NULL;
+
+		/* the render thread may have taken it back meanwhile */
+		f = frame_take();
+		if (!f)
+			continue;
+
+		atomic_fetch_add(&g_rows, g_present(f->buf, f->damage.x0,
+					f->damage.y0, f->damage.x1,
+					f->damage.y1));
+
+		atomic_store(&f->state, FRAME_FREE);
+		sem_post(&g_freed);
+	}
+}
+
+void qgl_present_start(uint32_t depth, int drop, qgl_present_fn_t *fn)
+{
+	size_t size = (size_t) qgl_width * qgl_height * 4;
+	uint32_t i;
+
+	g_nframes = depth + 1;
+	g_frames = calloc(g_nframes, sizeof(*g_frames));
+	g_stale = calloc(g_nframes, sizeof(*g_stale));
+	CBUG(!g_frames || !g_stale, "calloc present frames");
+	qgl_stale_reset(g_stale, g_nframes);
+
+	for (i = 0; i < g_nframes; i++) {
+		g_frames[i].buf = calloc(size, 1);
+		CBUG(!g_frames[i].buf, "calloc present frame");
+	}
+
+	g_drop = drop;
+	g_present = fn;
+	g_seq = 0;
+	atomic_store(&g_stop, 0);
+	atomic_store(&g_rows, 0);
+
+	CBUG(sem_init(&g_queued, 0, 0), "sem_init");
+	CBUG(sem_init(&g_freed, 0, 0), "sem_init");
+	CBUG(pthread_create(&g_thread, NULL, present_loop, NULL),
+			"pthread_create present");
+}
+
+/* a free buffer, or the oldest queued one taken back */
+static frame_t *frame_get(qgl_rect_t *damage)
+{
+	for (;;) {
+		frame_t *f;
+		uint64_t seq;
+		uint32_t i;
+
+		for (i = 0; i < g_nframes; i++)
+			if (atomic_load(&g_frames[i].state) == FRAME_FREE)
+				return &g_frames[i];
+
+		f = g_drop ? oldest_queued(&seq) : NULL;
+		if (f) {
+			int queued = FRAME_QUEUED;
+
+			if (atomic_compare_exchange_strong(&f->state,
+						&queued, FRAME_FREE)) {
+				qgl_rect_union(damage, &f->damage);
+				qgl_stat_add(QGL_STAT_DROPPED, 1);
+				return f;
+			}
+			continue;
+		}
+
+		sem_wait(&g_freed);
+	}
+}
+
+uint64_t qgl_present_push(const uint8_t *canvas,
+		uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1)
+{
+	qgl_rect_t damage = { x0, y0, x1, y1 };
+	frame_t *f;
+
+	if (!qgl_rect_empty(&damage)) {
+		f = frame_get(&damage);
+		qgl_stale_fill(g_stale, g_nframes, (uint32_t) (f - g_frames),
+				&damage, f->buf, canvas);
+		f->damage = damage;
+		atomic_store(&f->seq, ++g_seq);
+		atomic_store(&f->state, FRAME_QUEUED);
+		sem_post(&g_queued);
+	}
+
+	return atomic_exchange(&g_rows, 0);
+}
+
+void qgl_present_stop(void)
+{
+	uint32_t i;
+
+	if (!g_frames)
+		return;
+
+	atomic_store(&g_stop, 1);
+	sem_post(&g_queued);
+	pthread_join(g_thread, NULL);
+	sem_destroy(&g_queued);
+	sem_destroy(&g_freed);
+
+	for (i = 0; i < g_nframes; i++)
+		free(g_frames[i].buf);
+	free(g_frames);
+	free(g_stale);
+	g_frames = NULL;
+	g_stale = NULL;
+	g_nframes = 0;
+}
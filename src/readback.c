@@ -0,0 +1,157 @@
+/*
+ * readback.c — frame readback for backends presenting from memory
+ *
+ * By default the frame is read straight into screen.canvas, which
+ * waits for the GPU to finish drawing it. With QGL_HINT_ASYNC_READBACK
+ * set at qgl_init(), each frame is read into one of a ring of
+ * pixel-pack buffers instead, and only copied out at the next flush,
+ * by which time the GPU has long finished it: the backend presents a
+ * frame late, but the CPU never waits for the GPU.
+ */
+
+#include "./gl.h"
+#include "./be.h"
+
+#include <string.h>
+
+#define READBACK_PBOS 2
+
+typedef struct {
+	GLuint pbo;
+	GLsync fence;
+	uint32_t x0, y0, x1, y1;	/* area read, empty when idle */
+} readback_t;
+
+static readback_t g_rb[READBACK_PBOS];
+static uint32_t g_rb_cur;
+static int g_rb_async;
+
+void qgl_readback_init(void)
+{
+	size_t size = (size_t) qgl_width * qgl_height * 4;
+	uint32_t i;
+
+	g_rb_async = screen.canvas && qgl_hint_get(QGL_HINT_ASYNC_READBACK);
+	if (!g_rb_async)
+		return;
+
+	for (i = 0; i < READBACK_PBOS; i++) {
+		glGenBuffers(1, &g_rb[i].pbo);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, g_rb[i].pbo);
+		glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr) size, NULL,
+				GL_STREAM_READ);
+	}
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+/*
+ * read an area of g_fbo to `base`: an address, or an offset into the
+ * bound pixel-pack buffer, which glReadPixels takes as a pointer
+ */
+static void read_at(uintptr_t base, size_t pitch,
+		uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1)
+{
+	qgl_bind_fbo(g_fbo);
+	glReadBuffer(GL_COLOR_ATTACHMENT0);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glPixelStorei(GL_PACK_ROW_LENGTH, (GLint) (pitch / 4));
+	glReadPixels(x0, y0, x1 - x0, y1 - y0, GL_BGRA, GL_UNSIGNED_BYTE,
+			(void *) (base + (size_t) y0 * pitch
+				+ (size_t) x0 * 4));
+	glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+}
+
+void qgl_read_rect(uint8_t *base, size_t pitch,
+		uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1)
+{
+	read_at((uintptr_t) base, pitch, x0, y0, x1, y1);
+}
+
+/* copy what a buffer holds into the canvas, once the GPU wrote it */
+static void rb_collect(readback_t *rb)
+{
+	size_t row = (size_t) qgl_width * 4;
+	size_t off = (size_t) rb->y0 * row;
+	const uint8_t *src;
+	uint32_t y;
+
+	glClientWaitSync(rb->fence, GL_SYNC_FLUSH_COMMANDS_BIT, UINT64_MAX);
+	glDeleteSync(rb->fence);
+	rb->fence = 0;
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, rb->pbo);
+	src = glMapBufferRange(GL_PIXEL_PACK_BUFFER, (GLintptr) off,
+			(GLsizeiptr) ((rb->y1 - rb->y0) * row),
+			GL_MAP_READ_BIT);
+
+	if (src) {
+		for (y = rb->y0; y < rb->y1; y++)
+			memcpy(screen.canvas + (size_t) y * row
+					+ (size_t) rb->x0 * 4,
+					src + (size_t) (y - rb->y0) * row
+					+ (size_t) rb->x0 * 4,
+					(size_t) (rb->x1 - rb->x0) * 4);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+}
+
+void qgl_readback(void)
+{
+	readback_t *rb, *old;
+
+	if (!screen.canvas)
+		return;
+
+	if (!g_rb_async) {
+		if (screen.min_x < screen.max_x)
+			qgl_read_rect(screen.canvas, (size_t) qgl_width * 4,
+					screen.min_x, screen.min_y,
+					screen.max_x, screen.max_y);
+		return;
+	}
+
+	rb = &g_rb[g_rb_cur];
+	g_rb_cur = (g_rb_cur + 1) % READBACK_PBOS;
+	old = &g_rb[g_rb_cur];
+
+	rb->x0 = screen.min_x;
+	rb->y0 = screen.min_y;
+	rb->x1 = screen.max_x;
+	rb->y1 = screen.max_y;
+
+	if (rb->x0 < rb->x1) {
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, rb->pbo);
+		read_at(0, (size_t) qgl_width * 4,
+				rb->x0, rb->y0, rb->x1, rb->y1);
+		rb->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+
+	/* the backend gets the previous frame instead */
+	screen.min_x = old->x0;
+	screen.min_y = old->y0;
+	screen.max_x = old->x1;
+	screen.max_y = old->y1;
+
+	if (old->x0 < old->x1)
+		rb_collect(old);
+
+	old->x0 = old->x1 = 0;
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+void qgl_readback_deinit(void)
+{
+	uint32_t i;
+
+	for (i = 0; i < READBACK_PBOS; i++) {
+		if (g_rb[i].fence)
+			glDeleteSync(g_rb[i].fence);
+		if (g_rb[i].pbo)
+			glDeleteBuffers(1, &g_rb[i].pbo);
+	}
+
+	memset(g_rb, 0, sizeof(g_rb));
+	g_rb_cur = 0;
+	g_rb_async = 0;
+}
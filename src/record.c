@@ -0,0 +1,240 @@
+/*
+ * record.c — per-thread command recording
+ *
+ * Any thread may draw between qgl_record_begin() and qgl_record_end():
+ * its quads go to a buffer only that thread touches, and the GL thread
+ * draws what was last published with qgl_record_submit().
+ *
+ * Each thread owns three buffers cycling through recording, ready and
+ * shown. Publishing marks a buffer ready and drops an older ready one
+ * the GL thread hasn't taken yet; submitting swaps the newest ready
+ * buffer in for the shown one, or draws the shown one again. Neither
+ * side ever waits on the other, and buffers are refilled in place, so
+ * recording stops allocating once they are large enough.
+ */
+
+#include "../include/ttypt/qgl.h"
+#include "./gl.h"
+
+#include <ttypt/qsys.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define REC_BUFS 3
+
+enum {
+	BUF_FREE,
+	BUF_RECORDING,
+	BUF_READY,
+	BUF_SHOWN,
+};
+
+typedef struct rec_slot {
+	hw_list_t buf[REC_BUFS];
+	uint32_t order[REC_BUFS];
+	_Atomic uint64_t seq[REC_BUFS];	/* publication count, newest wins */
+	_Atomic int state[REC_BUFS];
+	uint64_t next_seq;
+	uint32_t id;			/* registration count, breaks ties */
+	int shown;			/* GL thread: buffer being drawn */
+	struct rec_slot *next;
+} rec_slot_t;
+
+/* every thread that ever recorded; only ever pushed to */
+static _Atomic(rec_slot_t *) g_slots;
+static _Atomic uint32_t g_slot_ids;
+
+static _Thread_local rec_slot_t *t_slot;
+static _Thread_local int t_cur = -1;
+
+_Thread_local hw_list_t *qgl_thread_list;
+
+/* GL thread scratch for ordering the slots */
+static rec_slot_t **g_order;
+static uint32_t g_order_cap;
+
+static rec_slot_t *slot_get(void)
+{
+	rec_slot_t *s = t_slot;
+
+	if (s)
+		return s;
+
+	s = calloc(1, sizeof(*s));
+	CBUG(!s, "calloc record slot");
+
+	s->id = atomic_fetch_add(&g_slot_ids, 1);
+	s->next = atomic_load(&g_slots);
+	while (!atomic_compare_exchange_weak(&g_slots, &s->next, s))
+		;
+
+	return t_slot = s;
+}
+
+void qgl_record_begin(uint32_t order)
+{
+	rec_slot_t *s = slot_get();
+	int i;
+
+	if (t_cur >= 0) {
+		WARN("qgl_record_begin: already recording\n");
+		return;
+	}
+
+	/*
+	 * At most one buffer is ready and one shown, so one is free,
+	 * except while slot_take() swaps them: two are shown for a moment
+	 * and we take our own ready one back instead.
+	 */
+	for (i = 0; i < REC_BUFS; i++) {
+		int expect = BUF_FREE;
+
+		if (atomic_compare_exchange_strong(&s->state[i],
+					&expect, BUF_RECORDING))
+			break;
+	}
+
+	if (i == REC_BUFS)
+		for (i = 0; i < REC_BUFS; i++) {
+			int expect = BUF_READY;
+
+			if (atomic_compare_exchange_strong(&s->state[i],
+						&expect, BUF_RECORDING))
+				break;
+		}
+
+	CBUG(i == REC_BUFS, "no free record buffer");
+
+	s->buf[i].ncmd = 0;
+	s->buf[i].ninst = 0;
+	s->order[i] = order;
+	t_cur = i;
+	qgl_thread_list = &s->buf[i];
+}
+
+void qgl_record_end(void)
+{
+	rec_slot_t *s = t_slot;
+	int i, cur = t_cur;
+
+	if (cur < 0) {
+		WARN("qgl_record_end: not recording\n");
+		return;
+	}
+
+	t_cur = -1;
+	qgl_thread_list = NULL;
+
+	atomic_store_explicit(&s->seq[cur], ++s->next_seq,
+			memory_order_relaxed);
+	atomic_store_explicit(&s->state[cur], BUF_READY,
+			memory_order_release);
+
+	/* drop what the GL thread didn't pick up in time */
+	for (i = 0; i < REC_BUFS; i++) {
+		int expect = BUF_READY;
+
+		if (i != cur)
+			atomic_compare_exchange_strong(&s->state[i],
+					&expect, BUF_FREE);
+	}
+}
+
+/* swap in the newest ready buffer; returns the one to draw, or -1 */
+static int slot_take(rec_slot_t *s)
+{
+	int i, ready = -1, shown = -1;
+	uint64_t best = 0;
+
+	for (i = 0; i < REC_BUFS; i++) {
+		int st = atomic_load_explicit(&s->state[i],
+				memory_order_acquire);
+		/* may be republished meanwhile, then the CAS below decides */
+		uint64_t seq = atomic_load_explicit(&s->seq[i],
+				memory_order_relaxed);
+
+		if (st == BUF_SHOWN)
+			shown = i;
+		else if (st == BUF_READY && (ready < 0 || seq > best)) {
+			ready = i;
+			best = seq;
+		}
+	}
+
+	if (ready >= 0) {
+		int expect = BUF_READY;
+
+		/* the recorder may have dropped it meanwhile */
+		if (atomic_compare_exchange_strong(&s->state[ready],
+					&expect, BUF_SHOWN)) {
+			if (shown >= 0)
+				atomic_store(&s->state[shown], BUF_FREE);
+			return ready;
+		}
+	}
+
+	return shown;
+}
+
+void qgl_record_submit(void)
+{
+	rec_slot_t *s;
+	uint32_t n = 0, i, j;
+
+	for (s = atomic_load(&g_slots); s; s = s->next) {
+		s->shown = slot_take(s);
+		if (s->shown < 0)
+			continue;
+
+		if (n == g_order_cap) {
+			g_order_cap = g_order_cap ? g_order_cap * 2 : 8;
+			g_order = realloc(g_order,
+					g_order_cap * sizeof(*g_order));
+			CBUG(!g_order, "realloc record order");
+		}
+
+		g_order[n++] = s;
+	}
+
+	/* few threads: insertion sort on order, then registration */
+	for (i = 1; i < n; i++) {
+		rec_slot_t *t = g_order[i];
+		uint32_t key = t->order[t->shown];
+
+		for (j = i; j > 0; j--) {
+			rec_slot_t *p = g_order[j - 1];
+			uint32_t pkey = p->order[p->shown];
+
+			if (pkey < key || (pkey == key && p->id < t->id))
+				break;
+			g_order[j] = p;
+		}
+
+		g_order[j] = t;
+	}
+
+	for (i = 0; i < n; i++) {
+		s = g_order[i];
+		qgl_list_replay(&s->buf[s->shown], 0, 0, qgl_default_tint);
+	}
+}
+
+void qgl_record_deinit(void)
+{
+	rec_slot_t *s = atomic_exchange(&g_slots, NULL), *next;
+	int i;
+
+	for (; s; s = next) {
+		next = s->next;
+		for (i = 0; i < REC_BUFS; i++) {
+			free(s->buf[i].cmd);
+			free(s->buf[i].inst);
+		}
+		free(s);
+	}
+
+	free(g_order);
+	g_order = NULL;
+	g_order_cap = 0;
+}
@@ -0,0 +1,182 @@
+/*
+ * state.c — GL state shadowing
+ *
+ * Keeps a copy of the bindings and fixed-function state QGL touches,
+ * so that setting what is already set costs no GL call. Anything that
+ * changes this state behind QGL's back must call qgl_state_reset().
+ */
+
+#include "./gl.h"
+
+#include <string.h>
+
+#define STATE_UNITS 8
+#define UNIFORM_SLOTS 64
+#define UNIFORM_MAX 64
+
+typedef struct {
+	GLuint prog;
+	GLint loc;
+	uint32_t len;
+	unsigned char val[UNIFORM_MAX];
+} uniform_slot_t;
+
+static struct {
+	GLuint prog, vao, fbo;
+	GLuint unit, tex[STATE_UNITS];
+	GLint vp[4];
+	int blend;
+	GLenum blend_func[4];
+} g_state;
+
+static uniform_slot_t g_uniform[UNIFORM_SLOTS];
+
+static inline void skipped(void)
+{
+	qgl_stat_add(QGL_STAT_GL_SKIPPED, 1);
+}
+
+void qgl_state_reset(void)
+{
+	/* no object is ever named ~0, so everything misses once */
+	memset(&g_state, 0xff, sizeof(g_state));
+	memset(g_uniform, 0, sizeof(g_uniform));
+}
+
+void qgl_use_program(GLuint prog)
+{
+	if (g_state.prog == prog) {
+		skipped();
+		return;
+	}
+
+	g_state.prog = prog;
+	glUseProgram(prog);
+}
+
+void qgl_bind_vao(GLuint vao)
+{
+	if (g_state.vao == vao) {
+		skipped();
+		return;
+	}
+
+	g_state.vao = vao;
+	glBindVertexArray(vao);
+}
+
+void qgl_bind_tex(GLuint unit, GLuint tex)
+{
+	/* callers may go on to raw texture calls on the active unit */
+	if (g_state.unit != unit) {
+		g_state.unit = unit;
+		glActiveTexture(GL_TEXTURE0 + unit);
+	}
+
+	if (unit < STATE_UNITS && g_state.tex[unit] == tex) {
+		skipped();
+		return;
+	}
+
+	if (unit < STATE_UNITS)
+		g_state.tex[unit] = tex;
+	glBindTexture(GL_TEXTURE_2D, tex);
+}
+
+void qgl_state_forget_tex(GLuint tex)
+{
+	unsigned i;
+
+	/* deleting a bound texture rebinds 0, and its name may be reused */
+	for (i = 0; i < STATE_UNITS; i++)
+		if (g_state.tex[i] == tex)
+			g_state.tex[i] = 0;
+}
+
+void qgl_bind_fbo(GLuint fbo)
+{
+	if (g_state.fbo == fbo) {
+		skipped();
+		return;
+	}
+
+	g_state.fbo = fbo;
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+}
+
+GLuint qgl_current_fbo(void)
+{
+	return g_state.fbo;
+}
+
+void qgl_viewport(GLint x, GLint y, GLsizei w, GLsizei h)
+{
+	GLint vp[4] = { x, y, w, h };
+
+	if (!memcmp(g_state.vp, vp, sizeof(vp))) {
+		skipped();
+		return;
+	}
+
+	memcpy(g_state.vp, vp, sizeof(vp));
+	glViewport(x, y, w, h);
+}
+
+void qgl_blend(int on)
+{
+	on = !!on;
+
+	if (g_state.blend == on) {
+		skipped();
+		return;
+	}
+
+	g_state.blend = on;
+	if (on)
+		glEnable(GL_BLEND);
+	else
+		glDisable(GL_BLEND);
+}
+
+void qgl_blend_func(GLenum src_rgb, GLenum dst_rgb,
+		GLenum src_a, GLenum dst_a)
+{
+	GLenum f[4] = { src_rgb, dst_rgb, src_a, dst_a };
+
+	if (!memcmp(g_state.blend_func, f, sizeof(f))) {
+		skipped();
+		return;
+	}
+
+	memcpy(g_state.blend_func, f, sizeof(f));
+	glBlendFuncSeparate(src_rgb, dst_rgb, src_a, dst_a);
+}
+
+int qgl_uniform_changed(GLint loc, const void *val, size_t len)
+{
+	GLuint prog = g_state.prog;
+	uniform_slot_t *s;
+
+	if (len > UNIFORM_MAX)
+		return 1;
+
+	s = &g_uniform[(prog * 31u + (GLuint) loc) % UNIFORM_SLOTS];
+
+	if (s->prog == prog && s->loc == loc && s->len == len
+			&& !memcmp(s->val, val, len)) {
+		skipped();
+		return 0;
+	}
+
+	s->prog = prog;
+	s->loc = loc;
+	s->len = (uint32_t) len;
+	memcpy(s->val, val, len);
+	return 1;
+}
+
+void qgl_uniform1i(GLint loc, GLint v)
+{
+	if (qgl_uniform_changed(loc, &v, sizeof(v)))
+		glUniform1i(loc, v);
+}
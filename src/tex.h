@@ -1,6 +1,7 @@
 #ifndef QGL_TEX_H
 #define QGL_TEX_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 enum img_new_flags {
@@ -11,23 +12,77 @@ typedef unsigned img_load_t(const char *filename);
 typedef int img_save_t(const char *filename,
 		const uint8_t *data, uint32_t w, uint32_t h);
 
+/* decode a file to RGBA without touching any shared state; NULL if it can't */
+typedef uint8_t *img_decode_t(const char *filename,
+		uint32_t *w, uint32_t *h);
+
 typedef struct img_be {
 	img_load_t *load;
 	img_save_t *save;
+	img_decode_t *decode;
 } img_be_t;
 
-void img_be_load(char *ext, img_load_t *load, img_save_t *save);
+void img_be_load(char *ext, img_load_t *load, img_save_t *save,
+		img_decode_t *decode);
 
 unsigned img_new(uint8_t **data,
 		const char *filename,
 		uint32_t w, uint32_t h,
 		unsigned flags);
 
+/*
+ * like img_new(), taking ownership of already decoded data; both leave
+ * the texture empty until the pixels go up with qgl_tex_upd()
+ */
+unsigned img_put(uint8_t *data, const char *filename,
+		uint32_t w, uint32_t h);
+
+/* an image whose pixels stay owned by the caller, `stride` pixels
+ * apart; it gets no texture (see qgl_tex_reg_sub) */
+unsigned img_put_shared(uint8_t *data, const char *name,
+		uint32_t w, uint32_t h, uint32_t stride);
+
+void img_del(unsigned ref);
+
+/* decode through the on-disk cache (img-cache.c); a non-zero
+ * `map_len` means the pixels are mapped from it */
+uint8_t *img_cache_decode(const char *filename, img_decode_t *decode,
+		uint32_t *w, uint32_t *h, size_t *map_len);
+
+/* release pixels from img_cache_decode() */
+void img_cache_free(uint8_t *data, size_t map_len);
+
+/* decoding on worker threads (img-async.c) */
+void img_async_push(unsigned ref, const char *filename,
+		img_decode_t *decode);
+
+/* take a finished job; `wait` blocks while any are pending */
+int img_async_pop(unsigned *ref, uint8_t **data,
+		uint32_t *w, uint32_t *h, size_t *map_len, int wait);
+
+void img_async_deinit(void);
+
+/* upload finished asynchronous loads, within QGL_HINT_UPLOAD_US */
+void img_async_drain(void);
+
+/* a texture for `ref` from BGRA `data`, or left for qgl_tex_upd() if NULL */
 void qgl_tex_reg(uint32_t ref, uint8_t *data,
 			 uint32_t w, uint32_t h);
 
 void qgl_tex_ureg(uint32_t ref);
 
+/* make room to register `ref` later without moving other textures */
+void qgl_tex_reserve(uint32_t ref);
+
+/* a whole page of RGBA pixels; returns its GL texture */
+uint32_t qgl_tex_page_new(uint32_t w, uint32_t h, const uint8_t *data);
+void qgl_tex_page_del(uint32_t id);
+
+/* register `ref` as the w x h rect at x, y of a tw x th page */
+void qgl_tex_reg_sub(uint32_t ref, uint32_t page_id,
+		uint32_t tw, uint32_t th,
+		uint32_t x, uint32_t y, uint32_t w, uint32_t h);
+
 void qgl_tex_upd(uint32_t ref, uint32_t x, uint32_t y,
 		uint32_t w, uint32_t h, uint8_t *data);
 
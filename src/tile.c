@@ -4,10 +4,11 @@
 #include <stdio.h>
 #include <string.h>
 
-#include <ttypt/qmap.h>
 #include <ttypt/qsys.h>
 
-static uint32_t tm_hd;
+#include "./handle.h"
+
+static qgl_htab_t tm_tab = QGL_HTAB(qgl_tm_t);
 
 uint32_t
 qgl_tm_new(uint32_t img_ref, uint32_t w, uint32_t h)
@@ -22,7 +23,7 @@ qgl_tm_new(uint32_t img_ref, uint32_t w, uint32_t h)
 	tm.nx = img_w / w;
 	tm.ny = img_h / h;
 
-	uint32_t ref = qmap_put(tm_hd, NULL, &tm);
+	uint32_t ref = qgl_hnew(&tm_tab, &tm);
 	WARN("tm_load %u: %u %u %u\n", ref, img_ref,
 			w, h);
 	return ref;
@@ -34,7 +35,7 @@ qgl_tile_draw(uint32_t ref, uint32_t idx,
 		uint32_t w, uint32_t h,
 		uint32_t rx, uint32_t ry)
 {
-	const qgl_tm_t *tm = qmap_get(tm_hd, &ref);
+	const qgl_tm_t *tm = qgl_hget(&tm_tab, ref);
 
 	unsigned tm_x = idx % tm->nx;
 	unsigned tm_y = idx / tm->nx;
@@ -55,22 +56,14 @@ qgl_tile_draw(uint32_t ref, uint32_t idx,
 					w, h, qgl_default_tint);
 }
 
-const qgl_tm_t *
-qgl_tm_get(uint32_t ref)
-{
-	return qmap_get(tm_hd, &ref);
-}
-
 void
-tile_construct(void)
+qgl_tm_del(uint32_t ref)
 {
-	uint32_t qm_tm = qmap_reg(sizeof(qgl_tm_t));
-
-	tm_hd = qmap_open(NULL, NULL, QM_HNDL, qm_tm, 0xF, QM_AINDEX);
+	qgl_hdel(&tm_tab, ref);
 }
 
-void __attribute__((constructor))
-constructor(void)
+const qgl_tm_t *
+qgl_tm_get(uint32_t ref)
 {
-	tile_construct();
+	return qgl_hget(&tm_tab, ref);
 }
@@ -5,8 +5,7 @@
 #include <xxhash.h>
 #include <math.h>
 
-extern GLuint g_fbo, g_vao_dummy, g_prog_tex;
-extern GLint g_uDst_tex, g_uUV_tex, g_uTint_tex;
+extern GLuint g_fbo;
 
 /* Each div optionally owns a cache */
 typedef struct {
@@ -120,8 +119,8 @@ void qgl_cache_build(qui_div_t *d)
 {
     qgl_cache_t *c = DIV_CACHE(d);
     int old_dirty;
-    GLuint tex, fbo;
-    GLint prev_fbo, vp[4];
+    GLuint tex, fbo, prev_fbo;
+    uint32_t prev_w, prev_h;
     int32_t pl, pt, pr, pb;
     uint64_t hash;
     int32_t ox, oy;
@@ -139,8 +138,14 @@ void qgl_cache_build(qui_div_t *d)
 
     hash = qgl_cache_hash_style(d->style, d->w, d->h);
 
-    if (c->tex)
+    /* quads queued so far belong to the previous target (and may
+     * still sample the texture we are about to replace) */
+    qgl_batch_flush();
+
+    if (c->tex) {
+        qgl_state_forget_tex(c->tex);
         glDeleteTextures(1, &c->tex);
+    }
 
     c->pad_l = pl;
     c->pad_t = pt;
@@ -152,7 +157,7 @@ void qgl_cache_build(qui_div_t *d)
     c->hash = hash;
 
     glGenTextures(1, &tex);
-    glBindTexture(GL_TEXTURE_2D, tex);
+    qgl_bind_tex(0, tex);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
@@ -163,13 +168,13 @@ void qgl_cache_build(qui_div_t *d)
     glGenFramebuffers(1, &fbo);
 
     /* save current framebuffer and viewport */
-    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prev_fbo);
-    glGetIntegerv(GL_VIEWPORT, vp);
+    prev_fbo = g_view_fbo;
+    prev_w = g_view_w;
+    prev_h = g_view_h;
 
-    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    qgl_set_viewport(fbo, c->w, c->h);
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
                           GL_TEXTURE_2D, tex, 0);
-    glViewport(0, 0, (GLint)c->w, (GLint)c->h);
     glClearColor(0, 0, 0, 0);
     glClear(GL_COLOR_BUFFER_BIT);
 
@@ -191,8 +196,7 @@ void qgl_cache_build(qui_div_t *d)
     c->dirty = old_dirty;
 
     /* restore previous framebuffer and viewport */
-    glBindFramebuffer(GL_FRAMEBUFFER, (GLuint)prev_fbo);
-    glViewport(vp[0], vp[1], vp[2], vp[3]);
+    qgl_set_viewport(prev_fbo, prev_w, prev_h);
     glDeleteFramebuffers(1, &fbo);
 
     c->tex = tex;
@@ -203,30 +207,22 @@ void qgl_cache_build(qui_div_t *d)
 void qgl_cache_draw(const qui_div_t *d, int32_t x, int32_t y)
 {
 	const qgl_cache_t *c = DIV_CACHE(d);
-	float dst[4], uv[4], tint[4] = { 1, 1, 1, 1 };
+	qgl_inst_t inst = { .color = qgl_default_tint, .kind = QGL_KIND_TEX };
 
 	if (!c || !c->tex)
 		return;
 
 	/* only draw inside div area */
-	dst[0] = (float)x;
-	dst[1] = (float)y;
-	dst[2] = (float)d->w;
-	dst[3] = (float)d->h;
+	inst.dst[0] = (float)x;
+	inst.dst[1] = (float)y;
+	inst.dst[2] = (float)d->w;
+	inst.dst[3] = (float)d->h;
 
 	/* UV rect to sample only the central portion (excluding shadow margins) */
-	uv[0] = (float)c->pad_l / (float)c->w;
-	uv[1] = (float)c->pad_t / (float)c->h;
-	uv[2] = (float)(c->pad_l + d->w) / (float)c->w;
-	uv[3] = (float)(c->pad_t + d->h) / (float)c->h;
-
-	glUseProgram(g_prog_tex);
-	glBindVertexArray(g_vao_dummy);
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, c->tex);
-	glUniform4fv(g_uDst_tex, 1, dst);
-	glUniform4fv(g_uUV_tex, 1, uv);
-	glUniform4fv(g_uTint_tex, 1, tint);
-	glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
-}
+	inst.uv[0] = (float)c->pad_l / (float)c->w;
+	inst.uv[1] = (float)c->pad_t / (float)c->h;
+	inst.uv[2] = (float)(c->pad_l + d->w) / (float)c->w;
+	inst.uv[3] = (float)(c->pad_t + d->h) / (float)c->h;
 
+	qgl_batch_push(&g_pipe_quad, c->tex, &inst);
+}
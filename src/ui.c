@@ -1057,8 +1057,26 @@ void render_div_raw(qui_div_t *d)
 		}
 	}
 
+	if (!d->first_child)
+		return;
+
+	/* hidden overflow: children stay inside the padding box */
+	if (s->overflow_y == QUI_OVERFLOW_HIDDEN) {
+		int32_t b = (int32_t)s->border_width;
+
+		if (d->w <= 2 * b || d->h <= 2 * b)
+			return;
+
+		qgl_clip_push(d->x + b, d->y + b,
+				(uint32_t)(d->w - 2 * b),
+				(uint32_t)(d->h - 2 * b));
+	}
+
 	for (qui_div_t *c = d->first_child; c; c = c->next_sibling)
 		render_div_raw(c);
+
+	if (s->overflow_y == QUI_OVERFLOW_HIDDEN)
+		qgl_clip_pop();
 }
 
 /*
@@ -0,0 +1,399 @@
+/*
+ * video.c — recording presented frames to a file
+ *
+ * qgl_flush() hands each presented frame to qgl_video_frame(), which
+ * copies it into the next free buffer of a FIFO and returns; a worker
+ * thread converts the buffers in order and writes them out, through
+ * LZ4 when compressing if built with LZ4=1, zlib otherwise. The render
+ * thread never waits for the worker: with no free buffer the frame is
+ * dropped and counted, its damage left stale in every buffer (see
+ * damage.h).
+ */
+
+#include "../include/ttypt/qgl.h"
+#include "./gl.h"
+#include "./be.h"
+#include "./damage.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef QGL_HAVE_LZ4
+# include <lz4frame.h>
+#else
+# include <zlib.h>
+#endif
+#include <ttypt/qsys.h>
+
+#define VIDEO_DEPTH 4
+#define VIDEO_ZBUF (256 * 1024)
+
+typedef struct {
+	uint8_t *buf;
+	uint64_t frame, time_ns;
+} vframe_t;
+
+static struct {
+	vframe_t *frames;
+	qgl_rect_t *stale;	/* render thread: damage each hasn't seen */
+	uint32_t depth;
+	uint32_t head, count;	/* under lock */
+	int stop;		/* under lock */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t thread;
+
+	qgl_video_fmt_t fmt;
+	uint32_t w, h, fps;
+	FILE *fp;
+	atomic_int failed;	/* a write failed: drop everything */
+#ifdef QGL_HAVE_LZ4
+	LZ4F_cctx *lz;
+#else
+	z_stream z;
+#endif
+	int compress;
+	uint8_t *zbuf, *yuv;
+	size_t zcap;
+
+	uint64_t frame, dropped;
+} g_vid;
+
+static void write_all(const void *data, size_t len)
+{
+	if (!len || atomic_load(&g_vid.failed))
+		return;
+
+	if (fwrite(data, 1, len, g_vid.fp) != len) {
+		WARN("qgl_video: write: %s\n", strerror(errno));
+		atomic_store(&g_vid.failed, 1);
+	}
+}
+
+#ifdef QGL_HAVE_LZ4
+/* an LZ4 frame stream, as the lz4 tool writes: fast enough to keep up */
+static void zbegin(void)
+{
+	size_t n;
+
+	CBUG(LZ4F_isError(LZ4F_createCompressionContext(&g_vid.lz,
+					LZ4F_VERSION)),
+			"LZ4F_createCompressionContext");
+	/* room for one VIDEO_ZBUF input and what the frame ends with */
+	g_vid.zcap = LZ4F_compressBound(VIDEO_ZBUF, NULL);
+	g_vid.zbuf = malloc(g_vid.zcap);
+	CBUG(!g_vid.zbuf, "malloc video zbuf");
+
+	n = LZ4F_compressBegin(g_vid.lz, g_vid.zbuf, g_vid.zcap, NULL);
+	CBUG(LZ4F_isError(n), "LZ4F_compressBegin");
+	write_all(g_vid.zbuf, n);
+}
+
+static void zout(const void *data, size_t len)
+{
+	const uint8_t *p = data;
+
+	while (len) {
+		size_t in = len < VIDEO_ZBUF ? len : VIDEO_ZBUF;
+		size_t n = LZ4F_compressUpdate(g_vid.lz, g_vid.zbuf,
+				g_vid.zcap, p, in, NULL);
+
+		CBUG(LZ4F_isError(n), "LZ4F_compressUpdate");
+		write_all(g_vid.zbuf, n);
+		p += in;
+		len -= in;
+	}
+}
+
+static void zend(void)
+{
+	size_t n = LZ4F_compressEnd(g_vid.lz, g_vid.zbuf, g_vid.zcap, NULL);
+
+	CBUG(LZ4F_isError(n), "LZ4F_compressEnd");
+	write_all(g_vid.zbuf, n);
+	LZ4F_freeCompressionContext(g_vid.lz);
+}
+#else
+/* gzip at the fastest level, so the file is a plain .gz */
+static void zbegin(void)
+{
+	g_vid.zcap = VIDEO_ZBUF;
+	g_vid.zbuf = malloc(g_vid.zcap);
+	CBUG(!g_vid.zbuf, "malloc video zbuf");
+	memset(&g_vid.z, 0, sizeof(g_vid.z));
+	/* 15 + 16: gzip framing */
+	CBUG(deflateInit2(&g_vid.z, Z_BEST_SPEED, Z_DEFLATED, 15 + 16,
+				8, Z_DEFAULT_STRATEGY) != Z_OK,
+			"deflateInit2");
+}
+
+static void zdeflate(const void *data, size_t len, int flush)
+{
+	z_stream *z = &g_vid.z;
+
+	z->next_in = (Bytef *) data;
+	z->avail_in = (uInt) len;
+
+	do {
+		z->next_out = g_vid.zbuf;
+		z->avail_out = (uInt) g_vid.zcap;
+		deflate(z, flush ? Z_FINISH : Z_NO_FLUSH);
+		write_all(g_vid.zbuf, g_vid.zcap - z->avail_out);
+	} while (!z->avail_out);
+}
+
+static void zout(const void *data, size_t len)
+{
+	zdeflate(data, len, 0);
+}
+
+static void zend(void)
+{
+	zdeflate(NULL, 0, 1);
+	deflateEnd(&g_vid.z);
+}
+#endif
+
+/* write through the compressor if any */
+static void out(const void *data, size_t len)
+{
+	if (g_vid.compress)
+		zout(data, len);
+	else
+		write_all(data, len);
+}
+
+/* BT.601 limited range, chroma averaged over 2x2 pixels */
+static void to_i420(const uint8_t *src)
+{
+	uint32_t w = g_vid.w, h = g_vid.h;
+	uint32_t cw = (w + 1) / 2, ch = (h + 1) / 2;
+	uint8_t *yp = g_vid.yuv, *up = yp + (size_t) w * h;
+	uint8_t *vp = up + (size_t) cw * ch;
+	uint32_t x, y;
+
+	for (y = 0; y < h; y++) {
+		const uint8_t *s = src + (size_t) y * w * 4;
+
+		for (x = 0; x < w; x++, s += 4)
+			yp[(size_t) y * w + x] = (uint8_t) (16
+				+ ((66 * s[2] + 129 * s[1] + 25 * s[0]
+				+ 128) >> 8));
+	}
+
+	for (y = 0; y < ch; y++)
+		for (x = 0; x < cw; x++) {
+			uint32_t x1 = x * 2 + 1 < w ? x * 2 + 1 : x * 2;
+			uint32_t y1 = y * 2 + 1 < h ? y * 2 + 1 : y * 2;
+			const uint8_t *p[4] = {
+				src + ((size_t) y * 2 * w + x * 2) * 4,
+				src + ((size_t) y * 2 * w + x1) * 4,
+				src + ((size_t) y1 * w + x * 2) * 4,
+				src + ((size_t) y1 * w + x1) * 4,
+			};
+			int b = 0, g = 0, r = 0, i;
+
+			for (i = 0; i < 4; i++) {
+				b += p[i][0];
+				g += p[i][1];
+				r += p[i][2];
+			}
+
+			b = (b + 2) / 4;
+			g = (g + 2) / 4;
+			r = (r + 2) / 4;
+			up[(size_t) y * cw + x] = (uint8_t) (128
+				+ ((-38 * r - 74 * g + 112 * b + 128) >> 8));
+			vp[(size_t) y * cw + x] = (uint8_t) (128
+				+ ((112 * r - 94 * g - 18 * b + 128) >> 8));
+		}
+}
+
+static void write_frame(const vframe_t *f)
+{
+	size_t size = (size_t) g_vid.w * g_vid.h;
+	uint64_t hdr[2] = { f->frame, f->time_ns };
+
+	if (g_vid.fmt == QGL_VIDEO_Y4M) {
+		size_t cw = (g_vid.w + 1) / 2, ch = (g_vid.h + 1) / 2;
+
+		to_i420(f->buf);
+		out("FRAME\n", 6);
+		out(g_vid.yuv, size + cw * ch * 2);
+		return;
+	}
+
+	out(hdr, sizeof(hdr));
+	out(f->buf, size * 4);
+}
+
+static void *video_loop(void *arg)
+{
+	(void) arg;
+
+	for (;;) {
+		vframe_t *f;
+
+		pthread_mutex_lock(&g_vid.lock);
+		while (!g_vid.count && !g_vid.stop)
+			pthread_cond_wait(&g_vid.cond, &g_vid.lock);
+		if (!g_vid.count) {
+			pthread_mutex_unlock(&g_vid.lock);
+			return NULL;
+		}
+		f = &g_vid.frames[g_vid.head];
+		pthread_mutex_unlock(&g_vid.lock);
+
+		write_frame(f);
+
+		pthread_mutex_lock(&g_vid.lock);
+		g_vid.head = (g_vid.head + 1) % g_vid.depth;
+		g_vid.count--;
+		pthread_mutex_unlock(&g_vid.lock);
+	}
+}
+
+int qgl_video_open(const char *path, qgl_video_fmt_t fmt, uint32_t fps,
+		uint32_t depth, int compress)
+{
+	size_t size = (size_t) qgl_width * qgl_height;
+	char hdr[128];
+	uint32_t i;
+
+	if (g_vid.frames)
+		return -1;
+
+	g_vid.fp = fopen(path, "wb");
+	if (!g_vid.fp) {
+		WARN("qgl_video: %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	g_vid.fmt = fmt;
+	g_vid.w = qgl_width;
+	g_vid.h = qgl_height;
+	g_vid.fps = fps ? fps : 60;
+	g_vid.depth = depth ? depth : VIDEO_DEPTH;
+	g_vid.compress = compress;
+	atomic_store(&g_vid.failed, 0);
+	g_vid.head = g_vid.count = 0;
+	g_vid.stop = 0;
+	g_vid.frame = g_vid.dropped = 0;
+
+	g_vid.frames = calloc(g_vid.depth, sizeof(*g_vid.frames));
+	g_vid.stale = calloc(g_vid.depth, sizeof(*g_vid.stale));
+	CBUG(!g_vid.frames || !g_vid.stale, "calloc video frames");
+	qgl_stale_reset(g_vid.stale, g_vid.depth);
+	for (i = 0; i < g_vid.depth; i++) {
+		g_vid.frames[i].buf = malloc(size * 4);
+		CBUG(!g_vid.frames[i].buf, "malloc video frame");
+	}
+
+	if (fmt == QGL_VIDEO_Y4M) {
+		g_vid.yuv = malloc(size + (size_t) ((qgl_width + 1) / 2)
+				* ((qgl_height + 1) / 2) * 2);
+		CBUG(!g_vid.yuv, "malloc video yuv");
+	}
+
+	if (compress)
+		zbegin();
+
+	if (fmt == QGL_VIDEO_Y4M) {
+		int n = snprintf(hdr, sizeof(hdr),
+				"YUV4MPEG2 W%u H%u F%u:1 Ip A1:1 C420jpeg\n",
+				g_vid.w, g_vid.h, g_vid.fps);
+
+		out(hdr, (size_t) n);
+	} else {
+		uint32_t words[5] = { 0, 1, g_vid.w, g_vid.h, g_vid.fps };
+
+		memcpy(&words[0], "QGLV", 4);
+		out(words, sizeof(words));
+	}
+
+	CBUG(pthread_mutex_init(&g_vid.lock, NULL), "pthread_mutex_init");
+	CBUG(pthread_cond_init(&g_vid.cond, NULL), "pthread_cond_init");
+	CBUG(pthread_create(&g_vid.thread, NULL, video_loop, NULL),
+			"pthread_create video");
+	return 0;
+}
+
+void qgl_video_frame(void)
+{
+	qgl_rect_t damage = { screen.min_x, screen.min_y,
+		screen.max_x, screen.max_y };
+	struct timespec ts;
+	vframe_t *f = NULL;
+	uint32_t tail;
+
+	if (!g_vid.frames)
+		return;
+
+	g_vid.frame++;
+
+	pthread_mutex_lock(&g_vid.lock);
+	tail = (g_vid.head + g_vid.count) % g_vid.depth;
+	if (g_vid.count < g_vid.depth && !atomic_load(&g_vid.failed))
+		f = &g_vid.frames[tail];
+	pthread_mutex_unlock(&g_vid.lock);
+
+	if (!f) {
+		qgl_stale_add(g_vid.stale, g_vid.depth, &damage);
+		g_vid.dropped++;
+		qgl_stat_add(QGL_STAT_VIDEO_DROPPED, 1);
+		return;
+	}
+
+	/* the tail isn't queued: the worker won't touch it */
+	qgl_stale_fill(g_vid.stale, g_vid.depth, tail, &damage, f->buf,
+			screen.canvas);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	f->frame = g_vid.frame;
+	f->time_ns = (uint64_t) ts.tv_sec * 1000000000ull
+		+ (uint64_t) ts.tv_nsec;
+
+	pthread_mutex_lock(&g_vid.lock);
+	g_vid.count++;
+	pthread_cond_signal(&g_vid.cond);
+	pthread_mutex_unlock(&g_vid.lock);
+}
+
+uint64_t qgl_video_close(void)
+{
+	uint64_t dropped = g_vid.dropped;
+	uint32_t i;
+
+	if (!g_vid.frames)
+		return 0;
+
+	pthread_mutex_lock(&g_vid.lock);
+	g_vid.stop = 1;
+	pthread_cond_signal(&g_vid.cond);
+	pthread_mutex_unlock(&g_vid.lock);
+	pthread_join(g_vid.thread, NULL);
+	pthread_mutex_destroy(&g_vid.lock);
+	pthread_cond_destroy(&g_vid.cond);
+
+	if (g_vid.compress)
+		zend();
+	if (fclose(g_vid.fp))
+		WARN("qgl_video: close: %s\n", strerror(errno));
+	g_vid.fp = NULL;
+
+	for (i = 0; i < g_vid.depth; i++)
+		free(g_vid.frames[i].buf);
+	free(g_vid.frames);
+	free(g_vid.stale);
+	free(g_vid.zbuf);
+	free(g_vid.yuv);
+	g_vid.frames = NULL;
+	g_vid.stale = NULL;
+	g_vid.zbuf = g_vid.yuv = NULL;
+
+	return dropped;
+}
@@ -0,0 +1,137 @@
+/**
+ * bench_png.c - PNG decode benchmark for QGL
+ * Times the PNG decoder on a large and a small image, decoding and
+ * through the texture cache
+ */
+
+#include <png.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <ttypt/qgl.h>
+
+/* The decoder behind qgl_tex_load(), without the GL upload */
+typedef uint8_t *decode_t(const char *filename, uint32_t *w, uint32_t *h);
+decode_t pngi_decode;
+
+/* The same through the texture cache (see qgl_tex_cache) */
+uint8_t *img_cache_decode(const char *filename, decode_t *decode,
+		uint32_t *w, uint32_t *h, size_t *map_len);
+void img_cache_free(uint8_t *data, size_t map_len);
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+/* An RGBA image with some texture, so it compresses like art does */
+static void write_png(const char *path, uint32_t w, uint32_t h) {
+	FILE *fp = fopen(path, "wb");
+	png_structp png;
+	png_infop info;
+	png_bytep row;
+	uint32_t x, y, seed = 1;
+
+	if (!fp) {
+		perror(path);
+		exit(1);
+	}
+
+	png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+	info = png_create_info_struct(png);
+	png_init_io(png, fp);
+	png_set_IHDR(png, info, w, h, 8, PNG_COLOR_TYPE_RGBA,
+			PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
+			PNG_FILTER_TYPE_DEFAULT);
+	png_write_info(png, info);
+
+	row = malloc((size_t) w * 4);
+	for (y = 0; y < h; y++) {
+		for (x = 0; x < w; x++) {
+			seed = seed * 1103515245 + 12345;
+			row[x * 4 + 0] = (uint8_t) (x ^ y);
+			row[x * 4 + 1] = (uint8_t) ((x + y) >> 2);
+			row[x * 4 + 2] = (uint8_t) (seed >> 28);
+			row[x * 4 + 3] = (x / 64 + y / 64) & 1 ? 0xFF : 0x80;
+		}
+		png_write_row(png, row);
+	}
+
+	png_write_end(png, NULL);
+	png_destroy_write_struct(&png, &info);
+	free(row);
+	fclose(fp);
+}
+
+static volatile uint32_t sink;
+
+/* Best of `runs` rounds of `iters` decodes, in ns per decode */
+static uint64_t bench(const char *path, int runs, int iters) {
+	uint64_t best = UINT64_MAX;
+	uint32_t w, h;
+	size_t map_len;
+	int r, i;
+
+	for (r = 0; r < runs; r++) {
+		uint64_t t = now_ns();
+
+		for (i = 0; i < iters; i++) {
+			uint8_t *data = img_cache_decode(path, pngi_decode,
+					&w, &h, &map_len);
+			size_t off;
+
+			/* read it all, as the upload would */
+			for (off = 0; off < (size_t) w * h * 4; off += 64)
+				sink += data[off];
+			img_cache_free(data, map_len);
+		}
+
+		t = (now_ns() - t) / (uint64_t) iters;
+		if (t < best)
+			best = t;
+	}
+
+	return best;
+}
+
+static void report(const char *name, const char *path,
+		uint32_t w, uint32_t h, int runs, int iters) {
+	char cache[] = "/tmp/qgl_bench_cache_XXXXXX";
+	uint64_t ns, cached;
+
+	write_png(path, w, h);
+	ns = bench(path, runs, iters);
+
+	/* the first load fills the cache, the timed ones hit it */
+	if (!mkdtemp(cache) || qgl_tex_cache(cache, 0)) {
+		perror(cache);
+		exit(1);
+	}
+	bench(path, 1, 1);
+	cached = bench(path, runs, iters);
+	qgl_tex_cache(cache, 1);
+	qgl_tex_cache(NULL, 0);
+	rmdir(cache);
+
+	printf("  %-6s %5ux%-5u %10.3f ms %8.1f Mpx/s  cached %8.3f ms\n",
+			name, w, h, (double) ns / 1e6,
+			(double) w * h * 1e3 / (double) ns,
+			(double) cached / 1e6);
+	unlink(path);
+}
+
+int main(void) {
+	const char *large = "/tmp/qgl_bench_large.png";
+	const char *small = "/tmp/qgl_bench_small.png";
+
+	printf("bench_png:\n");
+	report("large", large, 4096, 4096, 5, 1);
+	report("small", small, 64, 64, 5, 1000);
+
+	return 0;
+}
@@ -4,6 +4,7 @@ generate_fixtures.py - Generate test fixtures for QGL tests
 Creates simple PNG images for testing textures, fonts, and tilemaps.
 """
 
+import subprocess
 import sys
 
 try:
@@ -113,10 +114,24 @@ def create_small_texture():
     img.save('tests/fixtures/test_small.png')
     print("Created: tests/fixtures/test_small.png")
 
+def create_test_bundle():
+    """Pack the other fixtures into a bundle of small pages"""
+    with open('tests/fixtures/test_bundle.txt', 'w') as f:
+        f.write("tex  tests/fixtures/test_small.png\n")
+        f.write("tex  tests/fixtures/test_texture.png\n")
+        f.write("tm   tiles tests/fixtures/test_tilemap.png 16 16\n")
+        f.write("font mono tests/fixtures/test_font.png 8 8 0 255\n")
+
+    subprocess.run([sys.executable, 'mkbundle.py',
+                    'tests/fixtures/test_bundle.txt',
+                    'tests/fixtures/test_bundle.qglb', '256'], check=True)
+    print("Created: tests/fixtures/test_bundle.qglb")
+
 if __name__ == '__main__':
     print("Generating QGL test fixtures...")
     create_test_texture()
     create_test_font()
     create_test_tilemap()
     create_small_texture()
+    create_test_bundle()
     print("All fixtures generated successfully!")
@@ -4,9 +4,22 @@
  */
 
 #include <assert.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
 #include <ttypt/qgl.h>
+#include <ttypt/qgl-export.h>
+#include <ttypt/qmap.h>
+
+#include "../src/pixconv.h"
 
 static void test_qgl_size(void) {
 	uint32_t w = 0, h = 0;
@@ -87,6 +100,750 @@ static void test_multiple_operations(void) {
 	printf("  test_multiple_operations: PASS\n");
 }
 
+static void test_qgl_batch_stats(void) {
+	uint32_t w, h;
+	qgl_size(&w, &h);
+
+	/* Consecutive fills share one instanced draw */
+	for (int i = 0; i < 100; i++)
+		qgl_fill(i, i, 10, 10, 0xFF00FF00);
+	qgl_flush();
+
+	assert(qgl_stat(QGL_STAT_QUADS) == 100);
+	assert(qgl_stat(QGL_STAT_DRAW_CALLS) == 1);
+
+	/* Counters are per frame */
+	qgl_flush();
+	assert(qgl_stat(QGL_STAT_QUADS) == 0);
+	assert(qgl_stat(QGL_STAT_DRAW_CALLS) == 0);
+	assert(qgl_stat(QGL_STAT_MAX) == 0);
+
+	printf("  test_qgl_batch_stats: PASS\n");
+}
+
+static void test_qgl_state_skipped(void) {
+	/* Every frame rebinds the same framebuffer and viewport */
+	qgl_fill(0, 0, 10, 10, 0xFF0000FF);
+	qgl_flush();
+	qgl_fill(0, 0, 10, 10, 0xFF0000FF);
+	qgl_flush();
+
+	assert(qgl_stat(QGL_STAT_GL_SKIPPED) > 0);
+
+	printf("  test_qgl_state_skipped: PASS\n");
+}
+
+static void test_qgl_cmdlist(void) {
+	unsigned list;
+
+	/* Recording draws nothing */
+	qgl_cmdlist_begin();
+	for (int i = 0; i < 50; i++)
+		qgl_fill(i, 0, 4, 4, 0xFFFF0000);
+	for (int i = 0; i < 50; i++)
+		qgl_fill(i, 8, 4, 4, 0xFF0000FF);
+	list = qgl_cmdlist_end();
+	qgl_flush();
+
+	assert(list != QM_MISS);
+	assert(qgl_stat(QGL_STAT_QUADS) == 0);
+
+	/* Replays, moved or tinted, join the same batch */
+	qgl_cmdlist_replay(list, 0, 0, qgl_default_tint);
+	qgl_cmdlist_replay(list, 100, 40, 0x80FFFFFF);
+	qgl_flush();
+
+	assert(qgl_stat(QGL_STAT_QUADS) == 200);
+	assert(qgl_stat(QGL_STAT_DRAW_CALLS) == 1);
+
+	/* Freed lists are ignored */
+	qgl_cmdlist_free(list);
+	qgl_cmdlist_replay(list, 0, 0, qgl_default_tint);
+	qgl_flush();
+	assert(qgl_stat(QGL_STAT_QUADS) == 0);
+
+	assert(qgl_cmdlist_end() == QM_MISS);
+
+	printf("  test_qgl_cmdlist: PASS\n");
+}
+
+static void *record_thread(void *arg) {
+	int n = *(int *) arg;
+
+	qgl_record_begin((uint32_t) n);
+	for (int i = 0; i < n; i++)
+		qgl_fill(i, n, 4, 4, 0xFF00FF00);
+	qgl_record_end();
+	return NULL;
+}
+
+static void test_qgl_record(void) {
+	pthread_t t[2];
+	int n[2] = { 30, 70 };
+
+	qgl_flush();
+
+	/* Other threads record, the GL thread submits */
+	for (int i = 0; i < 2; i++)
+		pthread_create(&t[i], NULL, record_thread, &n[i]);
+	for (int i = 0; i < 2; i++)
+		pthread_join(t[i], NULL);
+
+	qgl_flush();
+	assert(qgl_stat(QGL_STAT_QUADS) == 0);
+
+	qgl_record_submit();
+	qgl_flush();
+	assert(qgl_stat(QGL_STAT_QUADS) == 100);
+	assert(qgl_stat(QGL_STAT_DRAW_CALLS) == 1);
+
+	/* Nothing new: the last recordings are drawn again */
+	qgl_record_submit();
+	qgl_flush();
+	assert(qgl_stat(QGL_STAT_QUADS) == 100);
+
+	/* The GL thread records too; newer recordings replace older */
+	qgl_record_begin(0);
+	qgl_fill(0, 0, 4, 4, 0xFF0000FF);
+	qgl_fill(8, 0, 4, 4, 0xFF0000FF);
+	qgl_record_end();
+	qgl_record_submit();
+	qgl_flush();
+	assert(qgl_stat(QGL_STAT_QUADS) == 102);
+
+	qgl_record_begin(0);
+	qgl_fill(0, 0, 4, 4, 0xFF0000FF);
+	qgl_record_end();
+	qgl_record_submit();
+	qgl_flush();
+	assert(qgl_stat(QGL_STAT_QUADS) == 101);
+
+	/* Empty recordings clear */
+	qgl_record_begin(0);
+	qgl_record_end();
+	qgl_record_submit();
+	qgl_flush();
+	assert(qgl_stat(QGL_STAT_QUADS) == 100);
+
+	printf("  test_qgl_record: PASS\n");
+}
+
+static void test_qgl_clip(void) {
+	qgl_flush();
+
+	/* Inside and straddling draws are kept, outside ones dropped */
+	qgl_clip_push(0, 0, 100, 100);
+	qgl_fill(10, 10, 20, 20, 0xFFFF0000);
+	qgl_fill(90, 90, 20, 20, 0xFFFF0000);
+	qgl_fill(200, 200, 20, 20, 0xFFFF0000);
+
+	/* Nested clips intersect */
+	qgl_clip_push(50, 50, 100, 100);
+	qgl_fill(120, 120, 10, 10, 0xFFFF0000);
+	qgl_fill(60, 60, 10, 10, 0xFFFF0000);
+	qgl_clip_pop();
+
+	qgl_clip_pop();
+	qgl_fill(200, 200, 20, 20, 0xFFFF0000);
+	qgl_flush();
+
+	assert(qgl_stat(QGL_STAT_QUADS) == 4);
+	assert(qgl_stat(QGL_STAT_CULLED) == 2);
+	assert(qgl_stat(QGL_STAT_DRAW_CALLS) == 1);
+
+	printf("  test_qgl_clip: PASS\n");
+}
+
+static void test_qgl_damage(void) {
+	uint32_t w, h;
+	qgl_size(&w, &h);
+
+	/* The first retained frame has nothing to build on */
+	qgl_hint(QGL_HINT_RETAIN, 1);
+	qgl_flush();
+	assert(qgl_stat(QGL_STAT_PRESENTED) == (uint64_t) w * h);
+
+	/* Later ones present only what was drawn */
+	qgl_fill(10, 10, 20, 20, 0xFFFF0000);
+	qgl_flush();
+	assert(qgl_stat(QGL_STAT_PRESENTED) == 400);
+
+	qgl_flush();
+	assert(qgl_stat(QGL_STAT_PRESENTED) == 0);
+
+	qgl_damage(0, 0, 5, 5);
+	qgl_flush();
+	assert(qgl_stat(QGL_STAT_PRESENTED) == 25);
+
+	qgl_hint(QGL_HINT_RETAIN, 0);
+	qgl_flush();
+	assert(qgl_stat(QGL_STAT_PRESENTED) == (uint64_t) w * h);
+
+	printf("  test_qgl_damage: PASS\n");
+}
+
+/* compare one kernel with the C one over every length and phase */
+static int pixconv_check(qgl_pixfmt_t fmt, int dither, const char *kernel,
+		const uint8_t *src) {
+	uint8_t want[40 * 3 + 64], got[sizeof(want)];
+	uint32_t bpp = fmt == QGL_PIX_RGB565 ? 2 : 3, n, p, i;
+
+	qgl_pixconv_init(fmt, dither);
+	if (qgl_pixconv_use(kernel))
+		return 0;
+
+	for (n = 0; n <= 40; n++)
+		for (p = 0; p < 16; p++) {
+			memset(want, 0xA5, sizeof(want));
+			memset(got, 0xA5, sizeof(got));
+			qgl_pixconv_use("c");
+			qgl_pixconv(want, src, n, p & 3, p >> 2);
+			qgl_pixconv_use(kernel);
+			qgl_pixconv(got, src, n, p & 3, p >> 2);
+
+			/* nothing is written past the n pixels */
+			assert(!memcmp(got, want, sizeof(got)));
+			for (i = n * bpp; i < sizeof(got); i++)
+				assert(got[i] == 0xA5);
+		}
+
+	return 1;
+}
+
+/* Every kernel the CPU runs converts exactly like the C ones */
+static void test_qgl_pixconv(void) {
+	static const char *kernels[] = { "sse2", "ssse3", "avx2", "neon" };
+	uint8_t src[40 * 4];
+	uint32_t seed = 12345, i, k;
+	int tested = 0;
+
+	for (i = 0; i < sizeof(src); i++) {
+		seed = seed * 1103515245 + 12345;
+		src[i] = (uint8_t) (seed >> 16);
+	}
+	/* near white, so dithering saturates */
+	memset(src + 8 * 4, 0xFE, 8 * 4);
+
+	for (k = 0; k < sizeof(kernels) / sizeof(*kernels); k++) {
+		tested += pixconv_check(QGL_PIX_RGB565, 0, kernels[k], src);
+		tested += pixconv_check(QGL_PIX_RGB565, 1, kernels[k], src);
+		tested += pixconv_check(QGL_PIX_RGB888, 0, kernels[k], src);
+	}
+
+	printf("  test_qgl_pixconv: PASS (%d kernel runs)\n", tested);
+}
+
+static uint64_t test_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000 + (uint64_t) ts.tv_nsec / 1000000;
+}
+
+static void test_qgl_pace(void) {
+	uint64_t t0, ns;
+	int i;
+
+	/* A fixed rate spaces frames by its period */
+	qgl_pace(QGL_PACE_FIXED, 100);
+	qgl_flush();
+	t0 = test_ms();
+	for (i = 0; i < 10; i++)
+		qgl_flush();
+	assert(test_ms() - t0 >= 90);
+	ns = qgl_stat(QGL_STAT_FRAME_NS);
+	assert(ns > 1000000 && ns < 50000000);
+
+	/* Waiting for the deadline leaves the frame on time */
+	qgl_pace_wait();
+	qgl_poll();
+	qgl_flush();
+	assert(qgl_stat(QGL_STAT_MISSED) == 0);
+
+	/* Uncapped frames don't wait */
+	qgl_pace(QGL_PACE_UNCAPPED, 0);
+	t0 = test_ms();
+	for (i = 0; i < 10; i++)
+		qgl_flush();
+	assert(test_ms() - t0 < 90);
+
+	qgl_pace(QGL_PACE_VSYNC, 0);
+
+	printf("  test_qgl_pace: PASS\n");
+}
+
+/* The present queue behind the fbdev backend (src/present.c) */
+typedef uint64_t present_fn_t(const uint8_t *frame,
+		uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1);
+void qgl_present_start(uint32_t depth, int drop, present_fn_t *fn);
+uint64_t qgl_present_push(const uint8_t *canvas,
+		uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1);
+void qgl_present_stop(void);
+
+/*
+ * Frame k sets pixel k of the top row to k. The presenter waits for
+ * `go`, then notes which frame it got, its damage, and whether the
+ * buffer held every frame up to it.
+ */
+static struct {
+	sem_t go;
+	atomic_uint entered, n;
+	uint32_t frame[16], x0[16], x1[16];
+	int whole[16];
+} g_pq;
+
+static uint64_t present_gated(const uint8_t *frame,
+		uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1) {
+	const uint32_t *px = (const uint32_t *) frame;
+	uint32_t n = atomic_load(&g_pq.n), k;
+
+	atomic_fetch_add(&g_pq.entered, 1);
+	sem_wait(&g_pq.go);
+
+	g_pq.frame[n] = px[x1 - 1];
+	g_pq.x0[n] = x0;
+	g_pq.x1[n] = x1;
+	g_pq.whole[n] = 1;
+	for (k = 1; k <= g_pq.frame[n]; k++)
+		if (px[k] != k)
+			g_pq.whole[n] = 0;
+
+	atomic_store(&g_pq.n, n + 1);
+	return y1 - y0;
+}
+
+static void present_frame(uint32_t *canvas, uint32_t k) {
+	canvas[k] = k;
+	qgl_present_push((const uint8_t *) canvas, k, 0, k + 1, 1);
+}
+
+static void present_until(atomic_uint *v, uint32_t n) {
+	while (atomic_load(v) < n)
+		usleep(1000);
+}
+
+static void *present_open_gate(void *arg) {
+	(void) arg;
+	usleep(50000);
+	for (int i = 0; i < 16; i++)
+		sem_post(&g_pq.go);
+	return NULL;
+}
+
+static void test_qgl_present(void) {
+	uint32_t w, h, *canvas, k;
+	uint64_t t0;
+	pthread_t t;
+
+	qgl_size(&w, &h);
+	canvas = calloc((size_t) w * h, 4);
+	assert(canvas);
+	sem_init(&g_pq.go, 0, 0);
+
+	/* A full queue blocks until the presenter frees a buffer */
+	qgl_present_start(1, 0, present_gated);
+	present_frame(canvas, 1);
+	present_until(&g_pq.entered, 1);
+	present_frame(canvas, 2);
+	pthread_create(&t, NULL, present_open_gate, NULL);
+	t0 = test_ms();
+	present_frame(canvas, 3);
+	assert(test_ms() - t0 >= 40);
+	pthread_join(t, NULL);
+	present_until(&g_pq.n, 3);
+	qgl_present_stop();
+	for (k = 0; k < 3; k++)
+		assert(g_pq.frame[k] == k + 1 && g_pq.whole[k]);
+
+	/* Dropping hands the oldest queued frame's damage to the next */
+	memset(canvas, 0, (size_t) w * h * 4);
+	while (!sem_trywait(&g_pq.go))
+		;
+	atomic_store(&g_pq.entered, 0);
+	atomic_store(&g_pq.n, 0);
+	qgl_flush();
+	qgl_present_start(1, 1, present_gated);
+	present_frame(canvas, 1);
+	present_until(&g_pq.entered, 1);
+	for (k = 2; k <= 5; k++)
+		present_frame(canvas, k);
+	sem_post(&g_pq.go);
+	sem_post(&g_pq.go);
+	present_until(&g_pq.n, 2);
+	qgl_flush();
+	assert(qgl_stat(QGL_STAT_DROPPED) == 3);
+	assert(g_pq.frame[0] == 1 && g_pq.frame[1] == 5);
+	assert(g_pq.x0[1] == 2 && g_pq.x1[1] == 6);
+	assert(g_pq.whole[1]);
+
+	/* Buffers wrap around, each kept current */
+	atomic_store(&g_pq.n, 0);
+	for (k = 6; k < 6 + 8; k++)
+		sem_post(&g_pq.go);
+	for (k = 6; k < 6 + 8; k++) {
+		present_frame(canvas, k);
+		present_until(&g_pq.n, k - 5);
+	}
+	for (k = 0; k < 8; k++)
+		assert(g_pq.frame[k] == k + 6 && g_pq.whole[k]);
+
+	/* Stopping lets the frame on show finish and drops queued ones */
+	atomic_store(&g_pq.entered, 0);
+	present_frame(canvas, 14);
+	present_until(&g_pq.entered, 1);
+	present_frame(canvas, 15);
+	pthread_create(&t, NULL, present_open_gate, NULL);
+	qgl_present_stop();
+	pthread_join(t, NULL);
+	assert(atomic_load(&g_pq.n) == 9 && g_pq.frame[8] == 14);
+
+	sem_destroy(&g_pq.go);
+	free(canvas);
+	printf("  test_qgl_present: PASS\n");
+}
+
+static void test_qgl_video(void) {
+	const char *path = "/tmp/qgl_test_video.raw";
+	uint32_t w, h, words[5];
+	uint64_t frame[2];
+	unsigned char magic[4];
+	FILE *fp;
+	long size;
+	int i;
+
+	qgl_size(&w, &h);
+	assert(qgl_video_open(path, QGL_VIDEO_RAW, 30, 8, 0) == 0);
+	assert(qgl_video_open(path, QGL_VIDEO_RAW, 30, 8, 0) == -1);
+	for (i = 0; i < 3; i++)
+		qgl_flush();
+	assert(qgl_video_close() == 0);
+
+	fp = fopen(path, "rb");
+	assert(fp);
+	assert(fread(words, sizeof(words), 1, fp) == 1);
+	assert(!memcmp(words, "QGLV", 4));
+	assert(words[1] == 1 && words[2] == w && words[3] == h);
+	assert(words[4] == 30);
+	assert(fread(frame, sizeof(frame), 1, fp) == 1);
+	assert(frame[0] == 1 && frame[1] > 0);
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	fclose(fp);
+	assert(size == (long) (sizeof(words)
+				+ 3 * (sizeof(frame) + (size_t) w * h * 4)));
+
+	/* compressed streams are plain gzip, or LZ4 frames */
+	assert(qgl_video_open(path, QGL_VIDEO_Y4M, 0, 0, 1) == 0);
+	qgl_flush();
+	qgl_video_close();
+	fp = fopen(path, "rb");
+	assert(fp && fread(magic, 1, 4, fp) == 4);
+	assert((magic[0] == 0x1f && magic[1] == 0x8b)
+			|| !memcmp(magic, "\x04\x22\x4d\x18", 4));
+	fclose(fp);
+
+	remove(path);
+	printf("  test_qgl_video: PASS\n");
+}
+
+/* State cache binding (src/state.c) */
+void qgl_bind_fbo(unsigned int fbo);
+
+typedef struct {
+	const uint8_t *pixels;
+	uint32_t w, h, x0, y0, x1, y1;
+	int calls;
+	int unbind;	/* bind the window's framebuffer, as GLFW does */
+} frame_seen_t;
+
+static void frame_cb(const uint8_t *pixels, uint32_t w, uint32_t h,
+		uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1, void *ctx) {
+	frame_seen_t *seen = ctx;
+
+	seen->pixels = pixels;
+	seen->w = w;
+	seen->h = h;
+	seen->x0 = x0;
+	seen->y0 = y0;
+	seen->x1 = x1;
+	seen->y1 = y1;
+	seen->calls++;
+	if (seen->unbind)
+		qgl_bind_fbo(0);
+}
+
+/*
+ * Asynchronous readback presents each frame one flush late, with the
+ * damage of the frame it presents. It has to be asked for before GL
+ * starts, so it runs in a child, before any test starts GL here.
+ */
+static void test_qgl_async_readback(void) {
+	static uint8_t pixels[64 * 32 * 4];
+	static frame_seen_t seen;
+	const uint32_t *px = (const uint32_t *) pixels;
+	int status;
+	pid_t pid;
+
+	pid = fork();
+	assert(pid >= 0);
+	if (pid) {
+		assert(waitpid(pid, &status, 0) == pid);
+		assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+		printf("  test_qgl_async_readback: PASS\n");
+		return;
+	}
+
+	qgl_hint(QGL_HINT_ASYNC_READBACK, 1);
+	qgl_headless(64, 32, pixels, frame_cb, &seen);
+	qgl_init();
+	qgl_hint(QGL_HINT_RETAIN, 1);
+	memset(pixels, 0x55, sizeof(pixels));
+
+	/* Nothing has been read back yet */
+	qgl_fill(0, 0, 10, 10, 0xFFFFFFFF);
+	qgl_flush();
+	assert(seen.calls == 1);
+	assert(seen.x0 >= seen.x1);
+	assert(px[0] == 0x55555555);
+
+	/* The first frame arrives with the second, with its own damage */
+	qgl_fill(20, 4, 4, 4, 0xFFFF0000);
+	qgl_flush();
+	assert(seen.calls == 2);
+	assert(seen.x0 == 0 && seen.y0 == 0);
+	assert(seen.x1 == 64 && seen.y1 == 32);
+	assert(px[0] == 0xFFFFFFFF && px[10] == 0xFF000000);
+	assert(px[5 * 64 + 21] == 0xFF000000);
+
+	qgl_flush();
+	assert(seen.calls == 3);
+	assert(seen.x0 == 20 && seen.y0 == 4);
+	assert(seen.x1 == 24 && seen.y1 == 8);
+	assert(px[5 * 64 + 21] == 0xFFFF0000);
+	_exit(0);
+}
+
+/*
+ * Switches the backend and starts GL, so it runs after the tests that
+ * don't need a context; the ones after it can read pixels back.
+ */
+static frame_seen_t g_headless_seen;
+
+static void test_qgl_headless(void) {
+	static uint8_t pixels[64 * 32 * 4];
+	frame_seen_t *seen = &g_headless_seen;
+	const uint32_t *px = (const uint32_t *) pixels;
+	uint32_t w, h;
+
+	qgl_headless(64, 32, pixels, frame_cb, seen);
+	qgl_init();
+	qgl_size(&w, &h);
+	assert(w == 64 && h == 32);
+
+	/* Frames are read straight into the caller's buffer */
+	memset(pixels, 0x55, sizeof(pixels));
+	qgl_fill(0, 0, 10, 10, 0xFFFFFFFF);
+	qgl_flush();
+	assert(seen->calls == 1);
+	assert(seen->pixels == pixels);
+	assert(seen->w == 64 && seen->h == 32);
+	assert(seen->x0 == 0 && seen->y0 == 0);
+	assert(seen->x1 == 64 && seen->y1 == 32);
+	assert(px[0] == 0xFFFFFFFF && px[9 * 64 + 9] == 0xFFFFFFFF);
+	assert(px[10] == 0xFF000000 && px[10 * 64] == 0xFF000000);
+	assert(px[31 * 64 + 63] == 0xFF000000);
+
+	qgl_flush();
+	assert(seen->calls == 2);
+	assert(px[0] == 0xFF000000);
+	printf("  test_qgl_headless: PASS\n");
+}
+
+/*
+ * Retained frames keep drawing to the frame after the backend binds its
+ * own. Runs before export starts, as reading slots back rebinds it.
+ */
+static void test_qgl_retain(void) {
+	uint32_t w, h, *pixels;
+
+	qgl_size(&w, &h);
+	pixels = malloc((size_t) w * h * 4);
+	assert(pixels);
+
+	g_headless_seen.unbind = 1;
+	qgl_hint(QGL_HINT_RETAIN, 1);
+	qgl_fill(0, 0, 10, 10, 0xFFFFFFFF);
+	qgl_flush();
+	qgl_fill(20, 4, 4, 4, 0xFFFF0000);
+	qgl_flush();
+	qgl_capture(pixels);
+
+	assert(pixels[0] == 0xFFFFFFFF && pixels[9 * w + 9] == 0xFFFFFFFF);
+	assert(pixels[5 * w + 21] == 0xFFFF0000);
+	assert(pixels[5 * w + 19] == 0xFF000000);
+
+	qgl_hint(QGL_HINT_RETAIN, 0);
+	qgl_flush();
+	qgl_fill(20, 4, 4, 4, 0xFF00FF00);
+	qgl_capture(pixels);
+	assert(pixels[0] == 0xFF000000 && pixels[5 * w + 21] == 0xFF00FF00);
+	qgl_flush();
+	g_headless_seen.unbind = 0;
+	free(pixels);
+
+	printf("  test_qgl_retain: PASS\n");
+}
+
+/* A frame past the ring's first regions still draws every quad */
+static void test_qgl_ring_grow(void) {
+	uint32_t w, h, *pixels, i, n = 100000;
+
+	qgl_size(&w, &h);
+	pixels = malloc((size_t) w * h * 4);
+	assert(pixels);
+
+	for (i = 0; i < n; i++)
+		qgl_fill(i % w, i / w % h, 1, 1,
+				i / (w * h) % 2 ? 0xFF0000FF : 0xFFFF0000);
+	qgl_capture(pixels);
+	qgl_flush();
+	assert(qgl_stat(QGL_STAT_QUADS) == n);
+
+	/* the last quads drawn on each pixel win */
+	for (i = n - w * h; i < n; i++)
+		assert(pixels[i % (w * h)] == (i / (w * h) % 2
+					? 0xFF0000FF : 0xFFFF0000));
+	free(pixels);
+
+	printf("  test_qgl_ring_grow: PASS\n");
+}
+
+/* Slots hold whole frames, even those written from partial damage */
+static void test_qgl_export(void) {
+	const qgl_export_header_t *hdr;
+	const qgl_export_slot_t *slot;
+	const uint32_t *px;
+	int mem_fd, event_fd, fd2, ev2;
+	uint64_t count = 0;
+	struct stat st;
+	uint32_t w, h;
+
+	qgl_size(&w, &h);
+	assert(qgl_export(3, &mem_fd, &event_fd) == 0);
+	assert(mem_fd >= 0 && event_fd >= 0);
+	assert(qgl_export(3, &fd2, &ev2) == 0);
+	assert(fd2 == mem_fd && ev2 == event_fd);
+
+	assert(fstat(mem_fd, &st) == 0);
+	hdr = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED,
+			mem_fd, 0);
+	assert(hdr != MAP_FAILED);
+	assert(hdr->magic == QGL_EXPORT_MAGIC);
+	assert(hdr->version == QGL_EXPORT_VERSION);
+	assert(hdr->width == w && hdr->height == h);
+	assert(hdr->stride == w * 4 && hdr->nslots == 3);
+	assert(hdr->slot_size >= (uint64_t) w * h * 4);
+	assert(hdr->data_offset + 3 * hdr->slot_size <= (uint64_t) st.st_size);
+	assert(hdr->latest == 0);
+
+	qgl_fill(0, 0, 10, 10, 0xFFFFFFFF);
+	qgl_flush();
+	assert(hdr->latest == 1);
+	slot = &hdr->slot[1];
+	px = (const uint32_t *) ((const uint8_t *) hdr + hdr->data_offset
+			+ hdr->slot_size);
+	assert(slot->frame == 1);
+	assert(slot->seq && slot->seq % 2 == 0);
+	assert(slot->x0 == 0 && slot->y0 == 0);
+	assert(slot->x1 == w && slot->y1 == h);
+	assert(px[0] == 0xFFFFFFFF && px[9 * w + 9] == 0xFFFFFFFF);
+	assert(px[10] == 0xFF000000 && px[(h - 1) * w + w - 1] == 0xFF000000);
+
+	/* Retained frames damage only what was drawn */
+	qgl_hint(QGL_HINT_RETAIN, 1);
+	qgl_fill(0, 0, 10, 10, 0xFFFFFFFF);
+	qgl_flush();
+	qgl_fill(20, 4, 4, 4, 0xFFFF0000);
+	qgl_flush();
+	assert(hdr->latest == 3);
+	slot = &hdr->slot[0];
+	px = (const uint32_t *) ((const uint8_t *) hdr + hdr->data_offset);
+	assert(slot->frame == 3);
+	assert(slot->time_ns >= hdr->slot[2].time_ns);
+	assert(slot->x0 == 20 && slot->y0 == 4);
+	assert(slot->x1 == 24 && slot->y1 == 8);
+	assert(px[5 * w + 21] == 0xFFFF0000);
+	assert(px[0] == 0xFFFFFFFF && px[10] == 0xFF000000);
+
+	/* A slot written again catches up on the frames it missed */
+	qgl_flush();
+	slot = &hdr->slot[1];
+	px = (const uint32_t *) ((const uint8_t *) hdr + hdr->data_offset
+			+ hdr->slot_size);
+	assert(slot->frame == 4);
+	assert(px[5 * w + 21] == 0xFFFF0000);
+	assert(px[0] == 0xFFFFFFFF && px[4 * w + 19] == 0xFF000000);
+	qgl_hint(QGL_HINT_RETAIN, 0);
+
+	assert(read(event_fd, &count, sizeof(count)) == sizeof(count));
+	assert(count == 4);
+
+	munmap((void *) hdr, (size_t) st.st_size);
+	printf("  test_qgl_export: PASS\n");
+}
+
+static void test_qgl_capture(void) {
+	uint32_t w, h, *pixels;
+	size_t i;
+	qgl_size(&w, &h);
+
+	pixels = malloc((size_t) w * h * 4);
+	assert(pixels);
+
+	/* Pending draws are flushed before reading, and the frame goes on */
+	qgl_fill(0, 0, w, h, 0xFFFF0000);
+	qgl_capture(pixels);
+	qgl_fill(0, 0, 10, 10, 0xFF00FF00);
+	qgl_flush();
+	assert(qgl_stat(QGL_STAT_DRAW_CALLS) == 2);
+
+	/* What was drawn after the capture isn't in it */
+	for (i = 0; i < (size_t) w * h; i++)
+		assert(pixels[i] == 0xFFFF0000);
+	free(pixels);
+
+	printf("  test_qgl_capture: PASS\n");
+}
+
+static void *record_fill_thread(void *arg) {
+	qgl_record_begin(5);
+	qgl_fill(20, 20, 4, 4, *(uint32_t *) arg);
+	qgl_record_end();
+	return NULL;
+}
+
+/* Equal orders draw in the order their threads started recording */
+static void test_qgl_record_order(void) {
+	uint32_t colors[2] = { 0xFFFF0000, 0xFF0000FF }, w, h, *pixels;
+	pthread_t t;
+
+	qgl_size(&w, &h);
+	pixels = malloc((size_t) w * h * 4);
+	assert(pixels);
+
+	for (int i = 0; i < 2; i++) {
+		pthread_create(&t, NULL, record_fill_thread, &colors[i]);
+		pthread_join(t, NULL);
+	}
+
+	qgl_record_submit();
+	qgl_capture(pixels);
+	assert(pixels[21 * w + 21] == 0xFF0000FF);
+	qgl_flush();
+	free(pixels);
+
+	printf("  test_qgl_record_order: PASS\n");
+}
+
 int main(void) {
 	printf("test_core:\n");
 	
@@ -96,6 +853,23 @@ int main(void) {
 	test_qgl_poll();
 	test_qgl_tint();
 	test_multiple_operations();
+	test_qgl_batch_stats();
+	test_qgl_state_skipped();
+	test_qgl_cmdlist();
+	test_qgl_record();
+	test_qgl_clip();
+	test_qgl_damage();
+	test_qgl_pixconv();
+	test_qgl_pace();
+	test_qgl_present();
+	test_qgl_video();
+	test_qgl_async_readback();
+	test_qgl_headless();
+	test_qgl_retain();
+	test_qgl_ring_grow();
+	test_qgl_export();
+	test_qgl_capture();
+	test_qgl_record_order();
 	
 	printf("test_core: ALL TESTS PASSED\n");
 	return 0;
@@ -194,6 +194,31 @@ static void test_font_close(void) {
 	printf("  test_font_close: PASS\n");
 }
 
+static void test_font_stale_ref(void) {
+	uint32_t old_ref, new_ref, w = 0, h = 0;
+
+	old_ref = qgl_font_open("tests/fixtures/test_font.png", 8, 8, 32, 126);
+	assert(old_ref != QM_MISS);
+	qgl_font_close(old_ref);
+
+	/* The slot is reused, but the old ref must not reach the new font */
+	new_ref = qgl_font_open("tests/fixtures/test_font.png", 8, 8, 32, 126);
+	assert(new_ref != QM_MISS);
+	assert(new_ref != old_ref);
+
+	qgl_font_measure(&w, &h, old_ref, "Hello", 0, 0, 1000, 1000, 1,
+		QUI_WS_NORMAL, QUI_WB_NORMAL);
+	assert(w == 0 && h == 0);
+
+	qgl_font_measure(&w, &h, new_ref, "Hello", 0, 0, 1000, 1000, 1,
+		QUI_WS_NORMAL, QUI_WB_NORMAL);
+	assert(h == 8);
+
+	qgl_font_close(new_ref);
+
+	printf("  test_font_stale_ref: PASS\n");
+}
+
 int main(void) {
 	printf("test_fonts:\n");
 	
@@ -206,6 +231,7 @@ int main(void) {
 	test_font_nowrap();
 	test_font_scaling();
 	test_font_close();
+	test_font_stale_ref();
 	
 	printf("test_fonts: ALL TESTS PASSED\n");
 	return 0;
@@ -4,9 +4,20 @@
  */
 
 #include <assert.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <ttypt/qgl.h>
+#include <ttypt/qgl-bundle.h>
+#include <ttypt/qgl-font.h>
+#include <ttypt/qgl-tm.h>
 #include <ttypt/qmap.h>
 
 static void test_tex_load(void) {
@@ -178,6 +189,371 @@ static void test_multiple_textures(void) {
 	printf("  test_multiple_textures: PASS\n");
 }
 
+static void test_tex_atlas(void) {
+	qgl_atlas_stats_t st;
+	uint32_t tm, font, w, h;
+
+	qgl_hint(QGL_HINT_ATLAS, 128);
+
+	tm = qgl_tex_load("tests/fixtures/test_tilemap.png");
+	font = qgl_tex_load("tests/fixtures/test_font.png");
+	assert(tm != QM_MISS && font != QM_MISS);
+
+	qgl_atlas_stats(&st);
+	assert(st.pages == 1);
+	assert(st.textures == 2);
+	assert(st.used_area == 2 * 128 * 128);
+	assert(st.used_area + st.lost_area <= st.page_area);
+
+	/* Atlas entries keep their own size and CPU pixels */
+	qgl_tex_size(&w, &h, tm);
+	assert(w == 128 && h == 128);
+	qgl_tex_paint(tm, 3, 3, 0xFF123456);
+	assert(qgl_tex_pick(tm, 3, 3) == 0xFF123456);
+
+	/* Both live on one page, so they share a draw call */
+	qgl_flush();
+	qgl_tex_draw(tm, 0, 0, 128, 128);
+	qgl_tex_draw(font, 128, 0, 128, 128);
+	qgl_tex_draw(tm, 256, 0, 64, 64);
+	qgl_flush();
+	assert(qgl_stat(QGL_STAT_DRAW_CALLS) == 1);
+
+	qgl_hint(QGL_HINT_ATLAS, 0);
+
+	printf("  test_tex_atlas: PASS\n");
+}
+
+static void on_loaded(unsigned ref, int ok, void *ctx) {
+	int *res = ctx;
+
+	(void) ref;
+	*res = ok ? 1 : -1;
+}
+
+/* grows the image table and the name map under its caller */
+static void on_loaded_queue(unsigned ref, int ok, void *ctx) {
+	char name[64];
+	int i;
+
+	for (i = 0; i < 64; i++) {
+		snprintf(name, sizeof(name), "tests/fixtures/missing-%d.png", i);
+		qgl_tex_load_async(name, NULL, NULL);
+	}
+	on_loaded(ref, ok, ctx);
+}
+
+static void test_tex_load_async(void) {
+	/* other spellings of loaded fixtures, so they load anew */
+	const char *small = "tests/fixtures/./test_small.png";
+	const char *tm_name = "tests/fixtures/./test_tilemap.png";
+	int res_small = 0, res_again = 0, res_missing = 0;
+	uint32_t small_ref, tm, missing, w = 1, h = 1, sw, sh;
+
+	qgl_hint(QGL_HINT_LOAD_THREADS, 2);
+
+	small_ref = qgl_tex_load_async(small, on_loaded, &res_small);
+	tm = qgl_tex_load_async(tm_name, NULL, NULL);
+	missing = qgl_tex_load_async("tests/fixtures/missing.png",
+			on_loaded, &res_missing);
+	assert(small_ref != QM_MISS && tm != QM_MISS && missing != QM_MISS);
+
+	/* Nothing is registered before a flush or a wait */
+	assert(qgl_tex_ready(small_ref) == 0);
+	qgl_tex_size(&w, &h, small_ref);
+	assert(w == 0 && h == 0);
+	qgl_tex_draw(small_ref, 0, 0, 8, 8);
+	assert(qgl_tex_load_async(small, on_loaded, &res_again) == small_ref);
+
+	/* A synchronous load of a pending file waits for it */
+	assert(qgl_tex_load(tm_name) == tm);
+	assert(qgl_tex_ready(tm) == 1);
+	qgl_tex_size(&w, &h, tm);
+	assert(w == 128 && h == 128);
+
+	qgl_tex_wait();
+	assert(res_small == 1 && res_again == 1);
+	assert(res_missing == -1);
+	assert(qgl_tex_ready(small_ref) == 1);
+	assert(qgl_tex_ready(missing) == -1);
+
+	/* A failed load can be retried under the same reference */
+	assert(qgl_tex_load_async("tests/fixtures/missing.png", NULL, NULL)
+			== missing);
+	assert(qgl_tex_ready(missing) == 0);
+	qgl_tex_wait();
+	assert(qgl_tex_ready(missing) == -1);
+
+	qgl_tex_size(&sw, &sh, qgl_tex_load("tests/fixtures/test_small.png"));
+	qgl_tex_size(&w, &h, small_ref);
+	assert(w == sw && h == sh);
+	assert(qgl_tex_pick(small_ref, 1, 1) == qgl_tex_pick(
+				qgl_tex_load("tests/fixtures/test_small.png"),
+				1, 1));
+
+	/* Ready textures call back at once */
+	res_again = 0;
+	qgl_tex_load_async(small, on_loaded, &res_again);
+	assert(res_again == 1);
+
+	/* Callbacks run while a load waits may queue more */
+	res_again = 0;
+	tm = qgl_tex_load_async("tests/fixtures/././test_tilemap.png",
+			on_loaded_queue, &res_again);
+	assert(qgl_tex_load("tests/fixtures/././test_tilemap.png") == tm);
+	assert(res_again == 1 && qgl_tex_ready(tm) == 1);
+	qgl_tex_wait();
+
+	qgl_hint(QGL_HINT_LOAD_THREADS, 0);
+
+	printf("  test_tex_load_async: PASS\n");
+}
+
+static atomic_int g_rec_stop;
+
+static void *record_tex_thread(void *arg) {
+	uint32_t ref = *(uint32_t *) arg;
+
+	while (!atomic_load(&g_rec_stop)) {
+		qgl_record_begin(0);
+		qgl_tex_draw(ref, 0, 0, 8, 8);
+		qgl_record_end();
+	}
+	return NULL;
+}
+
+/* Flushes finish loads while other threads record textures */
+static void test_tex_load_async_record(void) {
+	static char names[64][200];
+	uint32_t ref = qgl_tex_load("tests/fixtures/test_small.png");
+	uint32_t refs[64];
+	pthread_t t;
+	int i, j, left;
+
+	/* queued while nobody records, as new textures must be */
+	for (i = 0; i < 64; i++) {
+		strcpy(names[i], "tests/fixtures/");
+		for (j = 0; j < i + 4; j++)
+			strcat(names[i], "./");
+		strcat(names[i], "test_small.png");
+		refs[i] = qgl_tex_load_async(names[i], NULL, NULL);
+	}
+
+	atomic_store(&g_rec_stop, 0);
+	pthread_create(&t, NULL, record_tex_thread, &ref);
+	do {
+		qgl_flush();
+		for (i = left = 0; i < 64; i++)
+			left += !qgl_tex_ready(refs[i]);
+	} while (left);
+	atomic_store(&g_rec_stop, 1);
+	pthread_join(t, NULL);
+
+	qgl_record_submit();
+	qgl_flush();
+	printf("  test_tex_load_async_record: PASS\n");
+}
+
+static void copy_file(const char *from, const char *to) {
+	char buf[4096];
+	FILE *in = fopen(from, "rb"), *out = fopen(to, "wb");
+	size_t n;
+
+	assert(in && out);
+	while ((n = fread(buf, 1, sizeof(buf), in)))
+		assert(fwrite(buf, 1, n, out) == n);
+	fclose(in);
+	fclose(out);
+}
+
+/* Path of the only cache entry, or "" */
+static int cache_entries(const char *dir, char *entry, size_t len) {
+	DIR *d = opendir(dir);
+	struct dirent *de;
+	int n = 0;
+
+	assert(d);
+	while ((de = readdir(d))) {
+		if (!strstr(de->d_name, ".qtc"))
+			continue;
+		snprintf(entry, len, "%s/%s", dir, de->d_name);
+		n++;
+	}
+	closedir(d);
+	return n;
+}
+
+static void test_tex_cache(void) {
+	char root[] = "/tmp/qgl_tex_cache_XXXXXX";
+	char dir[64], src[64], name[80], entry[160];
+	uint32_t ref, w, h, orig;
+	uint8_t junk[4] = { 1, 2, 3, 4 };
+	FILE *fp;
+
+	assert(mkdtemp(root));
+	snprintf(dir, sizeof(dir), "%s/cache", root);
+	snprintf(src, sizeof(src), "%s/src.png", root);
+	copy_file("tests/fixtures/test_small.png", src);
+	assert(qgl_tex_cache(dir, 0) == 0);
+
+	/* A miss decodes and stores the pixels */
+	ref = qgl_tex_load(src);
+	orig = qgl_tex_pick(ref, 0, 0);
+	assert(cache_entries(dir, entry, sizeof(entry)) == 1);
+
+	/* Later loads use them: spoil the stored pixels to tell */
+	fp = fopen(entry, "r+b");
+	assert(fp && !fseek(fp, 4096, SEEK_SET));
+	assert(fwrite(junk, 1, sizeof(junk), fp) == sizeof(junk));
+	fclose(fp);
+	snprintf(name, sizeof(name), "%s/./src.png", root);
+	ref = qgl_tex_load(name);
+	assert(qgl_tex_pick(ref, 0, 0) == 0x04030201);
+	qgl_tex_paint(ref, 0, 0, orig);
+	qgl_tex_size(&w, &h, ref);
+	assert(w == 16 && h == 16);
+
+	/* Asynchronous loads go through the cache too */
+	snprintf(name, sizeof(name), "%s/././src.png", root);
+	ref = qgl_tex_load_async(name, NULL, NULL);
+	qgl_tex_wait();
+	assert(qgl_tex_pick(ref, 0, 0) == 0x04030201);
+
+	/* A new mtime alone doesn't, the content is the same */
+	{
+		struct timespec ts[2] = { { 1, 0 }, { 1, 0 } };
+
+		assert(!utimensat(AT_FDCWD, src, ts, 0));
+	}
+	snprintf(name, sizeof(name), "%s/./././src.png", root);
+	ref = qgl_tex_load(name);
+	assert(qgl_tex_pick(ref, 0, 0) == 0x04030201);
+
+	/* Changing the source invalidates its entry */
+	copy_file("tests/fixtures/test_texture.png", src);
+	snprintf(name, sizeof(name), "%s/.//src.png", root);
+	ref = qgl_tex_load(name);
+	qgl_tex_size(&w, &h, ref);
+	assert(w == 64 && h == 64);
+	assert(cache_entries(dir, entry, sizeof(entry)) == 1);
+
+	/* Past the cap, the least recently used entries go */
+	copy_file("tests/fixtures/test_small.png", src);
+	assert(qgl_tex_cache(dir, 1024) == 0);
+	assert(cache_entries(dir, entry, sizeof(entry)) == 0);
+
+	qgl_tex_cache(NULL, 0);
+	unlink(src);
+	rmdir(dir);
+	rmdir(root);
+
+	printf("  test_tex_cache: PASS\n");
+}
+
+/* Opens a copy of the test bundle with `len` bytes at `off` replaced */
+static uint32_t bundle_open_patched(size_t off, const void *val, size_t len) {
+	const char *path = "/tmp/qgl_test_bundle.qglb";
+	char buf[4096];
+	FILE *in = fopen("tests/fixtures/test_bundle.qglb", "rb");
+	FILE *out = fopen(path, "wb");
+	uint32_t b;
+	size_t n;
+
+	assert(in && out);
+	while ((n = fread(buf, 1, sizeof(buf), in)))
+		assert(fwrite(buf, 1, n, out) == n);
+	fseek(out, (long) off, SEEK_SET);
+	assert(fwrite(val, 1, len, out) == len);
+	fclose(in);
+	fclose(out);
+
+	b = qgl_bundle_open(path);
+	unlink(path);
+	return b;
+}
+
+static void test_bundle(void) {
+	const char *tex_name = "tests/fixtures/test_texture.png";
+	uint32_t orig, b, tex, small, tm, font, w, h;
+	const uint32_t zero = 0;
+	const uint8_t range[2] = { 'z', 'a' };
+	qgl_bundle_header_t hdr;
+	const qgl_tm_t *t;
+	FILE *fp;
+
+	orig = qgl_tex_load(tex_name);
+
+	b = qgl_bundle_open("tests/fixtures/test_bundle.qglb");
+	assert(b != QM_MISS);
+	assert(qgl_bundle_open("tests/fixtures/test_small.png") == QM_MISS);
+
+	/* Textures are found by name, also through qgl_tex_load() */
+	tex = qgl_bundle_ref(b, QGL_ASSET_TEX, tex_name);
+	assert(tex != QM_MISS && tex != orig);
+	assert(qgl_tex_load(tex_name) == tex);
+	assert(qgl_tex_ready(tex) == 1);
+	qgl_tex_size(&w, &h, tex);
+	assert(w == 64 && h == 64);
+	assert(qgl_tex_pick(tex, 0, 0) == qgl_tex_pick(orig, 0, 0));
+	assert(qgl_tex_pick(tex, 40, 10) == qgl_tex_pick(orig, 40, 10));
+	assert(qgl_tex_pick(tex, 63, 63) == qgl_tex_pick(orig, 63, 63));
+	qgl_tex_paint(tex, 5, 5, 0xFF654321);
+	assert(qgl_tex_pick(tex, 5, 5) == 0xFF654321);
+
+	/* Tilemaps and fonts come ready to use */
+	tm = qgl_bundle_ref(b, QGL_ASSET_TM, "tiles");
+	t = qgl_tm_get(tm);
+	assert(t && t->w == 16 && t->nx == 8 && t->ny == 8);
+	font = qgl_bundle_ref(b, QGL_ASSET_FONT, "mono");
+	assert(font != QM_MISS);
+	qgl_font_measure(&w, &h, font, "AB", 0, 0, 100, 100, 1,
+			QUI_WS_NORMAL, QUI_WB_NORMAL);
+	assert(w == 16 && h == 8);
+
+	assert(qgl_bundle_ref(b, QGL_ASSET_FONT, "tiles") == QM_MISS);
+	assert(qgl_bundle_ref(b, QGL_ASSET_TEX, "missing.png") == QM_MISS);
+
+	/* Textures of a page share a draw call */
+	small = qgl_bundle_ref(b, QGL_ASSET_TEX,
+			"tests/fixtures/test_small.png");
+	qgl_flush();
+	qgl_tex_draw(tex, 0, 0, 64, 64);
+	qgl_tex_draw(small, 64, 0, 16, 16);
+	qgl_tex_draw(tex, 80, 0, 64, 64);
+	qgl_flush();
+	assert(qgl_stat(QGL_STAT_DRAW_CALLS) == 1);
+
+	/* Closing drops its refs; names load from disk again */
+	qgl_bundle_close(b);
+	assert(qgl_tex_ready(tex) == -1);
+	assert(qgl_bundle_ref(b, QGL_ASSET_TEX, tex_name) == QM_MISS);
+	assert(qgl_tex_ready(orig) == 1);
+	tex = qgl_tex_load(tex_name);
+	assert(qgl_tex_ready(tex) == 1);
+	assert(qgl_tex_pick(tex, 5, 5) == qgl_tex_pick(orig, 5, 5));
+
+	/* Tilemaps and fonts that would divide by zero are refused */
+	fp = fopen("tests/fixtures/test_bundle.qglb", "rb");
+	assert(fp && fread(&hdr, sizeof(hdr), 1, fp) == 1);
+	fclose(fp);
+	assert(hdr.ntm && hdr.nfont);
+
+	b = bundle_open_patched(0, &hdr.magic, sizeof(hdr.magic));
+	assert(b != QM_MISS);
+	qgl_bundle_close(b);
+
+	assert(bundle_open_patched(hdr.tm + offsetof(qgl_bundle_tm_t, w),
+				&zero, sizeof(zero)) == QM_MISS);
+	assert(bundle_open_patched(hdr.font
+				+ offsetof(qgl_bundle_font_t, cell_h),
+				&zero, sizeof(zero)) == QM_MISS);
+	assert(bundle_open_patched(hdr.font
+				+ offsetof(qgl_bundle_font_t, first),
+				range, sizeof(range)) == QM_MISS);
+
+	printf("  test_bundle: PASS\n");
+}
+
 int main(void) {
 	printf("test_textures:\n");
 	
@@ -188,6 +564,11 @@ int main(void) {
 	test_tex_tint();
 	test_tex_pick_paint();
 	test_multiple_textures();
+	test_tex_atlas();
+	test_tex_load_async();
+	test_tex_load_async_record();
+	test_tex_cache();
+	test_bundle();
 	
 	printf("test_textures: ALL TESTS PASSED\n");
 	return 0;
@@ -212,6 +212,97 @@ static void test_qui_render_box_shadow(void) {
 	printf("  test_qui_render_box_shadow: PASS\n");
 }
 
+static void test_rounded_batching(void) {
+	qgl_flush();
+
+	/* Rounded rects and shadows share one program and batch */
+	qgl_box_shadow(0x80000000, 10, 10, 50, 50, 4, 4, 4, 4, 6, 2, 2);
+	qgl_box_shadow(0x80000000, 70, 10, 50, 50, 4, 4, 4, 4, 6, 2, 2);
+	qgl_border_radius(0xFFFFFFFF, 0, 10, 10, 50, 50, 4, 4, 4, 4, 0);
+	qgl_border_radius(0xFFFFFFFF, 0, 70, 10, 50, 50, 4, 4, 4, 4, 0);
+	qgl_border_radius(0xFFFFFFFF, 0, 130, 10, 50, 50, 4, 4, 4, 4, 0);
+	qgl_flush();
+
+	assert(qgl_stat(QGL_STAT_QUADS) == 5);
+	assert(qgl_stat(QGL_STAT_DRAW_CALLS) == 1);
+
+	printf("  test_rounded_batching: PASS\n");
+}
+
+static void test_layer_sorting(void) {
+	uint32_t a = qgl_tex_load("tests/fixtures/test_texture.png");
+	uint32_t b = qgl_tex_load("tests/fixtures/test_small.png");
+	int i;
+
+	qgl_flush();
+
+	/* Layered draws are queued, not lost */
+	qgl_layer(0);
+	for (i = 0; i < 10; i++) {
+		qgl_fill(i * 20, 100, 10, 10, 0xFF00FF00);
+		qgl_border_radius(0xFFFFFFFF, 0, i * 20, 120, 10, 10,
+				2, 2, 2, 2, 0);
+	}
+	qgl_layer(QGL_LAYER_NONE);
+	qgl_flush();
+	assert(qgl_stat(QGL_STAT_QUADS) == 20);
+	assert(qgl_stat(QGL_STAT_DRAW_CALLS) == 1);
+
+	/* Layers set out of order still share the batch */
+	qgl_layer(2);
+	qgl_fill(0, 0, 10, 10, 0xFF00FF00);
+	qgl_layer(1);
+	qgl_border_radius(0xFFFFFFFF, 0, 0, 0, 10, 10, 2, 2, 2, 2, 0);
+	qgl_layer(2 | QGL_LAYER_STRICT);
+	qgl_fill(20, 0, 10, 10, 0xFF00FF00);
+	qgl_flush();
+	assert(qgl_stat(QGL_STAT_QUADS) == 3);
+	assert(qgl_stat(QGL_STAT_DRAW_CALLS) == 1);
+	qgl_layer(QGL_LAYER_NONE);
+
+	/* Alternating textures break the batch each time */
+	for (i = 0; i < 10; i++) {
+		qgl_tex_draw(a, i * 20, 100, 10, 10);
+		qgl_tex_draw(b, i * 20, 120, 10, 10);
+	}
+	qgl_flush();
+	assert(qgl_stat(QGL_STAT_DRAW_CALLS) == 20);
+
+	/* In one layer they are grouped by texture */
+	qgl_layer(0);
+	for (i = 0; i < 10; i++) {
+		qgl_tex_draw(a, i * 20, 100, 10, 10);
+		qgl_tex_draw(b, i * 20, 120, 10, 10);
+	}
+	qgl_layer(QGL_LAYER_NONE);
+	qgl_flush();
+	assert(qgl_stat(QGL_STAT_QUADS) == 20);
+	assert(qgl_stat(QGL_STAT_DRAW_CALLS) == 2);
+
+	/* Layers are drawn in order, whatever order they were set in */
+	qgl_layer(2);
+	qgl_tex_draw(a, 0, 0, 10, 10);
+	qgl_layer(1);
+	qgl_tex_draw(b, 0, 0, 10, 10);
+	qgl_layer(2);
+	qgl_tex_draw(a, 20, 0, 10, 10);
+	qgl_layer(QGL_LAYER_NONE);
+	qgl_flush();
+	assert(qgl_stat(QGL_STAT_DRAW_CALLS) == 2);
+
+	/* Strict layers keep call order */
+	qgl_layer(0 | QGL_LAYER_STRICT);
+	for (i = 0; i < 10; i++) {
+		qgl_tex_draw(a, i * 20, 100, 10, 10);
+		qgl_tex_draw(b, i * 20, 120, 10, 10);
+	}
+	qgl_layer(QGL_LAYER_NONE);
+	qgl_flush();
+	assert(qgl_stat(QGL_STAT_DRAW_CALLS) == 20);
+
+	printf("  test_layer_sorting: PASS\n");
+}
+
 static void test_qui_render_display_none(void) {
 	uint32_t w, h;
 	qui_div_t *root, *hidden_child, *visible_child;
@@ -269,6 +360,10 @@ static void test_qui_clear(void) {
 
 int main(void) {
 	printf("test_ui_render:\n");
+
+	/* Textures need GL to get names of their own */
+	qgl_headless(0, 0, NULL, NULL, NULL);
+	qgl_init();
 	
 	test_qui_render_basic();
 	test_qui_render_text();
@@ -278,6 +373,8 @@ int main(void) {
 	test_qui_render_border_radius();
 	test_qui_render_padding();
 	test_qui_render_box_shadow();
+	test_rounded_batching();
+	test_layer_sorting();
 	test_qui_render_display_none();
 	test_qui_clear();
 	